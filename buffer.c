@@ -2,12 +2,18 @@
 #include "require.h"
 #include <stdio.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 //////////////////////////////////////////////////////////////////////
 
 void buf_grow(buffer_t* buf, size_t len) {
 
     size_t new_size = buf->size + len;
+
+    require(buf->storage == BUF_STORAGE_HEAP);
     
     if (!buf->data) {
         
@@ -31,7 +37,12 @@ void buf_grow(buffer_t* buf, size_t len) {
 
 void buf_free(buffer_t* buf) {
 
-    if (buf->data) { free(buf->data); }
+    if (buf->storage == BUF_STORAGE_MAPPED) {
+        munmap(buf->data, buf->size);
+    } else if (buf->storage == BUF_STORAGE_HEAP && buf->data) {
+        free(buf->data);
+    }
+    
     memset(buf, 0, sizeof(buffer_t));
 
 }
@@ -52,13 +63,13 @@ void buf_append_mem(buffer_t* buf, const void* src,
 
 //////////////////////////////////////////////////////////////////////
 
-void buf_append_file(buffer_t* buf, const char* filename,
-                     size_t max_length, int null_terminate) {
+int buf_try_append_file(buffer_t* buf, const char* filename,
+                        size_t max_length, int null_terminate) {
 
     FILE* fp = fopen(filename, "r");
     if (!fp) {
         fprintf(stderr, "error opening %s\n\n", filename);
-        exit(1);
+        return 0;
     }
     
     fseek(fp, 0, SEEK_END);
@@ -66,7 +77,8 @@ void buf_append_file(buffer_t* buf, const char* filename,
 
     if (fsize < 0 || fsize > max_length) {
         fprintf(stderr, "file exceeds maximum size!\n\n");
-        exit(1);
+        fclose(fp);
+        return 0;
     }
   
     fseek(fp, 0, SEEK_SET);
@@ -74,13 +86,95 @@ void buf_append_file(buffer_t* buf, const char* filename,
     buf_grow(buf, fsize + (null_terminate ? 1 : 0));
 
     int nread = fread(buf->data + buf->size, fsize, 1, fp);
+    fclose(fp);
 
     if (nread != 1) {
         fprintf(stderr, "error reading %s\n\n", filename);
-        exit(1);
+        return 0;
     }
 
     buf->size += fsize;
     if (null_terminate) { buf->data[buf->size] = 0; }
 
+    return 1;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+
+void buf_append_file(buffer_t* buf, const char* filename,
+                     size_t max_length, int null_terminate) {
+
+    if (!buf_try_append_file(buf, filename, max_length, null_terminate)) {
+        exit(1);
+    }
+
+}
+
+//////////////////////////////////////////////////////////////////////
+
+void buf_map_file(buffer_t* buf, const char* filename) {
+
+    if (!buf_try_map_file(buf, filename)) {
+        exit(1);
+    }
+
+}
+
+//////////////////////////////////////////////////////////////////////
+
+int buf_try_map_file(buffer_t* buf, const char* filename) {
+
+    require(!buf->data);
+
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "error opening %s\n\n", filename);
+        return 0;
+    }
+
+    struct stat sb;
+    if (fstat(fd, &sb)) {
+        fprintf(stderr, "error reading %s\n\n", filename);
+        close(fd);
+        return 0;
+    }
+
+    // can't map zero bytes, just leave the buffer empty
+    if (sb.st_size == 0) {
+        close(fd);
+        return 1;
+    }
+
+    void* data = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (data == MAP_FAILED) {
+        fprintf(stderr, "error mapping %s\n\n", filename);
+        return 0;
+    }
+
+    // everything we map gets consumed front to back exactly once
+    madvise(data, sb.st_size, MADV_SEQUENTIAL);
+
+    buf->data = (char*)data;
+    buf->alloc = sb.st_size;
+    buf->size = sb.st_size;
+    buf->storage = BUF_STORAGE_MAPPED;
+
+    return 1;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+
+void buf_borrow(buffer_t* buf, const void* data, size_t size) {
+
+    require(!buf->data);
+
+    buf->data = (char*)data;
+    buf->alloc = size;
+    buf->size = size;
+    buf->storage = BUF_STORAGE_BORROWED;
+    
 }
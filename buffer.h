@@ -8,9 +8,16 @@ typedef struct buffer {
     char*  data;
     size_t alloc;
     size_t size;
+    int    storage;
     
 } buffer_t;
 
+enum {
+    BUF_STORAGE_HEAP = 0,
+    BUF_STORAGE_MAPPED = 1,
+    BUF_STORAGE_BORROWED = 2
+};
+
 enum {
     BUF_RAW_APPEND = 0,
     BUF_NULL_TERMINATE = 1
@@ -26,4 +33,20 @@ void buf_append_mem(buffer_t* buf, const void* src,
 void buf_append_file(buffer_t* buf, const char* filename,
                      size_t max_length, int append_type);
 
+// same, but returns 0 instead of exiting if the file can't be read
+int buf_try_append_file(buffer_t* buf, const char* filename,
+                        size_t max_length, int append_type);
+
+// map an entire file read-only into an empty buffer instead of
+// copying it onto the heap; the buffer can't be grown or appended to
+// afterwards, and buf_free() unmaps it
+void buf_map_file(buffer_t* buf, const char* filename);
+
+// same, but returns 0 instead of exiting if the file can't be mapped
+int buf_try_map_file(buffer_t* buf, const char* filename);
+
+// make an empty buffer a read-only view of memory owned by someone
+// else, which buf_free() then leaves alone
+void buf_borrow(buffer_t* buf, const void* data, size_t size);
+
 #endif
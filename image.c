@@ -1,31 +1,27 @@
 #include "image.h"
 #include "require.h"
+#include "stringutils.h"
 
 #include <stdio.h>
 #include <png.h>
 #include <jpeglib.h>
 #include <string.h>
+#include <stdint.h>
+#include <setjmp.h>
 
-int write_png(const char* filename,
-              const unsigned char* data, 
-              size_t ncols,
-              size_t nrows,
-              size_t rowsz,
-              int yflip,
-              const float* pixel_scale) {
+int write_png_stream(FILE* fp,
+                     const unsigned char* data, 
+                     size_t ncols,
+                     size_t nrows,
+                     size_t rowsz,
+                     int yflip,
+                     const float* pixel_scale) {
 
-    FILE* fp = fopen(filename, "wb");
-    if (!fp) {
-        fprintf(stderr, "error opening %s for output\n", filename);
-        return 0;
-    }
-  
     png_structp png_ptr = png_create_write_struct
         (PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
 
     if (!png_ptr) {
         fprintf(stderr, "error creating write struct\n");
-        fclose(fp);
         return 0;
     }
   
@@ -33,14 +29,12 @@ int write_png(const char* filename,
     if (!info_ptr) {
         fprintf(stderr, "error creating info struct\n");
         png_destroy_write_struct(&png_ptr, (png_infopp)NULL);
-        fclose(fp);
         return 0;
     }  
 
     if (setjmp(png_jmpbuf(png_ptr))) {
         fprintf(stderr, "error processing PNG\n");
         png_destroy_write_struct(&png_ptr, &info_ptr);
-        fclose(fp);
         return 0;
     }
 
@@ -79,7 +73,33 @@ int write_png(const char* filename,
 
     png_write_end(png_ptr, info_ptr);
     png_destroy_write_struct(&png_ptr, &info_ptr);
-    fclose(fp);
+
+    return 1;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+
+int write_png(const char* filename,
+              const unsigned char* data, 
+              size_t ncols,
+              size_t nrows,
+              size_t rowsz,
+              int yflip,
+              const float* pixel_scale) {
+
+    FILE* fp = fopen(filename, "wb");
+    if (!fp) {
+        fprintf(stderr, "error opening %s for output\n", filename);
+        return 0;
+    }
+
+    int ok = write_png_stream(fp, data, ncols, nrows, rowsz,
+                              yflip, pixel_scale);
+
+    if (fclose(fp) || !ok) {
+        return 0;
+    }
 
     fprintf(stderr, "wrote %s\n", filename);
 
@@ -89,42 +109,251 @@ int write_png(const char* filename,
 
 //////////////////////////////////////////////////////////////////////
 
-unsigned char* get_rowptr_and_delta(buffer_t* dst,
+int get_image_type(const char* filename) {
+
+    const char* extension = get_extension(filename);
+
+    if (!strcasecmp(extension, "jpg") ||
+        !strcasecmp(extension, "jpeg")) {
+        return IMAGE_TYPE_JPG;
+    } else if (!strcasecmp(extension, "png")) {
+        return IMAGE_TYPE_PNG;
+    } else {
+        return IMAGE_TYPE_UNKNOWN;
+    }
+
+}
+
+//////////////////////////////////////////////////////////////////////
+
+int try_read_image(const buffer_t* src,
+                   int type,
+                   int vflip,
+                   int max_size,
+                   image_info_t* info,
+                   unsigned char* dst) {
+
+    switch (type) {
+    case IMAGE_TYPE_JPG:
+        return read_jpg(src, vflip, max_size, info, dst);
+    case IMAGE_TYPE_PNG:
+        return read_png(src, vflip, max_size, info, dst);
+    default:
+        fprintf(stderr, "unrecognized media extension\n");
+        return 0;
+    }
+
+}
+
+//////////////////////////////////////////////////////////////////////
+
+void read_image(const buffer_t* src,
+                int type,
+                int vflip,
+                int max_size,
+                image_info_t* info,
+                unsigned char* dst) {
+
+    if (!try_read_image(src, type, vflip, max_size, info, dst)) {
+        exit(1);
+    }
+
+}
+
+//////////////////////////////////////////////////////////////////////
+
+unsigned char* get_rowptr_and_delta(unsigned char* dst,
                                     int height, int stride,
                                     int vflip,
                                     int* row_delta) {
 
-    unsigned char* dstart = (unsigned char*)dst->data + dst->size;
-
     if (vflip) {
         *row_delta = -stride;
-        return dstart + (height-1)*stride;
+        return dst + (height-1)*stride;
     } else {
         *row_delta = stride;
-        return dstart;
+        return dst;
     }
 
 }
 
+//////////////////////////////////////////////////////////////////////
+
+int get_reduction(size_t width, size_t height, int max_size) {
+
+    size_t big = width > height ? width : height;
+    int reduction = 0;
+
+    if (max_size > 0) {
+        while (((big + ((size_t)1 << reduction) - 1) >> reduction) > max_size) {
+            ++reduction;
+        }
+    }
+
+    return reduction;
+    
+}
 
 //////////////////////////////////////////////////////////////////////
 
-void read_jpg(const buffer_t* raw,
-              int vflip,
-              size_t* pchannels,
-              size_t* pwidth,
-              size_t* pheight,
-              size_t* psize,
-              buffer_t* dst) {
+void get_downsampled_size(size_t width, size_t height, size_t factor,
+                          size_t* dst_width, size_t* dst_height) {
 
-    struct jpeg_decompress_struct cinfo;
+    *dst_width = width / factor;
+    *dst_height = height / factor;
+
+    if (!*dst_width) { *dst_width = 1; }
+    if (!*dst_height) { *dst_height = 1; }
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// Box filter: each output pixel averages a factor x factor block
+// (clamped to the image size) and leftover rows/columns are dropped.
+// Whole source rows are first summed into a column accumulator, which
+// is a plain unit-stride loop that the compiler vectorizes.
+
+void downsample(const unsigned char* src,
+                size_t width, size_t height,
+                size_t channels, size_t factor,
+                unsigned char* dst) {
+
+    size_t dst_width, dst_height;
+    get_downsampled_size(width, height, factor, &dst_width, &dst_height);
+
+    size_t block_w = factor < width ? factor : width;
+    size_t block_h = factor < height ? factor : height;
+
+    size_t src_stride = width * channels;
+    size_t used = dst_width * block_w * channels;
+
+    uint32_t area = block_w * block_h;
+    uint32_t* colsum = malloc(used * sizeof(uint32_t));
+    require(colsum);
+
+    for (size_t y=0; y<dst_height; ++y) {
+
+        const unsigned char* row = src + y * block_h * src_stride;
+
+        for (size_t i=0; i<used; ++i) { colsum[i] = row[i]; }
+
+        for (size_t r=1; r<block_h; ++r) {
+            row += src_stride;
+            for (size_t i=0; i<used; ++i) { colsum[i] += row[i]; }
+        }
+
+        const uint32_t* sum = colsum;
+
+        for (size_t x=0; x<dst_width; ++x) {
+            for (size_t c=0; c<channels; ++c) {
+                uint32_t total = 0;
+                for (size_t b=0; b<block_w; ++b) {
+                    total += sum[b*channels + c];
+                }
+                *dst++ = (total + area/2) / area;
+            }
+            sum += block_w * channels;
+        }
+
+    }
+
+    free(colsum);
+    
+}
+
+
+//////////////////////////////////////////////////////////////////////
+
+int get_mip_levels(size_t width, size_t height) {
+
+    size_t big = width > height ? width : height;
+    int levels = 1;
+
+    while (big > 1) {
+        big >>= 1;
+        ++levels;
+    }
+
+    return levels;
+    
+}
+
+//////////////////////////////////////////////////////////////////////
+
+size_t get_mip_chain_size(size_t width, size_t height,
+                          size_t channels, int levels) {
+
+    size_t total = 0;
+
+    for (int l=0; l<levels; ++l) {
+        total += width * height * channels;
+        get_downsampled_size(width, height, 2, &width, &height);
+    }
+
+    return total;
+    
+}
+
+//////////////////////////////////////////////////////////////////////
+
+void build_mipmaps(unsigned char* chain,
+                   size_t width, size_t height,
+                   size_t channels, int levels) {
+
+    for (int l=1; l<levels; ++l) {
+
+        unsigned char* next = chain + width * height * channels;
+        
+        downsample(chain, width, height, channels, 2, next);
+        get_downsampled_size(width, height, 2, &width, &height);
+        
+        chain = next;
+        
+    }
+    
+}
+
+// libjpeg's default error handler exits, so this one jumps back into
+// read_jpg() instead
+
+typedef struct jpg_error_mgr {
+    
     struct jpeg_error_mgr mgr;
     jmp_buf setjmp_buffer;
+    
+} jpg_error_mgr_t;
+
+void jpg_error_exit(j_common_ptr cinfo) {
 
-    cinfo.err = jpeg_std_error(&mgr);
+    jpg_error_mgr_t* err = (jpg_error_mgr_t*)cinfo->err;
+
+    (*cinfo->err->output_message)(cinfo);
+    longjmp(err->setjmp_buffer, 1);
+    
+}
+
+//////////////////////////////////////////////////////////////////////
 
-    if (setjmp(setjmp_buffer)) {
+int read_jpg(const buffer_t* raw,
+             int vflip,
+             int max_size,
+             image_info_t* info,
+             unsigned char* dst) {
+
+    struct jpeg_decompress_struct cinfo;
+    jpg_error_mgr_t err;
+
+    // only allocated when box filtering, see below
+    unsigned char* volatile scratch = NULL;
+
+    cinfo.err = jpeg_std_error(&err.mgr);
+    err.mgr.error_exit = jpg_error_exit;
+
+    if (setjmp(err.setjmp_buffer)) {
+        fprintf(stderr, "JPG read error!\n");
         jpeg_destroy_decompress(&cinfo);
+        free(scratch);
+        return 0;
     }
 
     jpeg_create_decompress(&cinfo);
@@ -135,64 +364,78 @@ void read_jpg(const buffer_t* raw,
 
     if (rc != 1) {
         fprintf(stderr, "failure reading jpeg header!\n");
-        exit(1);
+        jpeg_destroy_decompress(&cinfo);
+        return 0;
     }
 
-    jpeg_start_decompress(&cinfo);
+    // the first three halvings come for free from the IDCT, anything
+    // past that is done by box filtering the 1/8 scale output
+    int reduction = get_reduction(cinfo.image_width, cinfo.image_height,
+                                  max_size);
+
+    int dct_reduction = reduction < 3 ? reduction : 3;
+    size_t factor = (size_t)1 << (reduction - dct_reduction);
+
+    cinfo.scale_num = 1;
+    cinfo.scale_denom = 1 << dct_reduction;
+
+    jpeg_calc_output_dimensions(&cinfo);
 
     int width = cinfo.output_width;
     int height = cinfo.output_height;
     int pixel_size = cinfo.output_components;
 
-    printf("jpeg is %dx%dx%d\n", width, height, pixel_size);
-
     if (width <= 0 || height <= 0 || (pixel_size != 3 && pixel_size != 1)) {
         fprintf(stderr, "incorrect JPG type!\n");
-        exit(1);
+        jpeg_destroy_decompress(&cinfo);
+        return 0;
     }
 
-    int size = width * height * 3;
-    int row_stride = width * 3;
+    // grayscale stays single-channel, see update_teximage() for swizzle
+    int row_stride = width * pixel_size;
 
-    if (row_stride % 4) {
-        fprintf(stderr, "warning: bad stride for GL_UNPACK_ALIGNMENT!\n");
-    }
+    info->type = IMAGE_TYPE_JPG;
+    info->channels = pixel_size;
+    info->src_width = cinfo.image_width;
+    info->src_height = cinfo.image_height;
+    get_downsampled_size(width, height, factor, &info->width, &info->height);
+    info->size = info->width * info->height * pixel_size;
+
+    if (!dst) {
+
+        jpeg_destroy_decompress(&cinfo);
+        return 1;
         
-    buf_grow(dst, size);
+    }
 
-    int row_delta;
-    unsigned char* rowptr = get_rowptr_and_delta(dst, height, row_stride,
-                                                 vflip, &row_delta);
+    unsigned char* pixels = dst;
+    
+    if (factor > 1) {
+        scratch = malloc(row_stride * height);
+        require(scratch);
+        pixels = scratch;
+    }
 
-    unsigned char* dummy = 0;
-    if (pixel_size == 1) { dummy = malloc(row_stride); }
+    jpeg_start_decompress(&cinfo);
 
-    dst->size += size;
+    int row_delta;
+    unsigned char* rowptr = get_rowptr_and_delta(pixels, height, row_stride,
+                                                 vflip, &row_delta);
 
     while (cinfo.output_scanline < cinfo.output_height) {
-
-        if (pixel_size == 1) {
-            jpeg_read_scanlines(&cinfo, &dummy, 1);
-            for (int x=0; x<width; ++x) {
-                rowptr[3*x + 0] = rowptr[3*x + 1] = rowptr[3*x + 2] = dummy[x];
-            }
-        } else {
-            jpeg_read_scanlines(&cinfo, &rowptr, 1);
-        }
-        
+        jpeg_read_scanlines(&cinfo, &rowptr, 1);
         rowptr += row_delta;
-        
     }
 
-    if (dummy) { free(dummy); }
-
     jpeg_finish_decompress(&cinfo);
     jpeg_destroy_decompress(&cinfo);
 
-    *pchannels = 3;
-    *pwidth = width;
-    *pheight = height;
-    *psize = size;
+    if (factor > 1) {
+        downsample(pixels, width, height, pixel_size, factor, dst);
+        free(scratch);
+    }
+
+    return 1;
 
 }
 
@@ -215,7 +458,9 @@ void png_stream_read(png_structp png_ptr,
 
     png_simple_stream_t* str = (png_simple_stream_t*)png_get_io_ptr(png_ptr);
 
-    require( str->pos + length <= str->len );
+    if (length > str->len - str->pos) {
+        png_error(png_ptr, "unexpected end of file");
+    }
 
     memcpy(data, str->start + str->pos, length );
     str->pos += length;
@@ -224,32 +469,38 @@ void png_stream_read(png_structp png_ptr,
 
 //////////////////////////////////////////////////////////////////////
 
-void read_png(const buffer_t* raw,
-              int vflip,
-              size_t* pchannels,
-              size_t* pwidth,
-              size_t* pheight,
-              size_t* psize,
-              buffer_t* dst) {
+int read_png(const buffer_t* raw,
+             int vflip,
+             int max_size,
+             image_info_t* info,
+             unsigned char* dst) {
     
     png_structp png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING,
                                                  NULL, NULL, NULL);
 
     if (!png_ptr) {
         fprintf(stderr, "error initializing png read struct!\n");
-        exit(1);
+        return 0;
     }
 
     png_infop info_ptr = png_create_info_struct(png_ptr);
 
     if (!info_ptr) {
         fprintf(stderr, "error initializing png info struct!\n");
-        exit(1);
+        png_destroy_read_struct(&png_ptr, NULL, NULL);
+        return 0;
     }
 
+    // freed if decoding fails part way
+    unsigned char* volatile scratch = NULL;
+    png_bytepp volatile row_ptrs = NULL;
+
     if (setjmp(png_jmpbuf(png_ptr))) {
         fprintf(stderr, "PNG read error!\n");
-        exit(1);
+        png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+        free(scratch);
+        free(row_ptrs);
+        return 0;
     }
 
     png_simple_stream_t str = { (const unsigned char*)raw->data, 0, raw->size };
@@ -265,33 +516,38 @@ void read_png(const buffer_t* raw,
     int channels = png_get_channels(png_ptr, info_ptr);
     int color_type = png_get_color_type(png_ptr, info_ptr);
 
-    const char* color_type_str = "[unknown]";
+    if (!dst) {
+
+        const char* color_type_str = "[unknown]";
 
 #define HANDLE(x) case x: color_type_str = #x; break
-    switch (color_type) {
-        HANDLE(PNG_COLOR_TYPE_GRAY);
-        HANDLE(PNG_COLOR_TYPE_GRAY_ALPHA);
-        HANDLE(PNG_COLOR_TYPE_RGB);
-        HANDLE(PNG_COLOR_TYPE_RGB_ALPHA);
-        HANDLE(PNG_COLOR_TYPE_PALETTE);
-    }
+        switch (color_type) {
+            HANDLE(PNG_COLOR_TYPE_GRAY);
+            HANDLE(PNG_COLOR_TYPE_GRAY_ALPHA);
+            HANDLE(PNG_COLOR_TYPE_RGB);
+            HANDLE(PNG_COLOR_TYPE_RGB_ALPHA);
+            HANDLE(PNG_COLOR_TYPE_PALETTE);
+        }
 
-    printf("PNG is %dx%dx%d, color type %s\n",
-           width, height, channels, color_type_str);
+        printf("PNG is %dx%dx%d, color type %s\n",
+               width, height, channels, color_type_str);
+        
+    }
 
     if (bitdepth == 16) {
         png_set_strip_16(png_ptr);
         bitdepth = 8;
     }
-    
-    if (color_type == PNG_COLOR_TYPE_GRAY ) {
-        channels = 3;
-        png_set_gray_to_rgb(png_ptr);
-    } else if (color_type == PNG_COLOR_TYPE_GRAY_ALPHA) {
-        channels = 4;
-        png_set_gray_to_rgb(png_ptr);
+
+    // gray and gray+alpha keep their native channel count, see
+    // update_teximage() for how they get swizzled back to RGBA
+    if ((color_type == PNG_COLOR_TYPE_GRAY ||
+         color_type == PNG_COLOR_TYPE_GRAY_ALPHA) && bitdepth < 8) {
+        png_set_expand_gray_1_2_4_to_8(png_ptr);
+        bitdepth = 8;
     } else if (color_type == PNG_COLOR_TYPE_PALETTE) {
         channels = 3;
+        bitdepth = 8;
         png_set_palette_to_rgb(png_ptr);
         if (png_get_valid(png_ptr, info_ptr, PNG_INFO_tRNS)) {
             channels = 4;
@@ -299,34 +555,44 @@ void read_png(const buffer_t* raw,
         }
     }
     
-    if (width <= 0 || height <= 0 || bitdepth != 8 || (channels != 3 && channels != 4)) {
+    if (width <= 0 || height <= 0 || bitdepth != 8 || channels < 1 || channels > 4) {
         fprintf(stderr, "invalid PNG settings!\n");
-        exit(1);
+        png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+        return 0;
     }
 
     int row_stride = width * channels;
     
-    if (row_stride % 4) {
-        fprintf(stderr, "warning: PNG data is not aligned for OpenGL!\n");
-        exit(1);
-    }
+    size_t factor = (size_t)1 << get_reduction(width, height, max_size);
+
+    info->type = IMAGE_TYPE_PNG;
+    info->channels = channels;
+    info->src_width = width;
+    info->src_height = height;
+    get_downsampled_size(width, height, factor, &info->width, &info->height);
+    info->size = info->width * info->height * channels;
 
-    int size = row_stride * height;
+    if (!dst) {
 
-    *pwidth = width;
-    *pheight = height;
-    *psize = size;
-    *pchannels = channels;
+        png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+        return 1;
+        
+    }
 
-    buf_grow(dst, size);
+    unsigned char* pixels = dst;
+    
+    if (factor > 1) {
+        scratch = malloc(row_stride * height);
+        require(scratch);
+        pixels = scratch;
+    }
 
     int row_delta;
-    unsigned char* rowptr = get_rowptr_and_delta(dst, height, row_stride,
+    unsigned char* rowptr = get_rowptr_and_delta(pixels, height, row_stride,
                                                  vflip, &row_delta);
 
-    dst->size += size;
-
-    png_bytepp row_ptrs = malloc(height * sizeof(png_bytep));
+    row_ptrs = malloc(height * sizeof(png_bytep));
+    require(row_ptrs);
     
     for (size_t i=0; i<height; ++i) {
         row_ptrs[i] = rowptr;
@@ -339,4 +605,11 @@ void read_png(const buffer_t* raw,
 
     free(row_ptrs);
 
+    if (factor > 1) {
+        downsample(pixels, width, height, channels, factor, dst);
+        free(scratch);
+    }
+
+    return 1;
+
 }
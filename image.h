@@ -2,6 +2,7 @@
 #define _IMAGE_H_
 
 #include "buffer.h"
+#include <stdio.h>
 
 int write_png(const char* filename,
              const unsigned char* data, 
@@ -11,21 +12,92 @@ int write_png(const char* filename,
              int yflip,
              const float* pixel_scale);
 
-void read_jpg(const buffer_t* src,
-              int vflip,
-              size_t* channels,
-              size_t* width,
-              size_t* height,
-              size_t* size,
-              buffer_t* dst);
-
-void read_png(const buffer_t* src,
-              int vflip,
-              size_t* channels,
-              size_t* width,
-              size_t* height,
-              size_t* size,
-              buffer_t* dst);
+// same, but to an already open stream, which is left open
+int write_png_stream(FILE* fp,
+                     const unsigned char* data, 
+                     size_t ncols,
+                     size_t nrows,
+                     size_t rowsz,
+                     int yflip,
+                     const float* pixel_scale);
 
+enum {
+    IMAGE_TYPE_UNKNOWN = 0,
+    IMAGE_TYPE_JPG = 1,
+    IMAGE_TYPE_PNG = 2
+};
+
+typedef struct image_info {
+
+    int type;
+    size_t channels, width, height, size;
+    size_t src_width, src_height; // before any downscaling
+    
+} image_info_t;
+
+int get_image_type(const char* filename);
+
+// Decoders fill in info from the image header. If dst is non-NULL,
+// they also decode the pixels into it, so it must hold at least the
+// info->size bytes reported by a previous header-only call. They
+// return 0 after printing a message if the image is malformed.
+//
+// If max_size is positive, images get halved until neither dimension
+// exceeds it; the number of halvings only depends on the source size,
+// so same-sized cubemap faces always come out the same size.
+
+int read_jpg(const buffer_t* src,
+             int vflip,
+             int max_size,
+             image_info_t* info,
+             unsigned char* dst);
+
+int read_png(const buffer_t* src,
+             int vflip,
+             int max_size,
+             image_info_t* info,
+             unsigned char* dst);
+
+int try_read_image(const buffer_t* src,
+                   int type,
+                   int vflip,
+                   int max_size,
+                   image_info_t* info,
+                   unsigned char* dst);
+
+// same, but exits on error
+void read_image(const buffer_t* src,
+                int type,
+                int vflip,
+                int max_size,
+                image_info_t* info,
+                unsigned char* dst);
+
+// number of halvings needed to fit within max_size (0 = no limit)
+int get_reduction(size_t width, size_t height, int max_size);
+
+void get_downsampled_size(size_t width, size_t height, size_t factor,
+                          size_t* dst_width, size_t* dst_height);
+
+// box filter src down by an integer factor into dst, which must hold
+// the size given by get_downsampled_size()
+void downsample(const unsigned char* src,
+                size_t width, size_t height,
+                size_t channels, size_t factor,
+                unsigned char* dst);
+
+// A mip chain stores each level right after the previous one, with
+// every level half the size of the last (rounded down, minimum 1) as
+// OpenGL expects, down to 1x1 for a full chain.
+
+int get_mip_levels(size_t width, size_t height);
+
+size_t get_mip_chain_size(size_t width, size_t height,
+                          size_t channels, int levels);
+
+// fill in levels 1 and up of a chain whose level 0 is already there
+void build_mipmaps(unsigned char* chain,
+                   size_t width, size_t height,
+                   size_t channels, int levels);
 
 #endif
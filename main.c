@@ -0,0 +1,5 @@
+#include "st_render.h"
+
+int main(int argc, char** argv) {
+    return st_glfw_main(argc, argv);
+}
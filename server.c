@@ -0,0 +1,206 @@
+#include "server.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+struct server {
+
+    char path[sizeof(((struct sockaddr_un*)0)->sun_path)];
+
+    int listen_fd;
+    int client_fd;
+
+    // bytes received past the last complete line
+    char pending[SERVER_MAX_LINE];
+    size_t num_pending;
+
+};
+
+//////////////////////////////////////////////////////////////////////
+
+server_t* server_create(const char* path) {
+
+    server_t* s = (server_t*)calloc(1, sizeof(server_t));
+
+    if (!s) {
+        fprintf(stderr, "out of memory in server_create!\n");
+        exit(1);
+    }
+
+    if (strlen(path) >= sizeof(s->path)) {
+        fprintf(stderr, "error: socket path %s is too long\n", path);
+        exit(1);
+    }
+
+    strcpy(s->path, path);
+    s->client_fd = -1;
+
+    // a client hanging up mid-reply shouldn't kill us
+    signal(SIGPIPE, SIG_IGN);
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    // only ever replace a stale socket, never some other file
+    struct stat sb;
+
+    if (lstat(path, &sb) == 0) {
+        if (!S_ISSOCK(sb.st_mode)) {
+            fprintf(stderr, "error: %s exists and is not a socket\n", path);
+            exit(1);
+        }
+        unlink(path);
+    }
+
+    s->listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    if (s->listen_fd < 0 ||
+        bind(s->listen_fd, (struct sockaddr*)&addr, sizeof(addr)) ||
+        listen(s->listen_fd, 4)) {
+        fprintf(stderr, "error listening on %s: %s\n", path, strerror(errno));
+        exit(1);
+    }
+
+    return s;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+
+void server_drop_client(server_t* s) {
+
+    if (s->client_fd >= 0) {
+        close(s->client_fd);
+        s->client_fd = -1;
+    }
+
+    s->num_pending = 0;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+
+void server_read_line(server_t* s, char* line) {
+
+    while (1) {
+
+        if (s->client_fd < 0) {
+
+            s->client_fd = accept(s->listen_fd, NULL, NULL);
+
+            if (s->client_fd < 0) {
+                if (errno == EINTR) { continue; }
+                fprintf(stderr, "error accepting on %s: %s\n",
+                        s->path, strerror(errno));
+                exit(1);
+            }
+
+        }
+
+        char* newline = memchr(s->pending, '\n', s->num_pending);
+
+        if (newline) {
+
+            size_t length = newline - s->pending;
+
+            if (length && s->pending[length-1] == '\r') {
+                memcpy(line, s->pending, length-1);
+                line[length-1] = '\0';
+            } else {
+                memcpy(line, s->pending, length);
+                line[length] = '\0';
+            }
+
+            s->num_pending -= length + 1;
+            memmove(s->pending, newline + 1, s->num_pending);
+
+            return;
+
+        }
+
+        if (s->num_pending == SERVER_MAX_LINE) {
+            fprintf(stderr, "dropping client that sent a line that's too long\n");
+            server_drop_client(s);
+            continue;
+        }
+
+        ssize_t count = read(s->client_fd, s->pending + s->num_pending,
+                             SERVER_MAX_LINE - s->num_pending);
+
+        if (count < 0 && errno == EINTR) {
+            continue;
+        } else if (count <= 0) {
+            server_drop_client(s);
+        } else {
+            s->num_pending += count;
+        }
+
+    }
+
+}
+
+//////////////////////////////////////////////////////////////////////
+
+int server_write(server_t* s, const void* data, size_t size) {
+
+    const char* src = (const char*)data;
+
+    while (size && s->client_fd >= 0) {
+
+        ssize_t count = write(s->client_fd, src, size);
+
+        if (count < 0 && errno == EINTR) {
+            continue;
+        } else if (count <= 0) {
+            server_drop_client(s);
+        } else {
+            src += count;
+            size -= count;
+        }
+
+    }
+
+    return s->client_fd >= 0;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+
+int server_printf(server_t* s, const char* format, ...) {
+
+    char buf[SERVER_MAX_LINE];
+
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(buf, sizeof(buf), format, args);
+    va_end(args);
+
+    if (length >= (int)sizeof(buf)) { length = sizeof(buf) - 1; }
+
+    return server_write(s, buf, length);
+
+}
+
+//////////////////////////////////////////////////////////////////////
+
+void server_free(server_t* s) {
+
+    if (!s) { return; }
+
+    server_drop_client(s);
+    close(s->listen_fd);
+    unlink(s->path);
+
+    free(s);
+
+}
@@ -0,0 +1,35 @@
+#ifndef _SERVER_H_
+#define _SERVER_H_
+
+#include <stddef.h>
+
+// A Unix domain socket that takes commands one line at a time from a
+// single client. Clients are served one after another; when one hangs
+// up, the next connection is accepted.
+
+typedef struct server server_t;
+
+enum {
+    SERVER_MAX_LINE = 4096
+};
+
+// replaces a stale socket at path, but exits if some other kind of
+// file is there; also exits on error
+server_t* server_create(const char* path);
+
+// blocks until the next command arrives, waiting for a client if there
+// isn't one, and copies it without its newline into line, which holds
+// SERVER_MAX_LINE bytes
+void server_read_line(server_t* s, char* line);
+
+// returns 0 if the client went away, in which case the rest of the
+// reply is dropped and the next read waits for a new client
+int server_write(server_t* s, const void* data, size_t size);
+
+int server_printf(server_t* s, const char* format, ...)
+    __attribute__((format(printf, 2, 3)));
+
+// closes everything and removes the socket file
+void server_free(server_t* s);
+
+#endif
@@ -13,16 +13,35 @@
 #include <time.h>
 #include <math.h>
 #include <ctype.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "require.h"
 #include "buffer.h"
 #include "image.h"
 #include "www.h"
 #include "stringutils.h"
+#include "threadpool.h"
+#include "texcache.h"
+#include "stbundle.h"
+#include "video.h"
+#include "wav.h"
+#include "watch.h"
+#include "server.h"
+#include "st_render.h"
 
 enum {
 
     MAX_RENDERBUFFERS = 6,
+    MAX_PASS_NAME_LENGTH = 64,
+
+    MAX_MOSAIC_TILES = 16,
+
+    // most passes either kind of shader can have, for everything
+    // indexed by pass
+    MAX_PASSES = (MAX_MOSAIC_TILES > MAX_RENDERBUFFERS ?
+                  MAX_MOSAIC_TILES : MAX_RENDERBUFFERS),
     
     MAX_UNIFORMS = 16,
     
@@ -32,7 +51,17 @@ enum {
     
     BIG_STRING_LENGTH = 1024,
     MAX_PROGRAM_LENGTH = 1024*256,
-    MAX_FILE_LENGTH = 1024*1024*1024, // 1GB
+    
+    MAX_IMAGE_REQUESTS = MAX_PASSES * NUM_CHANNELS * 6,
+    
+    VIDEO_SLOTS = 4,
+
+    CUBEMAP_BUFFER_SIZE = 1024,
+
+    SOUND_BLOCK_WIDTH = 512,
+    SOUND_BLOCK_HEIGHT = 512,
+    SOUND_CHANNELS = 2,
+    DEFAULT_SOUND_DURATION = 180,
     
     KEYMAP_ROWS = 3,
     KEYMAP_BYTES_PER_ROW = 256*3,
@@ -74,9 +103,6 @@ typedef struct uniform {
     
 } uniform_t;
 
-uniform_t uinfo[MAX_UNIFORMS];
-int num_uniforms = 0;
-
 //////////////////////////////////////////////////////////////////////
 
 const char* vertex_src[1] = {
@@ -102,11 +128,98 @@ enum {
     FRAG_SRC_NUM_SLOTS
 };
 
+// sends each triangle to all six faces of a cubemap pass's target
+const char* cubemap_geometry_src[1] = {
+    "#version 330\n"
+    "layout(triangles) in;\n"
+    "layout(triangle_strip, max_vertices=18) out;\n"
+    "flat out int _st_glfw_face;\n"
+    "void main() {\n"
+    "    for (int face=0; face<6; ++face) {\n"
+    "        for (int i=0; i<3; ++i) {\n"
+    "            gl_Layer = face;\n"
+    "            _st_glfw_face = face;\n"
+    "            gl_Position = gl_in[i].gl_Position;\n"
+    "            EmitVertex();\n"
+    "        }\n"
+    "        EndPrimitive();\n"
+    "    }\n"
+    "}\n"
+};
+
+// goes in the main slot of cubemap passes; the ray directions follow
+// the GL cube map face layout
+const char* cubemap_main = "\n"
+"flat in int _st_glfw_face;\n"
+"void main() {\n"
+"    vec2 p = 2.0*gl_FragCoord.xy/iResolution.xy - 1.0;\n"
+"    vec3 dirs[6] = vec3[6](vec3(1.0, -p.y, -p.x), vec3(-1.0, -p.y, p.x),\n"
+"                           vec3(p.x, 1.0, p.y), vec3(p.x, -1.0, -p.y),\n"
+"                           vec3(p.x, -p.y, 1.0), vec3(-p.x, -p.y, -1.0));\n"
+"    mainCubemap(fragColor, gl_FragCoord.xy, vec3(0.0),\n"
+"                normalize(dirs[_st_glfw_face]));\n"
+"}\n";
+
+// goes in the main slot of -mosaic tiles, which all draw straight to
+// the screen, so that fragCoord starts from the corner of the tile
+const char* mosaic_main = "\n"
+"uniform vec2 _st_glfw_iTileOrigin;\n"
+"void main() {\n"
+"    mainImage(fragColor, gl_FragCoord.xy - _st_glfw_iTileOrigin);\n"
+"}\n";
+
 const char* scale_render_mainimage = "\n"
 "void mainImage( out vec4 fragColor, in vec2 fragCoord ) {\n"
 "    fragColor = texture(iChannel0, _st_glfw_iFinalScale*fragCoord/iResolution.xy);\n"
 "}\n";
 
+// with -checkerboard, the image pass draws into a half-width buffer
+// and each texel shades every other pixel of its row, alternating
+// which ones from row to row and frame to frame
+const char* checkerboard_main = "\n"
+"void main() {\n"
+"    int y = int(gl_FragCoord.y);\n"
+"    float x = 2.0*floor(gl_FragCoord.x) + float((y + iFrame) & 1) + 0.5;\n"
+"    mainImage(fragColor, vec2(x, gl_FragCoord.y));\n"
+"}\n";
+
+// fills in the pixels skipped this frame from last frame's half,
+// clamped to the range of their freshly shaded neighbours so moving
+// content doesn't smear
+const char* checkerboard_resolve_mainimage = "\n"
+"vec4 _st_glfw_half(ivec2 p) {\n"
+"    ivec2 size = textureSize(iChannel0, 0);\n"
+"    p = clamp(p, ivec2(0), size - 1);\n"
+"    return texelFetch(iChannel0, p, 0);\n"
+"}\n"
+"void mainImage( out vec4 fragColor, in vec2 fragCoord ) {\n"
+"    ivec2 p = ivec2(fragCoord);\n"
+"    int parity = (p.y + iFrame) & 1;\n"
+"    if ((p.x & 1) == parity) {\n"
+"        fragColor = _st_glfw_half(ivec2(p.x >> 1, p.y));\n"
+"        return;\n"
+"    }\n"
+"    vec4 l = _st_glfw_half(ivec2((p.x - 1) >> 1, p.y));\n"
+"    vec4 r = _st_glfw_half(ivec2((p.x + 1) >> 1, p.y));\n"
+"    vec4 d = _st_glfw_half(ivec2(p.x >> 1, p.y - 1));\n"
+"    vec4 u = _st_glfw_half(ivec2(p.x >> 1, p.y + 1));\n"
+"    vec4 prev = texelFetch(iChannel1, ivec2(p.x >> 1, p.y), 0);\n"
+"    fragColor = clamp(prev, min(min(l, r), min(d, u)), max(max(l, r), max(d, u)));\n"
+"}\n";
+
+// goes in the main slot of the sound pass; each texel of a block is
+// one stereo sample, in order across then up
+const char* sound_main = "\n"
+"uniform int _st_glfw_iSoundSample;\n"
+"uniform float _st_glfw_iSoundTime;\n"
+"uniform int _st_glfw_iSoundBlockWidth;\n"
+"void main() {\n"
+"    int i = int(gl_FragCoord.x) + int(gl_FragCoord.y)*_st_glfw_iSoundBlockWidth;\n"
+"    vec2 s = mainSound(_st_glfw_iSoundSample + i,\n"
+"                       _st_glfw_iSoundTime + float(i)/iSampleRate);\n"
+"    fragColor = vec4(clamp(s, -1.0, 1.0), 0.0, 1.0);\n"
+"}\n";
+
 const char* default_fragment_src[FRAG_SRC_NUM_SLOTS] = {
 
     "#version 330\n#line 0 0\n",
@@ -151,6 +264,8 @@ typedef enum texture_ctype {
     CTYPE_KEYBOARD = 2,
     CTYPE_CUBEMAP = 3,
     CTYPE_BUFFER = 4,
+    CTYPE_VIDEO = 5,
+    CTYPE_CUBEBUFFER = 6,
 } texture_ctype_t;
 
 typedef struct channel {
@@ -160,6 +275,7 @@ typedef struct channel {
 
     GLuint target;
     GLuint tex_id;
+    GLuint sampler;
     int src_rb_idx;
 
     int filter;
@@ -167,14 +283,43 @@ typedef struct channel {
     int vflip;
     int wrap;
 
+    // buffer channels can read the pass's output from the frame before
+    int previous_frame;
+
+    // another channel with the same source owns the texture
+    struct channel* shared;
+    int want_mipmaps;
+
     size_t channels, width, height, size;
+    int levels; // size is bytes per face, including all levels
     buffer_t texture;
+    int pending_faces;
+
+    // set if texture is a mapped pixel unpack buffer
+    int staging;
+    GLuint pbo;
+    GLsync upload_fence;
+
+    // video frames stream through their own unpack buffers
+    video_t* video;
+    double video_fps;
+    int video_frames;
+    long video_seq;
+    float video_time;
+    GLuint video_pbos[VIDEO_SLOTS];
+    GLsync video_fences[VIDEO_SLOTS];
 
     int dirty;
     int initialized;
     
 } channel_t;
 
+enum {
+    STAGING_NONE = 0,
+    STAGING_REQUESTED = 1,
+    STAGING_MAPPED = 2
+};
+
 enum {
     FRAMEBUFFER_NONE = 0,
     FRAMEBUFFER_UNINITIALIZED = 1,
@@ -182,12 +327,17 @@ enum {
     FRAMEBUFFER_BADSIZE = 3,
 };
 
+// iResolution, iChannelResolution and iSampleRate, in that order
+enum {
+    NUM_SPECIALIZED_VALUES = 3 + 3*NUM_CHANNELS + 1
+};
+
 typedef struct renderbuffer {
 
     buffer_t shader_buf;
     int shader_count;
 
-    const char* name;
+    char name[MAX_PASS_NAME_LENGTH];
     
     channel_t channels[NUM_CHANNELS];
 
@@ -202,31 +352,164 @@ typedef struct renderbuffer {
 
     GLuint framebuffers[2]; 
     int framebuffer_state;
+    int is_cubemap;
+
+    // fraction of the render size this pass draws at; 0 means 1
+    float resolution_scale;
+
+    // only drawn when u_frame % update_interval == update_phase
+    int update_interval;
+    int update_phase;
+
+    // draws half the pixels at half width, see checkerboard_main
+    int checkerboard;
 
     GLuint draw_tex_ids[2];
     int last_drawn;
 
     GLuint uniform_handles[MAX_UNIFORMS];
+
+    // from a bundle, tried before compiling
+    const void* program_binary;
+    GLsizei program_binary_length;
+    GLenum program_binary_format;
+
+    // with -specialize, the values compiled into the program
+    int specialized;
+    GLfloat specialized_values[NUM_SPECIALIZED_VALUES];
+    buffer_t specialized_buf;
     
 } renderbuffer_t;
 
-renderbuffer_t renderbuffers[MAX_RENDERBUFFERS];
-int draw_order[MAX_RENDERBUFFERS];
-
-int num_renderbuffers = 0;
+// with -mosaic, one pass per tile, see get_tile_rect()
+renderbuffer_t mosaic_tiles[MAX_MOSAIC_TILES];
 
 GLubyte keymap[KEYMAP_TOTAL_BYTES];
 
+//////////////////////////////////////////////////////////////////////
+// registry of image sources so each one is loaded and uploaded once
+
+typedef struct texture_source {
+
+    texture_ctype_t ctype;
+    int vflip;
+    char src[BIG_STRING_LENGTH];
+    
+    channel_t* channel;
+    
+} texture_source_t;
+
+//////////////////////////////////////////////////////////////////////
+// everything that belongs to one loaded shader; the command line tool
+// draws main_shader, and each st_render context has its own
+
+typedef struct shader {
+
+    renderbuffer_t passes[MAX_RENDERBUFFERS];
+
+    // passes, or mosaic_tiles with -mosaic
+    renderbuffer_t* renderbuffers;
+    int draw_order[MAX_PASSES];
+    int num_renderbuffers;
+
+    // never drawn to the screen, just rendered out to sound_output
+    renderbuffer_t sound_pass;
+    int have_sound_pass;
+
+    uniform_t uinfo[MAX_UNIFORMS];
+    int num_uniforms;
+
+    // the one channel that owns the keyboard texture
+    channel_t* keyboard_channel;
+
+    // channels that own a video texture
+    channel_t* video_channels[MAX_PASSES*NUM_CHANNELS];
+    int num_video_channels;
+
+    texture_source_t texture_sources[MAX_PASSES*NUM_CHANNELS];
+    int num_texture_sources;
+
+    // uploads whose unpack buffers go away once done
+    channel_t* inflight_uploads[MAX_PASSES*NUM_CHANNELS];
+    int num_inflight_uploads;
+
+    char window_title[BIG_STRING_LENGTH];
+
+    json_t* json_root;
+    buffer_t json_buf;
+    buffer_t common_buf;
+    stbundle_t bundle;
+    
+} shader_t;
+
+shader_t main_shader;
+
+// the shader everything below works on; the playlist preloader
+// thread works on its own, see preload_entry()
+__thread shader_t* cur_shader = &main_shader;
+
+//////////////////////////////////////////////////////////////////////
+
+typedef struct image_request {
+
+    channel_t* channel;
+    int face;
+    
+    char src[BIG_STRING_LENGTH];
+    int is_local_file;
+
+    char cache_key[BIG_STRING_LENGTH + 128];
+    texcache_entry_t cached;
+
+    buffer_t raw;
+    image_info_t info;
+    
+} image_request_t;
+
+image_request_t image_requests[MAX_IMAGE_REQUESTS];
+int num_image_requests = 0;
+
+threadpool_t* decode_pool = NULL;
+
+pthread_t image_loader;
+int image_loader_running = 0;
+
+// protects everything below, which is shared with the decode workers
+pthread_mutex_t image_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t image_ready_cond = PTHREAD_COND_INITIALIZER;
+
+channel_t* ready_channels[MAX_PASSES*NUM_CHANNELS];
+int num_ready_channels = 0;
+int num_loading_channels = 0;
+
+// once the GL context is up, decoders write straight into pixel
+// unpack buffers that the main thread maps for them
+int pbo_uploads = 0;
+channel_t* staging_channels[MAX_PASSES*NUM_CHANNELS];
+int num_staging_channels = 0;
+pthread_cond_t staging_cond = PTHREAD_COND_INITIALIZER;
+
 int last_key = -1;
 
 GLubyte* key_state = keymap + 0*KEYMAP_BYTES_PER_ROW;
 GLubyte* key_toggle = keymap + 2*KEYMAP_BYTES_PER_ROW;
 GLubyte* key_press = keymap + 1*KEYMAP_BYTES_PER_ROW;
 
+// bit i is set if row i of keymap changed since the last upload
+enum {
+    KEY_STATE_DIRTY = 1 << 0,
+    KEY_PRESS_DIRTY = 1 << 1,
+    KEY_TOGGLE_DIRTY = 1 << 2,
+    KEYMAP_ALL_DIRTY = KEY_STATE_DIRTY | KEY_PRESS_DIRTY | KEY_TOGGLE_DIRTY
+};
+
+int keymap_dirty_rows = KEYMAP_ALL_DIRTY;
+int any_key_pressed = 0;
+
 //////////////////////////////////////////////////////////////////////
 
 GLfloat u_time = 0; // set this to starttime after options
-GLfloat u_resolution[3]; // set every frame
+GLfloat u_resolution[3]; // set per-buffer every frame
 GLfloat u_mouse[4] = { -1, -1, -1, -1 }; 
 GLfloat u_time_delta = 0;
 GLfloat u_date[4]; // set every frame
@@ -237,11 +520,67 @@ GLfloat u_scale_factor = 1;
 
 GLint u_frame = 0;
 
+GLint u_sound_sample = 0; // set per block of sound
+GLfloat u_sound_time = 0;
+GLint u_sound_block_width = SOUND_BLOCK_WIDTH;
+
+GLfloat u_tile_origin[2] = { 0, 0 }; // set per tile with -mosaic
+
 //////////////////////////////////////////////////////////////////////
 
 int debug_output = 0;
+int max_texture_size = 0;
+double video_fps = 30;
+const char* sound_output = NULL;
+double sound_duration = 0;
+
+// from -pass-scale and -pass-interval, applied once passes are loaded
+typedef struct pass_option {
+    const char* name;
+    float scale;
+    int interval, phase;
+} pass_option_t;
+
+enum { MAX_PASS_OPTIONS = 2*MAX_PASSES };
+
+pass_option_t pass_options[MAX_PASS_OPTIONS];
+int num_pass_options = 0;
+
+int use_cache = 1;
+const char* cache_dir = NULL;
+long cache_size_mb = 1024;
+
+double startup_time = 0;
+int first_frame_drawn = 0;
 int is_scaled = 0;
 
+// cleared while hot reloading, so a typo doesn't kill the program
+__thread int shader_errors_fatal = 1;
+
+// cleared by the st_render API and the playlist preloader, which
+// report failure instead of exiting; gl_error_seen says whether there
+// were any
+__thread int gl_errors_fatal = 1;
+__thread int gl_error_seen = 0;
+
+// local shader sources get watched for changes, see watch_source()
+enum {
+    SOURCE_COMMON = -1
+};
+
+int watching = 1;
+watcher_t* watcher = NULL;
+int source_passes[WATCH_MAX_FILES]; // by watch id
+int num_watched_sources = 0;
+int specialize = 0;
+int checkerboard = 0;
+
+// with -mosaic, each raw GLSL input is its own pass, drawn into its
+// own tile of a mosaic_cols x mosaic_rows grid on the screen
+int mosaic = 0;
+int mosaic_cols = 0;
+int mosaic_rows = 0;
+
 int window_size[2] = { 640, 360 };
 
 int render_framebuffer_size[2] = { 0, 0 };
@@ -264,6 +603,60 @@ int stop_at_frame = 100;
 float total_delta = 0.0;
 float total_delta2 = 0.0;
 
+// from -sweep KEY=V1,V2,...; every combination gets profiled
+enum {
+    MAX_SWEEP_KEYS = 8,
+    MAX_SWEEP_VARIANTS = 256
+};
+
+const char* sweep_keys[MAX_SWEEP_KEYS];
+int num_sweep_keys = 0;
+double sweep_max_error = -1;
+
+// set to have render() keep a copy of the next frame in captured_pixels
+int capture_next_frame = 0;
+unsigned char* captured_pixels = NULL;
+int captured_stride = 0;
+
+// with -serve, commands come in over a Unix socket, see run_server()
+const char* serve_path = NULL;
+server_t* server = NULL;
+
+// hidden window, no vsync: for -serve and the st_render API
+int offscreen = 0;
+
+// the one st_render API context, if any, see st_render_create()
+st_render_t* render_context = NULL;
+
+// with -playlist, shaders to cycle through, see next_playlist_entry()
+typedef struct playlist_entry {
+    double duration;
+    char path[BIG_STRING_LENGTH];
+} playlist_entry_t;
+
+enum { MAX_PLAYLIST_ENTRIES = 256 };
+
+playlist_entry_t playlist[MAX_PLAYLIST_ENTRIES];
+int num_playlist_entries = 0;
+int playlist_pos = 0;
+double playlist_switch_time = 0; // wallclock
+
+// the next entry on the playlist gets loaded into next_shader in the
+// background, in a hidden context that shares objects with the
+// window's, see preload_entry()
+pthread_t preloader;
+int preloader_running = 0;
+int preload_pos = -1;
+int preload_ok = 0;
+GLFWwindow* preload_context = NULL;
+
+shader_t spare_shader;
+shader_t* next_shader = &spare_shader;
+
+// set by the preloader once it's done, under preload_mutex
+int preload_done = 0;
+pthread_mutex_t preload_mutex = PTHREAD_MUTEX_INITIALIZER;
+
 int animating = 1;
 int recording = 0;
 int profiling = 0;
@@ -273,19 +666,14 @@ int mouse_down = 0;
 
 //////////////////////////////////////////////////////////////////////
 
-char window_title[BIG_STRING_LENGTH] = "Shadertoy GLFW";
-
 const char* shadertoy_id = NULL;
 const char* api_key = NULL;
 
 const char* json_input = NULL;
-json_t* json_root = NULL;
-
-buffer_t json_buf = { 0, 0, 0 };
 
-buffer_t defines_buf = { 0, 0, 0 };
+buffer_t defines_buf = { 0, 0, 0, 0 };
 
-buffer_t common_buf = { 0, 0, 0 };
+const char* bundle_output = NULL;
 
 //////////////////////////////////////////////////////////////////////
 
@@ -318,13 +706,32 @@ const char* target_string(GLenum target) {
 
 //////////////////////////////////////////////////////////////////////
 
+double get_wallclock() {
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+    
+}
+
+//////////////////////////////////////////////////////////////////////
+
+void log_startup(const char* stage) {
+
+    printf("%s after %.1f ms\n", stage, (get_wallclock() - startup_time) * 1e3);
+    
+}
+
+//////////////////////////////////////////////////////////////////////
+
 void check_opengl_errors(const char* context) { 
     GLenum error = glGetError();
     if (!context || !*context) { context = "error"; }
     if (error) {
         fprintf(stderr, "%s: %s\n", context, get_error_string(error));
-        exit(1);
-                                                                         
+        if (gl_errors_fatal) { exit(1); }
+        gl_error_seen = 1;
     }
 }
 
@@ -351,9 +758,12 @@ GLuint make_shader(GLenum type,
         char buf[4096];
         glGetShaderInfoLog(shader, sizeof(buf), NULL, buf);
         fprintf(stderr, "error compiling %s shader:\n\n%s\n",
-                type == GL_VERTEX_SHADER ? "vertex" : "fragment",
+                (type == GL_VERTEX_SHADER ? "vertex" :
+                 type == GL_GEOMETRY_SHADER ? "geometry" : "fragment"),
                 buf);
-        exit(1);
+        if (shader_errors_fatal) { exit(1); }
+        glDeleteShader(shader);
+        return 0;
     }
 
     return shader;
@@ -367,7 +777,7 @@ void add_uniform(const char* name,
                  GLenum type,
                  int array_length) {
 
-    if (num_uniforms >= MAX_UNIFORMS) {
+    if (cur_shader->num_uniforms >= MAX_UNIFORMS) {
         fprintf(stderr, "error: maximum # of uniforms exceeded, "
                 "increase MAX_UNIFORMS\n");
         exit(1);
@@ -401,29 +811,81 @@ void add_uniform(const char* name,
         exit(1);
     }
     
-    uinfo[num_uniforms] = u;
+    cur_shader->uinfo[cur_shader->num_uniforms] = u;
 
-    for (int j=0; j<num_renderbuffers; ++j) {
+    for (int j=0; j<cur_shader->num_renderbuffers; ++j) {
         
-        renderbuffer_t* rb = renderbuffers + j;
+        renderbuffer_t* rb = cur_shader->renderbuffers + j;
         
         GLuint handle = glGetUniformLocation(rb->program, name);
 
-        rb->uniform_handles[num_uniforms] = handle;
+        rb->uniform_handles[cur_shader->num_uniforms] = handle;
         
     }
 
-    ++num_uniforms;
+    if (cur_shader->have_sound_pass) {
+        cur_shader->sound_pass.uniform_handles[cur_shader->num_uniforms] =
+            glGetUniformLocation(cur_shader->sound_pass.program, name);
+    }
+
+    ++cur_shader->num_uniforms;
     
 }
 
 //////////////////////////////////////////////////////////////////////
 
-void setup_shaders(renderbuffer_t* rb) {
+int program_binaries_supported() {
 
-    GLuint vertex_shader = make_shader(GL_VERTEX_SHADER, 1,
-                                       vertex_src);
+#ifdef ST_GLFW_USE_GLEW
+    if (!glGetProgramBinary || !glProgramBinary) { return 0; }
+#endif
+
+    GLint num_formats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &num_formats);
+
+    // pre-4.1 contexts without the extension don't know the enum
+    while (glGetError() != GL_NO_ERROR) { }
+    
+    return num_formats > 0;
+    
+}
+
+//////////////////////////////////////////////////////////////////////
+// returns 1 if the driver accepted the program binary from the
+// bundle, 0 if it needs to be compiled from source after all
+
+int load_program_binary(renderbuffer_t* rb) {
+
+    if (!program_binaries_supported()) { return 0; }
+
+    rb->program = glCreateProgram();
+
+    glProgramBinary(rb->program, rb->program_binary_format,
+                    rb->program_binary, rb->program_binary_length);
+
+    GLint status = 0;
+    glGetProgramiv(rb->program, GL_LINK_STATUS, &status);
+
+    // an unsupported format is an error, not just a failed link
+    while (glGetError() != GL_NO_ERROR) { }
 
+    if (!status) {
+        fprintf(stderr, "warning: driver rejected program binary for %s, "
+                "compiling from source\n", rb->name);
+        glDeleteProgram(rb->program);
+        rb->program = 0;
+        return 0;
+    }
+
+    dprintf("using program binary for %s\n", rb->name);
+
+    return 1;
+    
+}
+
+//////////////////////////////////////////////////////////////////////
+
+void setup_shaders(renderbuffer_t* rb) {
 
     if (defines_buf.data) {
         rb->fragment_src[FRAG_SRC_DEFINES_SLOT] = defines_buf.data;
@@ -441,10 +903,12 @@ void setup_shaders(renderbuffer_t* rb) {
         case CTYPE_BUFFER:
         case CTYPE_TEXTURE:
         case CTYPE_KEYBOARD:
+        case CTYPE_VIDEO:
         case CTYPE_NONE:
             stype = "sampler2D";
             break;
         case CTYPE_CUBEMAP:
+        case CTYPE_CUBEBUFFER:
             stype = "samplerCube";
             break;
         default:
@@ -469,17 +933,69 @@ void setup_shaders(renderbuffer_t* rb) {
         }
     }
 
-    GLuint fragment_shader = make_shader(GL_FRAGMENT_SHADER,
-                                         FRAG_SRC_NUM_SLOTS,
-                                         rb->fragment_src);
-                                
-    rb->program = glCreateProgram();
-    glAttachShader(rb->program, vertex_shader);
-    glAttachShader(rb->program, fragment_shader);
-    glLinkProgram(rb->program);
+    // -D on the command line changes the source, so the binary is stale
+    if (rb->program_binary && !defines_buf.data && load_program_binary(rb)) {
+        glUseProgram(rb->program);
+        check_opengl_errors("after use program");
+        return;
+    }
+
+    // if errors aren't fatal, rb->program is left alone on failure
+    GLuint shaders[3] = { 0, 0, 0 };
+    int num_shaders = rb->is_cubemap ? 3 : 2;
+
+    shaders[0] = make_shader(GL_VERTEX_SHADER, 1, vertex_src);
+
+    shaders[1] = make_shader(GL_FRAGMENT_SHADER,
+                             FRAG_SRC_NUM_SLOTS,
+                             rb->fragment_src);
+
+    if (rb->is_cubemap) {
+        shaders[2] = make_shader(GL_GEOMETRY_SHADER, 1,
+                                 cubemap_geometry_src);
+    }
+
+    GLuint program = glCreateProgram();
+
+    for (int i=0; i<num_shaders; ++i) {
+        if (shaders[i]) { glAttachShader(program, shaders[i]); }
+    }
+
+    if (bundle_output && program_binaries_supported()) {
+        glProgramParameteri(program,
+                            GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
+
+    GLint status = 0;
+
+    if (shaders[0] && shaders[1] && (!rb->is_cubemap || shaders[2])) {
+        
+        glLinkProgram(program);
+        glGetProgramiv(program, GL_LINK_STATUS, &status);
+
+        if (!status) {
+            char buf[4096];
+            glGetProgramInfoLog(program, sizeof(buf), NULL, buf);
+            fprintf(stderr, "error linking %s:\n\n%s\n", rb->name, buf);
+            if (shader_errors_fatal) { exit(1); }
+        }
+        
+    }
+
+    // the program keeps them alive for as long as it needs them
+    for (int i=0; i<num_shaders; ++i) {
+        if (shaders[i]) { glDeleteShader(shaders[i]); }
+    }
 
     check_opengl_errors("after linking program");
 
+    if (!status) {
+        glDeleteProgram(program);
+        return;
+    }
+
+    rb->program = program;
+
 
     glUseProgram(rb->program);
     check_opengl_errors("after use program");
@@ -513,6 +1029,13 @@ void setup_array(renderbuffer_t* rb) {
     
     check_opengl_errors("after element buffer setup");
 
+}
+
+//////////////////////////////////////////////////////////////////////
+// vertex arrays belong to one GL context, see setup_context_objects()
+
+void setup_vertex_array(renderbuffer_t* rb) {
+
     glGenVertexArrays(1, &rb->vao);
 
     glBindVertexArray(rb->vao);
@@ -541,8 +1064,12 @@ void setup_uniforms() {
     add_uniform("iChannelTime", u_channel_time, GL_FLOAT, 4);
     add_uniform("iSampleRate", &u_sample_rate, GL_FLOAT, 1);
     add_uniform("_st_glfw_iFinalScale", &u_scale_factor, GL_FLOAT, 1);
+    add_uniform("_st_glfw_iSoundSample", &u_sound_sample, GL_INT, 1);
+    add_uniform("_st_glfw_iSoundTime", &u_sound_time, GL_FLOAT, 1);
+    add_uniform("_st_glfw_iSoundBlockWidth", &u_sound_block_width, GL_INT, 1);
+    add_uniform("_st_glfw_iTileOrigin", u_tile_origin, GL_FLOAT_VEC2, 1);
 
-    printf("there were %d uniforms\n", (int)num_uniforms);
+    printf("there were %d uniforms\n", (int)cur_shader->num_uniforms);
 
     check_opengl_errors("after setting up uniforms");
 
@@ -557,53 +1084,125 @@ void update_teximage(channel_t* channel) {
     int count = 1;
     const GLubyte* src = (const GLubyte*)channel->texture.data;
 
+    // offsets into the bound unpack buffer, if any
+    if (channel->pbo) {
+        src = (const GLubyte*)0;
+    }
+
     if (channel->ctype == CTYPE_CUBEMAP) {
         
         target = GL_TEXTURE_CUBE_MAP_POSITIVE_X;
         count = 6;
         
+    }
+
+    if (channel->ctype == CTYPE_TEXTURE || channel->ctype == CTYPE_CUBEMAP ||
+        channel->ctype == CTYPE_VIDEO) {
+
+        if (!src && !channel->pbo) {
+            fprintf(stderr, "error: pixels for %s were already released!\n",
+                    channel->name);
+            exit(1);
+        }
+        
     } else if (channel->ctype == CTYPE_KEYBOARD) {
         
         src = keymap;
                  
-    } else if (channel->ctype != CTYPE_TEXTURE) {
+    } else {
         
         fprintf(stderr, "should not call update_teximage for this ctype!\n");
         exit(1);
         
     }
 
-    GLenum format;
+    GLenum internal_format, format;
 
-    if (channel->channels == 4) {
-        format = GL_RGBA;
-    } else {
+    // single- and dual-channel images upload as-is and get swizzled
+    // so that shaders see the same (l,l,l,1) or (l,l,l,a) that an
+    // expanded RGB/RGBA image would give them
+    const GLint gray_swizzle[4] = { GL_RED, GL_RED, GL_RED, GL_ONE };
+    const GLint gray_alpha_swizzle[4] = { GL_RED, GL_RED, GL_RED, GL_GREEN };
+    const GLint* swizzle = NULL;
+
+    switch (channel->channels) {
+    case 1:
+        internal_format = GL_R8;
+        format = GL_RED;
+        swizzle = gray_swizzle;
+        break;
+    case 2:
+        internal_format = GL_RG8;
+        format = GL_RG;
+        swizzle = gray_alpha_swizzle;
+        break;
+    case 3:
+        internal_format = GL_RGB8;
         format = GL_RGB;
+        break;
+    case 4:
+        internal_format = GL_RGBA8;
+        format = GL_RGBA;
+        break;
+    default:
+        fprintf(stderr, "invalid number of channels for texture!\n");
+        exit(1);
+    }
+
+    if (swizzle && !channel->initialized) {
+        glTexParameteriv(channel->target, GL_TEXTURE_SWIZZLE_RGBA, swizzle);
+    }
+
+    // rows are tightly packed no matter the width
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+    if (channel->pbo) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, channel->pbo);
+    }
+
+    int levels = channel->levels > 1 ? channel->levels : 1;
+
+    if (levels > 1 && !channel->initialized) {
+        glTexParameteri(channel->target, GL_TEXTURE_MAX_LEVEL, levels-1);
     }
 
     for (int i=0; i<count; ++i) {
+
+        const GLubyte* level_src = src + i*channel->size;
+        size_t w = channel->width, h = channel->height;
+
+        for (int l=0; l<levels; ++l) {
     
-        if (!channel->initialized) {
+            if (!channel->initialized) {
 
-            glTexImage2D(target + i, 0, format,
-                         channel->width,
-                         channel->height, 0,
-                         format, GL_UNSIGNED_BYTE,
-                         src + i*channel->size);
+                glTexImage2D(target + i, l, internal_format,
+                             w, h, 0,
+                             format, GL_UNSIGNED_BYTE,
+                             level_src);
 
-        } else {
+            } else {
+
+                glTexSubImage2D(target + i, l,
+                                0, 0,
+                                w, h,
+                                format, GL_UNSIGNED_BYTE,
+                                level_src);
 
-            glTexSubImage2D(target + i, 0,
-                            0, 0,
-                            channel->width, channel->height,
-                            format, GL_UNSIGNED_BYTE,
-                            src + i*channel->size);
+            }
+
+            level_src += w * h * channel->channels;
+            get_downsampled_size(w, h, 2, &w, &h);
 
         }
 
     }
 
-    if (channel->filter == GL_LINEAR_MIPMAP_LINEAR) {
+    if (channel->pbo) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+
+    // mip chains for images in client memory get built at decode time
+    if (levels == 1 && channel->filter == GL_LINEAR_MIPMAP_LINEAR) {
 
         glGenerateMipmap(channel->target);
                 
@@ -615,29 +1214,58 @@ void update_teximage(channel_t* channel) {
 }
 
 //////////////////////////////////////////////////////////////////////
+// re-upload just the rows of the keyboard texture that changed
+
+void update_keyboard(channel_t* channel) {
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+    for (int row=0; row<KEYMAP_ROWS; ++row) {
+        
+        if (keymap_dirty_rows & (1 << row)) {
+            
+            glTexSubImage2D(GL_TEXTURE_2D, 0,
+                            0, row,
+                            channel->width, 1,
+                            GL_RGB, GL_UNSIGNED_BYTE,
+                            keymap + row*KEYMAP_BYTES_PER_ROW);
+            
+        }
+        
+    }
+
+    keymap_dirty_rows = 0;
+    
+}
+
+//////////////////////////////////////////////////////////////////////
+// filtering and wrapping live in a sampler object per channel, so
+// channels sharing a texture can still sample it differently
 
-void texture_parameters(const channel_t* channel) {
+void setup_sampler(channel_t* channel) {
 
     int mag = channel->filter;
     if (mag == GL_LINEAR_MIPMAP_LINEAR) {
         mag = GL_LINEAR;
     }
+
+    glGenSamplers(1, &channel->sampler);
         
-    glTexParameteri(channel->target,
-                    GL_TEXTURE_MAG_FILTER,
-                    mag);
+    glSamplerParameteri(channel->sampler,
+                        GL_TEXTURE_MAG_FILTER,
+                        mag);
 
-    glTexParameteri(channel->target,
-                    GL_TEXTURE_MIN_FILTER,
-                    channel->filter);
+    glSamplerParameteri(channel->sampler,
+                        GL_TEXTURE_MIN_FILTER,
+                        channel->filter);
 
-    glTexParameteri(channel->target,
-                    GL_TEXTURE_WRAP_S,
-                    channel->wrap);
+    glSamplerParameteri(channel->sampler,
+                        GL_TEXTURE_WRAP_S,
+                        channel->wrap);
 
-    glTexParameteri(channel->target,
-                    GL_TEXTURE_WRAP_T,
-                    channel->wrap);
+    glSamplerParameteri(channel->sampler,
+                        GL_TEXTURE_WRAP_T,
+                        channel->wrap);
 
 }
 
@@ -660,59 +1288,260 @@ void clear_framebuffer(renderbuffer_t* rb) {
 }
  
 //////////////////////////////////////////////////////////////////////
+// x, y, width and height of a -mosaic tile on the screen; tiles go
+// across and then down, starting from the top left
 
-void setup_framebuffer(renderbuffer_t* rb) {
-
-    dprintf("setting up framebuffer for %s\n", rb->name);
+void get_tile_rect(int idx, int rect[4]) {
 
-    glGenTextures(2, rb->draw_tex_ids);
-    glGenFramebuffers(2, rb->framebuffers);
+    int col = idx % mosaic_cols;
+    int row = mosaic_rows - 1 - idx / mosaic_cols;
 
-   
-    for (int i=0; i<2; ++i) {
-        
-        debug_glBindTexture(GL_TEXTURE_2D, rb->draw_tex_ids[i]);
-            
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-            
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F,
-                     render_framebuffer_size[0], render_framebuffer_size[1], 0,
-                     GL_RGBA, GL_FLOAT, 0);
-            
-        glBindFramebuffer(GL_FRAMEBUFFER, rb->framebuffers[i]);
+    const int* size = display_framebuffer_size;
 
-        glFramebufferTexture2D(GL_FRAMEBUFFER,
-                               GL_COLOR_ATTACHMENT0,
-                               GL_TEXTURE_2D,
-                               rb->draw_tex_ids[i],
-                               0);
+    rect[0] = size[0] * col / mosaic_cols;
+    rect[1] = size[1] * row / mosaic_rows;
+    rect[2] = size[0] * (col + 1) / mosaic_cols - rect[0];
+    rect[3] = size[1] * (row + 1) / mosaic_rows - rect[1];
+    
+}
 
-        GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+//////////////////////////////////////////////////////////////////////
+// size of the textures a pass draws into (or of its tile, with -mosaic)
 
-        require(status == GL_FRAMEBUFFER_COMPLETE);
+void get_pass_size(const renderbuffer_t* rb, int size[2]) {
 
+    if (mosaic) {
+        int rect[4];
+        get_tile_rect(rb - cur_shader->renderbuffers, rect);
+        size[0] = rect[2];
+        size[1] = rect[3];
+        return;
     }
 
-    rb->last_drawn = 1;
-    
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    if (rb->is_cubemap) {
+        size[0] = size[1] = CUBEMAP_BUFFER_SIZE;
+        return;
+    }
 
-    rb->framebuffer_state = FRAMEBUFFER_OK;
+    float scale = rb->resolution_scale ? rb->resolution_scale : 1;
+
+    for (int i=0; i<2; ++i) {
+        size[i] = (int)(render_framebuffer_size[i] * scale + 0.5f);
+        if (size[i] < 1) { size[i] = 1; }
+    }
+
+    if (rb->checkerboard) {
+        size[0] = (size[0] + 1) / 2;
+    }
+    
+}
+
+//////////////////////////////////////////////////////////////////////
+
+void setup_framebuffer(renderbuffer_t* rb) {
+
+    dprintf("setting up framebuffer for %s\n", rb->name);
+
+    glGenTextures(2, rb->draw_tex_ids);
+    glGenFramebuffers(2, rb->framebuffers);
+
+    GLenum target = rb->is_cubemap ? GL_TEXTURE_CUBE_MAP : GL_TEXTURE_2D;
+
+    int size[2];
+    get_pass_size(rb, size);
+   
+    for (int i=0; i<2; ++i) {
+        
+        debug_glBindTexture(target, rb->draw_tex_ids[i]);
+            
+        glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, rb->framebuffers[i]);
+
+        if (rb->is_cubemap) {
+
+            // half floats keep all six faces at 1024x1024 affordable
+            for (int face=0; face<6; ++face) {
+                glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, 0, GL_RGBA16F,
+                             size[0], size[1], 0,
+                             GL_RGBA, GL_FLOAT, 0);
+            }
+
+            // layered, so the geometry shader picks the face
+            glFramebufferTexture(GL_FRAMEBUFFER,
+                                 GL_COLOR_ATTACHMENT0,
+                                 rb->draw_tex_ids[i],
+                                 0);
+
+        } else {
+            
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F,
+                         size[0], size[1], 0,
+                         GL_RGBA, GL_FLOAT, 0);
+            
+            glFramebufferTexture2D(GL_FRAMEBUFFER,
+                                   GL_COLOR_ATTACHMENT0,
+                                   GL_TEXTURE_2D,
+                                   rb->draw_tex_ids[i],
+                                   0);
+
+        }
+
+        GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+
+        if (status != GL_FRAMEBUFFER_COMPLETE) {
+            fprintf(stderr, "error: framebuffer for %s is incomplete\n",
+                    rb->name);
+            if (gl_errors_fatal) { exit(1); }
+            gl_error_seen = 1;
+        }
+
+    }
+
+    rb->last_drawn = 1;
+    
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    rb->framebuffer_state = FRAMEBUFFER_OK;
 
     check_opengl_errors("setup_textures framebuffer");
 
 }
 
-void setup_textures(renderbuffer_t* rb) {
+//////////////////////////////////////////////////////////////////////
+// main thread: (re)map one of a video's unpack buffers and hand it to
+// the decoder thread
+
+void provide_video_slot(channel_t* channel, int slot) {
+
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, channel->video_pbos[slot]);
+
+    // orphan the old storage so mapping never waits on the GPU
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, channel->size, NULL, GL_STREAM_DRAW);
+
+    // the decoder only ever writes here, and reading back from an
+    // unpack buffer can be very slow
+    void* ptr = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, channel->size,
+                                 GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    if (!ptr) {
+        fprintf(stderr, "error mapping pixel unpack buffer!\n");
+        exit(1);
+    }
+
+    video_provide_slot(channel->video, slot, (unsigned char*)ptr);
+    
+}
+
+//////////////////////////////////////////////////////////////////////
+
+void setup_video(channel_t* channel) {
+
+    glGenTextures(1, &channel->tex_id);
+    glGenBuffers(VIDEO_SLOTS, channel->video_pbos);
+
+    for (int slot=0; slot<VIDEO_SLOTS; ++slot) {
+        provide_video_slot(channel, slot);
+    }
+
+    channel->video_seq = -1;
+
+    cur_shader->video_channels[cur_shader->num_video_channels++] = channel;
+
+    check_opengl_errors("after setting up video");
+    
+}
+
+//////////////////////////////////////////////////////////////////////
+// give back video slots whose uploads have finished; with wait set,
+// block until they all have
 
-    if (rb->framebuffer_state == FRAMEBUFFER_UNINITIALIZED) {
+void recycle_video_slots(channel_t* channel, int wait) {
 
-        setup_framebuffer(rb);
+    for (int slot=0; slot<VIDEO_SLOTS; ++slot) {
+
+        GLsync fence = channel->video_fences[slot];
+        if (!fence) { continue; }
+
+        GLenum status = glClientWaitSync(fence,
+                                         wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0,
+                                         wait ? 1000000000 : 0);
+
+        if (status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED) {
+            glDeleteSync(fence);
+            channel->video_fences[slot] = 0;
+            provide_video_slot(channel, slot);
+        }
         
     }
+    
+}
+
+//////////////////////////////////////////////////////////////////////
+// show the frame for the current time, if it's been decoded; whenever
+// frames come from fixed time steps instead of the clock (recording,
+// sweeps, -serve and the st_render API), wait for it so every frame
+// is exact
+
+void update_video(channel_t* channel) {
+
+    int wait = recording || num_sweep_keys || server || render_context;
+
+    recycle_video_slots(channel, wait);
+
+    double duration = channel->video_frames / channel->video_fps;
+
+    // wrapped into [0, duration) even for a negative -starttime
+    channel->video_time = fmod(u_time, duration);
+    if (channel->video_time < 0) { channel->video_time += duration; }
+    if (channel->video_time >= duration) { channel->video_time = 0; }
+
+    long seq = (long)floor(u_time * channel->video_fps);
+    if (seq < 0) { seq = 0; }
+
+    if (seq == channel->video_seq) { return; }
+
+    int slot = video_acquire(channel->video, seq, wait);
+
+    // keep showing the last frame in place of a broken one
+    if (slot == VIDEO_FRAME_FAILED) {
+        fprintf(stderr, "warning: skipping video frame %ld\n", seq);
+        channel->video_seq = seq;
+        return;
+    }
+
+    // realtime playback just keeps showing the last frame
+    if (slot < 0) { return; }
+
+    GLuint pbo = channel->video_pbos[slot];
+
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    debug_glBindTexture(GL_TEXTURE_2D, channel->tex_id);
+
+    channel->pbo = pbo;
+    update_teximage(channel);
+    channel->pbo = 0;
+
+    channel->video_fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    channel->video_seq = seq;
+
+    check_opengl_errors("after uploading video frame");
+    
+}
+
+//////////////////////////////////////////////////////////////////////
+
+void setup_textures(renderbuffer_t* rb) {
+
+    glUseProgram(rb->program);
 
     for (int i=0; i<4; ++i) {
 
@@ -721,21 +1550,25 @@ void setup_textures(renderbuffer_t* rb) {
 
         GLuint uniform_sampler = glGetUniformLocation(rb->program, channel->name);
         glUniform1i(uniform_sampler, i);
+
+        if (channel->ctype != CTYPE_NONE) {
+            setup_sampler(channel);
+        }
         
-        
-        if (channel->ctype && channel->ctype != CTYPE_BUFFER) {
+        // images get uploaded by upload_ready_images() once decoded,
+        // and videos by setup_context_objects()
+        if (channel->ctype == CTYPE_KEYBOARD && !channel->shared) {
 
             dprintf("setting up texture for channel %d of %s\n",
                     i, rb->name);
             
             glGenTextures(1, &channel->tex_id);
             debug_glBindTexture(channel->target, channel->tex_id);
-            texture_parameters(channel);
             update_teximage(channel);
 
             check_opengl_errors("after dealing with channel");
 
-        } 
+        }
         
     }
 
@@ -755,10 +1588,12 @@ void reset() {
     u_mouse[0] = u_mouse[1] = u_mouse[2] = u_mouse[3] = -1;
 
     memset(keymap, 0, KEYMAP_TOTAL_BYTES);
+    keymap_dirty_rows = KEYMAP_ALL_DIRTY;
+    any_key_pressed = 0;
 
-    for (int j=0; j<num_renderbuffers; ++j) {
+    for (int j=0; j<cur_shader->num_renderbuffers; ++j) {
         
-        renderbuffer_t* rb = renderbuffers + j;
+        renderbuffer_t* rb = cur_shader->renderbuffers + j;
 
         if (rb->framebuffer_state != FRAMEBUFFER_NONE) {
             clear_framebuffer(rb);
@@ -777,8 +1612,8 @@ void reset() {
 
 void set_uniforms(renderbuffer_t* rb) {
 
-    for (size_t i=0; i<num_uniforms; ++i) {
-        const uniform_t* u = uinfo + i;
+    for (size_t i=0; i<cur_shader->num_uniforms; ++i) {
+        const uniform_t* u = cur_shader->uinfo + i;
         switch (u->ptr_type) {
         case GL_FLOAT:
             u->float_func(rb->uniform_handles[i], u->array_length, (const GLfloat*)u->src);
@@ -797,7 +1632,9 @@ void set_uniforms(renderbuffer_t* rb) {
 
 //////////////////////////////////////////////////////////////////////
 
-void screenshot() {
+// returns a malloc'd copy of the RGB pixels just drawn
+
+unsigned char* read_screen(int* stride_out) {
     
     glFinish();
 
@@ -809,7 +1646,7 @@ void screenshot() {
     int align;
     glGetIntegerv(GL_PACK_ALIGNMENT, &align);
 
-    printf("alignment is %d\n", align);
+    dprintf("alignment is %d\n", align);
 
     if (stride % align) {
         stride += align - stride % align;
@@ -823,11 +1660,49 @@ void screenshot() {
     }
   
     glReadPixels(0, 0, w, h, GL_RGB, GL_UNSIGNED_BYTE, screen);
+
+    *stride_out = stride;
+    return screen;
+    
+}
+
+//////////////////////////////////////////////////////////////////////
+
+void screenshot() {
+
+    int w = render_framebuffer_size[0];
+    int h = render_framebuffer_size[1];
+
+    int stride;
+    unsigned char* screen = read_screen(&stride);
   
     char buf[BIG_STRING_LENGTH];
-    snprintf(buf, BIG_STRING_LENGTH, "frame%04d.png", png_frame++);
-  
-    write_png(buf, screen, w, h, stride, 1, pixel_scale);
+
+    if (mosaic) {
+
+        // one readback for the whole mosaic, then a PNG per tile
+        for (int j=0; j<cur_shader->num_renderbuffers; ++j) {
+
+            int rect[4];
+            get_tile_rect(j, rect);
+
+            snprintf(buf, BIG_STRING_LENGTH, "frame%04d-%02d-%s.png",
+                     png_frame, j, cur_shader->renderbuffers[j].name);
+
+            write_png(buf, screen + rect[1]*stride + 3*rect[0],
+                      rect[2], rect[3], stride, 1, pixel_scale);
+
+        }
+
+        ++png_frame;
+
+    } else {
+        
+        snprintf(buf, BIG_STRING_LENGTH, "frame%04d.png", png_frame++);
+        write_png(buf, screen, w, h, stride, 1, pixel_scale);
+
+    }
+    
     free(screen);
   
     if (single_shot) {
@@ -842,6 +1717,40 @@ int min(int a, int b) {
     return a < b ? a : b;
 }
 
+//////////////////////////////////////////////////////////////////////
+// free the unpack buffers of uploads that the GPU has finished,
+// without ever waiting on the ones it hasn't
+
+void retire_uploads() {
+
+    for (int k=0; k<cur_shader->num_inflight_uploads; ) {
+
+        channel_t* channel = cur_shader->inflight_uploads[k];
+        
+        GLenum status = glClientWaitSync(channel->upload_fence, 0, 0);
+
+        if (status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED) {
+
+            glDeleteSync(channel->upload_fence);
+            glDeleteBuffers(1, &channel->pbo);
+
+            channel->upload_fence = 0;
+            channel->pbo = 0;
+            channel->staging = STAGING_NONE;
+            
+            int last = --cur_shader->num_inflight_uploads;
+            cur_shader->inflight_uploads[k] = cur_shader->inflight_uploads[last];
+            
+        } else {
+            
+            ++k;
+            
+        }
+        
+    }
+    
+}
+
 //////////////////////////////////////////////////////////////////////
 
 void resize_framebuffers(renderbuffer_t* rb) {
@@ -860,6 +1769,9 @@ void resize_framebuffers(renderbuffer_t* rb) {
 
     setup_framebuffer(rb);
     clear_framebuffer(rb);
+
+    int size[2];
+    get_pass_size(rb, size);
     
     for (int i=0; i<2; ++i) {
 
@@ -870,8 +1782,8 @@ void resize_framebuffers(renderbuffer_t* rb) {
         
         debug_glBindTexture(GL_TEXTURE_2D, 0);
         
-        int blitw = min(w, render_framebuffer_size[0]);
-        int blith = min(h, render_framebuffer_size[1]);
+        int blitw = min(w, size[0]);
+        int blith = min(h, size[1]);
         
         glBindFramebuffer(GL_READ_FRAMEBUFFER, prev_framebuffers[i]);
         glBindFramebuffer(GL_DRAW_FRAMEBUFFER, rb->framebuffers[i]);
@@ -892,6 +1804,143 @@ void resize_framebuffers(renderbuffer_t* rb) {
 
 }
 
+//////////////////////////////////////////////////////////////////////
+
+void get_specialized_values(GLfloat values[NUM_SPECIALIZED_VALUES]) {
+
+    memcpy(values, u_resolution, 3*sizeof(GLfloat));
+    memcpy(values+3, u_channel_resolution, 3*NUM_CHANNELS*sizeof(GLfloat));
+    values[3+3*NUM_CHANNELS] = u_sample_rate;
+    
+}
+
+//////////////////////////////////////////////////////////////////////
+// rebuild a pass's program from its current fragment_src slots and
+// the current defines; returns 0 if it failed and errors aren't fatal,
+// in which case the old program stays
+
+int recompile_program(renderbuffer_t* rb) {
+
+    GLuint prev_program = rb->program;
+
+    setup_shaders(rb);
+
+    if (rb->program == prev_program) {
+        return 0;
+    }
+    
+    glDeleteProgram(prev_program);
+
+    // uniform locations and sampler units belong to the old program
+    for (int k=0; k<cur_shader->num_uniforms; ++k) {
+        rb->uniform_handles[k] = glGetUniformLocation(rb->program,
+                                                      cur_shader->uinfo[k].name);
+    }
+
+    for (int i=0; i<NUM_CHANNELS; ++i) {
+        glUniform1i(glGetUniformLocation(rb->program, rb->channels[i].name), i);
+    }
+
+    return 1;
+    
+}
+
+//////////////////////////////////////////////////////////////////////
+// returns 1 if the uniform declaration of the given length declares
+// one of the names in the NULL-terminated list
+
+int declares_any(const char* decl, size_t length, const char** names) {
+
+    for (int k=0; names[k]; ++k) {
+
+        size_t n = strlen(names[k]);
+
+        for (size_t i=1; i+n<length; ++i) {
+            if (decl[i-1] == ' ' && !memcmp(decl+i, names[k], n) &&
+                (decl[i+n] == ';' || decl[i+n] == '[')) {
+                return 1;
+            }
+        }
+        
+    }
+
+    return 0;
+    
+}
+
+//////////////////////////////////////////////////////////////////////
+// recompile a pass with the uniforms that can't change during a
+// -record or -profile run turned into constants of the same names, so
+// the compiler can fold them
+
+void specialize_program(renderbuffer_t* rb,
+                        const GLfloat values[NUM_SPECIALIZED_VALUES]) {
+
+    const char* fixed_names[] = {
+        "iResolution", "iChannelResolution", "iSampleRate", NULL
+    };
+
+    buffer_t* buf = &rb->specialized_buf;
+    buf_free(buf);
+
+    // keep every other declaration of the default uniforms slot
+    const char* decl = default_fragment_src[FRAG_SRC_UNIFORMS_SLOT];
+
+    while (*decl) {
+
+        const char* end = strchr(decl, ';');
+        require(end);
+
+        size_t length = end + 1 - decl;
+        
+        if (!declares_any(decl, length, fixed_names)) {
+            buf_append_mem(buf, decl, length, BUF_NULL_TERMINATE);
+            buf_append_mem(buf, " ", 1, BUF_NULL_TERMINATE);
+        }
+
+        decl = end + 1;
+        while (*decl == ' ') { ++decl; }
+        
+    }
+
+    const GLfloat* res = values;
+    const GLfloat* cres = values + 3;
+
+    char consts[BIG_STRING_LENGTH];
+    int l = snprintf(consts, BIG_STRING_LENGTH,
+                     "\nconst vec3 iResolution = vec3(%.1f, %.1f, %.1f);\n"
+                     "const vec3 iChannelResolution[4] = vec3[4](",
+                     res[0], res[1], res[2]);
+
+    for (int i=0; i<NUM_CHANNELS; ++i) {
+        l += snprintf(consts + l, BIG_STRING_LENGTH - l,
+                      "%svec3(%.1f, %.1f, %.1f)", i ? ", " : "",
+                      cres[3*i+0], cres[3*i+1], cres[3*i+2]);
+    }
+
+    l += snprintf(consts + l, BIG_STRING_LENGTH - l,
+                  ");\nconst float iSampleRate = %.1f;\n",
+                  values[3+3*NUM_CHANNELS]);
+
+    require(l < BIG_STRING_LENGTH);
+
+    buf_append_mem(buf, consts, l, BUF_NULL_TERMINATE);
+
+    rb->fragment_src[FRAG_SRC_UNIFORMS_SLOT] = buf->data;
+
+    dprintf("specializing %s for %gx%g\n", rb->name, res[0], res[1]);
+
+    recompile_program(rb);
+
+    memcpy(rb->specialized_values, values, sizeof(rb->specialized_values));
+    rb->specialized = 1;
+
+    check_opengl_errors("after specializing program");
+    
+}
+
+//////////////////////////////////////////////////////////////////////
+
 void render(GLFWwindow* window) {   
 
     double frame_start = glfwGetTime();
@@ -914,18 +1963,28 @@ void render(GLFWwindow* window) {
     u_date[3] = ( ((ltime->tm_hour * 60.f) + ltime->tm_min) * 60.f +
                   ltime->tm_sec + tv.tv_usec * 1e-6f );
 
-    u_resolution[0] = render_framebuffer_size[0];
-    u_resolution[1] = render_framebuffer_size[1];
-    u_resolution[2] = 1.f;
-
     check_opengl_errors("before set uniforms");
 
-    int screenshot_idx = num_renderbuffers - 1;
+    if (cur_shader->num_inflight_uploads) {
+        retire_uploads();
+    }
+
+    for (int k=0; k<cur_shader->num_video_channels; ++k) {
+        update_video(cur_shader->video_channels[k]);
+    }
+
+    // shared by every pass that reads the keyboard
+    if (cur_shader->keyboard_channel && keymap_dirty_rows) {
+        debug_glBindTexture(GL_TEXTURE_2D, cur_shader->keyboard_channel->tex_id);
+        update_keyboard(cur_shader->keyboard_channel);
+    }
+
+    int screenshot_idx = cur_shader->num_renderbuffers - 1;
     if (is_scaled) { screenshot_idx -= 1; }
     
-    for (int j=0; j<num_renderbuffers; ++j) {
+    for (int j=0; j<cur_shader->num_renderbuffers; ++j) {
 
-        renderbuffer_t* rb = renderbuffers + draw_order[j];
+        renderbuffer_t* rb = cur_shader->renderbuffers + cur_shader->draw_order[j];
 
         if (rb->framebuffer_state == FRAMEBUFFER_BADSIZE) {
 
@@ -936,6 +1995,14 @@ void render(GLFWwindow* window) {
         require(rb->framebuffer_state == FRAMEBUFFER_NONE ||
                 rb->framebuffer_state == FRAMEBUFFER_OK);
 
+        // skipped passes leave last_drawn alone, so readers (including
+        // the pass itself, next time) see its last output
+        if (rb->update_interval > 1 &&
+            u_frame % rb->update_interval != rb->update_phase) {
+            dprintf("skipping %s this frame\n", rb->name);
+            continue;
+        }
+
 
         int cur_draw = 0;
 
@@ -952,32 +2019,63 @@ void render(GLFWwindow* window) {
         glUseProgram(rb->program);
         check_opengl_errors("before doing texture stuff");
 
+        int size[2];
+        get_pass_size(rb, size);
+
+        u_resolution[0] = size[0];
+        u_resolution[1] = size[1];
+        u_resolution[2] = 1.f;
+
+        // the shader still sees the full-size image it's drawing
+        if (rb->checkerboard) {
+            u_resolution[0] = render_framebuffer_size[0];
+        }
+
+        if (mosaic) {
+            int rect[4];
+            get_tile_rect(cur_shader->draw_order[j], rect);
+            u_tile_origin[0] = rect[0];
+            u_tile_origin[1] = rect[1];
+        }
+
         for (int i=0; i<NUM_CHANNELS; ++i) {
 
             channel_t* channel = rb->channels + i;
+            channel_t* tex = channel->shared ? channel->shared : channel;
 
             debug_glActiveTexture(GL_TEXTURE0 + i);
             dprintf("doing texture thing for channel %d of %s\n",
                     i, rb->name);
 
-            if (channel->ctype == CTYPE_BUFFER) {
+            glBindSampler(i, channel->sampler);
+
+            if (channel->ctype == CTYPE_BUFFER ||
+                channel->ctype == CTYPE_CUBEBUFFER) {
 
                 require(channel->src_rb_idx >= 0 &&
-                        channel->src_rb_idx < num_renderbuffers);
+                        channel->src_rb_idx < cur_shader->num_renderbuffers);
+
+                renderbuffer_t* src_rb = (cur_shader->renderbuffers +
+                                          channel->src_rb_idx);
+
+                GLenum target = (src_rb->is_cubemap ?
+                                 GL_TEXTURE_CUBE_MAP : GL_TEXTURE_2D);
 
-                renderbuffer_t* src_rb = renderbuffers + channel->src_rb_idx;
+                int src_size[2];
+                get_pass_size(src_rb, src_size);
 
-                channel->width = render_framebuffer_size[0];
-                channel->height = render_framebuffer_size[1];
+                channel->width = src_size[0];
+                channel->height = src_size[1];
 
-                GLuint src_tex = src_rb->draw_tex_ids[src_rb->last_drawn];
+                int src_idx = src_rb->last_drawn;
+                if (channel->previous_frame) { src_idx = 1 - src_idx; }
+
+                GLuint src_tex = src_rb->draw_tex_ids[src_idx];
                 
-                debug_glBindTexture(GL_TEXTURE_2D, src_tex);
+                debug_glBindTexture(target, src_tex);
                 
-                texture_parameters(channel);
-
                 if (channel->filter == GL_LINEAR_MIPMAP_LINEAR) {
-                    glGenerateMipmap(GL_TEXTURE_2D);
+                    glGenerateMipmap(target);
                 }
 
                 dprintf("  channel %d of %s has dims %dx%d, is using "
@@ -987,30 +2085,47 @@ void render(GLFWwindow* window) {
 
             } else {
 
-                debug_glBindTexture(channel->target, channel->tex_id);
+                debug_glBindTexture(tex->target, tex->tex_id);
                 
-                if (channel->dirty || channel->ctype == CTYPE_KEYBOARD) {
-                    update_teximage(channel);
+                if (tex->dirty) {
+                    update_teximage(tex);
                 }
 
             }
             
             check_opengl_errors("after a texture thing");
 
-            u_channel_resolution[i][0] = channel->width;
-            u_channel_resolution[i][1] = channel->height;
+            u_channel_resolution[i][0] = tex->width;
+            u_channel_resolution[i][1] = tex->height;
             u_channel_resolution[i][2] = 1.;
+
+            u_channel_time[i] = (tex->ctype == CTYPE_VIDEO) ? tex->video_time : 0;
             
         
         }
 
+        // a resize changes the values, so the pass gets recompiled
+        if (specialize) {
+            
+            GLfloat values[NUM_SPECIALIZED_VALUES];
+            get_specialized_values(values);
+            
+            if (!rb->specialized ||
+                memcmp(values, rb->specialized_values, sizeof(values))) {
+                specialize_program(rb, values);
+            }
+            
+        }
+
         set_uniforms(rb);
         check_opengl_errors("after set uniforms");
 
-        if (j == num_renderbuffers - 1) {
+        if (mosaic) {
+            glViewport(u_tile_origin[0], u_tile_origin[1], size[0], size[1]);
+        } else if (j == cur_shader->num_renderbuffers - 1) {
             glViewport(0, 0, display_framebuffer_size[0], display_framebuffer_size[1]);
         } else {
-            glViewport(0, 0, render_framebuffer_size[0], render_framebuffer_size[1]);
+            glViewport(0, 0, size[0], size[1]);
         }
 
         glBindVertexArray(rb->vao);
@@ -1028,6 +2143,12 @@ void render(GLFWwindow* window) {
             screenshot();
         }
 
+        if (j == screenshot_idx && capture_next_frame) {
+            free(captured_pixels);
+            captured_pixels = read_screen(&captured_stride);
+            capture_next_frame = 0;
+        }
+
     }
 
     glFinish();
@@ -1035,7 +2156,9 @@ void render(GLFWwindow* window) {
     u_time_delta = frame_end - frame_start;
     
     if (profiling && u_frame >= startup_frames) {
-        printf("draw time = %8.1f ms/frame\n", u_time_delta*1e3);
+        if (!num_sweep_keys) {
+            printf("draw time = %8.1f ms/frame\n", u_time_delta*1e3);
+        }
         total_delta += u_time_delta;
         total_delta2 += u_time_delta*u_time_delta;
     }
@@ -1044,12 +2167,22 @@ void render(GLFWwindow* window) {
 
     glfwSwapBuffers(window);
 
-    memset(key_press, 0, KEYMAP_BYTES_PER_ROW);
+    if (!first_frame_drawn) {
+        log_startup("first frame");
+        first_frame_drawn = 1;
+    }
 
+    if (any_key_pressed) {
+        memset(key_press, 0, KEYMAP_BYTES_PER_ROW);
+        keymap_dirty_rows |= KEY_PRESS_DIRTY;
+        any_key_pressed = 0;
+    }
     
     u_frame += 1;
 
-    if (recording) {
+    // sweep variants and server clients all see the same sequence
+    // of times
+    if (recording || num_sweep_keys || server) {
         u_time += target_frame_duration*speedup;
     } else if (animating) {
         u_time += (frame_start - last_frame_start)*speedup;
@@ -1063,6 +2196,125 @@ void render(GLFWwindow* window) {
 
 
 
+//////////////////////////////////////////////////////////////////////
+// render the whole sound pass out to a .wav file, a block of
+// SOUND_BLOCK_WIDTH x SOUND_BLOCK_HEIGHT samples per draw
+
+void render_sound() {
+
+    renderbuffer_t* rb = &cur_shader->sound_pass;
+
+    GLuint fbo, tex;
+
+    glGenTextures(1, &tex);
+    glBindTexture(GL_TEXTURE_2D, tex);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RG32F,
+                 SOUND_BLOCK_WIDTH, SOUND_BLOCK_HEIGHT, 0,
+                 GL_RG, GL_FLOAT, NULL);
+
+    glGenFramebuffers(1, &fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                           GL_TEXTURE_2D, tex, 0);
+
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        fprintf(stderr, "error: can't render sound into a float framebuffer!\n");
+        exit(1);
+    }
+
+    glUseProgram(rb->program);
+
+    for (int i=0; i<NUM_CHANNELS; ++i) {
+
+        channel_t* channel = rb->channels + i;
+        channel_t* tex = channel->shared ? channel->shared : channel;
+
+        debug_glActiveTexture(GL_TEXTURE0 + i);
+        glBindSampler(i, channel->sampler);
+        debug_glBindTexture(tex->target, tex->tex_id);
+
+        if (tex->dirty) {
+            update_teximage(tex);
+        }
+
+        u_channel_resolution[i][0] = tex->width;
+        u_channel_resolution[i][1] = tex->height;
+        u_channel_resolution[i][2] = 1.;
+        
+    }
+
+    glViewport(0, 0, SOUND_BLOCK_WIDTH, SOUND_BLOCK_HEIGHT);
+    glBindVertexArray(rb->vao);
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+
+    const size_t block_samples = SOUND_BLOCK_WIDTH * SOUND_BLOCK_HEIGHT;
+
+    GLfloat* block = (GLfloat*)malloc(block_samples * SOUND_CHANNELS * sizeof(GLfloat));
+    int16_t* pcm = (int16_t*)malloc(block_samples * SOUND_CHANNELS * sizeof(int16_t));
+
+    if (!block || !pcm) {
+        fprintf(stderr, "out of memory in render_sound!\n");
+        exit(1);
+    }
+
+    // start where the picture starts so the two line up
+    long first_sample = (long)floor(starttime * u_sample_rate);
+    size_t total = (size_t)ceil(sound_duration * u_sample_rate);
+
+    wav_writer_t wav;
+    wav_open(&wav, sound_output, (int)u_sample_rate, SOUND_CHANNELS);
+
+    double start = glfwGetTime();
+
+    for (size_t done=0; done<total; done+=block_samples) {
+
+        size_t count = total - done;
+        if (count > block_samples) { count = block_samples; }
+
+        // whole rows only, but just as many as needed
+        size_t rows = (count + SOUND_BLOCK_WIDTH - 1) / SOUND_BLOCK_WIDTH;
+
+        long sample = first_sample + (long)done;
+        
+        u_sound_sample = sample;
+        u_sound_time = sample / (double)u_sample_rate;
+        u_time = u_sound_time;
+
+        set_uniforms(rb);
+
+        glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_BYTE, (void*)0);
+
+        glReadPixels(0, 0, SOUND_BLOCK_WIDTH, rows,
+                     GL_RG, GL_FLOAT, block);
+
+        check_opengl_errors("after rendering sound block");
+
+        for (size_t i=0; i<count*SOUND_CHANNELS; ++i) {
+            pcm[i] = (int16_t)lrintf(block[i] * 32767.f);
+        }
+
+        wav_write(&wav, pcm, count);
+
+    }
+
+    if (!wav_close(&wav)) {
+        fprintf(stderr, "error writing %s\n", sound_output);
+        exit(1);
+    }
+
+    printf("wrote %.2f seconds of sound to %s in %.3f seconds\n",
+           total / (double)u_sample_rate, sound_output,
+           glfwGetTime() - start);
+
+    free(block);
+    free(pcm);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDeleteFramebuffers(1, &fbo);
+    glDeleteTextures(1, &tex);
+    
+}
+
 //////////////////////////////////////////////////////////////////////
 
 void new_shader_source(renderbuffer_t* rb) {
@@ -1076,6 +2328,33 @@ void new_shader_source(renderbuffer_t* rb) {
                    BUF_NULL_TERMINATE);
 }
 
+//////////////////////////////////////////////////////////////////////
+// pass is an index into renderbuffers, or SOURCE_COMMON
+
+void watch_source(const char* path, int pass) {
+
+    if (!watching) { return; }
+
+    if (!watcher) {
+        
+        watcher = watch_create();
+        
+        if (!watcher) {
+            fprintf(stderr, "warning: can't watch shader files for changes here\n");
+            watching = 0;
+            return;
+        }
+        
+    }
+
+    int id = watch_add(watcher, path);
+    require(id == num_watched_sources);
+    
+    source_passes[id] = pass;
+    ++num_watched_sources;
+    
+}
+
 //////////////////////////////////////////////////////////////////////
 
 void setup_keyboard(renderbuffer_t* rb, int cidx) {
@@ -1083,6 +2362,7 @@ void setup_keyboard(renderbuffer_t* rb, int cidx) {
     channel_t* channel = rb->channels + cidx;
 
     channel->ctype = CTYPE_KEYBOARD;
+    channel->channels = 3;
     channel->width = KEYMAP_BYTES_PER_ROW / 3;
     channel->height = KEYMAP_ROWS;
     channel->size = KEYMAP_TOTAL_BYTES;
@@ -1090,894 +2370,2898 @@ void setup_keyboard(renderbuffer_t* rb, int cidx) {
     channel->filter = GL_NEAREST;
     channel->wrap = GL_CLAMP_TO_EDGE;
 
-    memset(keymap, 0, KEYMAP_TOTAL_BYTES);
+    if (cur_shader->keyboard_channel && cur_shader->keyboard_channel != channel) {
+        channel->shared = cur_shader->keyboard_channel;
+    } else {
+        cur_shader->keyboard_channel = channel;
+    }
 
 }
 
 //////////////////////////////////////////////////////////////////////
+// if some channel already loads this image (or cubemap), share its
+// texture and return 1; otherwise register this channel as the owner
 
-void load_image(channel_t* channel, const char* src, int is_local_file) {
-
-    buffer_t raw = { 0, 0, 0 };
-            
-    if (is_local_file) {
-
-        buf_append_file(&raw, src, MAX_FILE_LENGTH, BUF_RAW_APPEND);
-
-    } else {
+int find_shared_texture(channel_t* channel, const char* src) {
 
-        fetch_url(src, &raw);
+    for (int k=0; k<cur_shader->num_texture_sources; ++k) {
 
-    }
+        texture_source_t* ts = cur_shader->texture_sources + k;
 
-    const char* extension = get_extension(src);
+        if (ts->ctype == channel->ctype &&
+            ts->vflip == channel->vflip &&
+            !strcmp(ts->src, src)) {
 
-    if (!strcasecmp(extension, "jpg") ||
-        !strcasecmp(extension, "jpeg")) {
+            channel_t* owner = ts->channel;
 
-        read_jpg(&raw, channel->vflip,
-                 &channel->channels,
-                 &channel->width, &channel->height, &channel->size,
-                 &channel->texture);
-                
-    } else if (!strcasecmp(extension, "png")) {
+            dprintf("sharing texture for %s\n", src);
 
-        read_png(&raw, channel->vflip,
-                 &channel->channels,
-                 &channel->width, &channel->height, &channel->size,
-                 &channel->texture);
+            channel->shared = owner;
+            owner->want_mipmaps = owner->want_mipmaps || channel->want_mipmaps;
+            
+            return 1;
+            
+        }
+        
+    }
 
-    } else {
+    require(cur_shader->num_texture_sources < MAX_PASSES*NUM_CHANNELS);
 
-        fprintf(stderr, "unrecognized media extension\n");
-        exit(1);
-                    
+    if (strlen(src) >= BIG_STRING_LENGTH) {
+        jsfail("error: filename too long!");
     }
 
-    buf_free(&raw);
+    texture_source_t* ts = (cur_shader->texture_sources +
+                            cur_shader->num_texture_sources);
+    ++cur_shader->num_texture_sources;
+
+    ts->ctype = channel->ctype;
+    ts->vflip = channel->vflip;
+    strcpy(ts->src, src);
+    ts->channel = channel;
 
+    return 0;
+    
 }
 
 //////////////////////////////////////////////////////////////////////
 
-void load_inputs(renderbuffer_t* rb, json_t* inputs, int is_local) {
+void queue_image(channel_t* channel, int face,
+                 const char* src, int is_local_file) {
 
-    const char* src_strings[3] = { "src", NULL, NULL };
-    
-    if (is_local) {
-        src_strings[1] = "src_file";
+    if (num_image_requests >= MAX_IMAGE_REQUESTS) {
+        jsfail("error: maximum # of images exceeded, "
+               "increase MAX_IMAGE_REQUESTS");
     }
-    
-    int ninputs = json_array_size(inputs);
 
-    for (int i=0; i<ninputs; ++i) {
-        
-        json_t* input_i = jsarray(inputs, i, JSON_OBJECT);
-        
-        int cidx = jsobject_integer(input_i, "channel");
-        
-        if (cidx < 0 || cidx >= NUM_CHANNELS) {
-            fprintf(stderr, "invalid channel for input %d\n", i);
-            exit(1);
-        }
+    if (strlen(src) >= BIG_STRING_LENGTH) {
+        jsfail("error: filename too long!");
+    }
 
-        channel_t* channel = rb->channels + cidx;
+    image_request_t* req = image_requests + num_image_requests;
+    ++num_image_requests;
 
-        json_t* sampler = jsobject(input_i, "sampler", JSON_OBJECT);
+    req->channel = channel;
+    req->face = face;
+    strcpy(req->src, src);
+    req->is_local_file = is_local_file;
 
-        const enum_info_t filter_enums[] = {
-            { "nearest", GL_NEAREST },
-            { "mipmap", GL_LINEAR },
-            { "linear", GL_LINEAR_MIPMAP_LINEAR },
-            { 0, -1 },
-        };
+    if (channel->pending_faces++ == 0) {
+        ++num_loading_channels;
+    }
+    
+}
 
-        const enum_info_t tf_enums[] = {
-            { "true", 1 },
-            { "false", 0 },
-            { 0, -1 },
-        };
+//////////////////////////////////////////////////////////////////////
+// called from a decode_pool worker once a face is in place
 
-        const enum_info_t wrap_enums[] = {
-            { "clamp", GL_CLAMP_TO_EDGE },
-            { "repeat", GL_REPEAT },
-            { 0, -1 },
-        };
-        
-        channel->filter = lookup_enum(filter_enums, 
-                                      jsobject_string(sampler, "filter"));
+void image_done(image_request_t* req) {
 
-        channel->srgb = lookup_enum(tf_enums,
-                                    jsobject_string(sampler, "srgb"));
+    channel_t* channel = req->channel;
 
-        channel->vflip = lookup_enum(tf_enums,
-                                     jsobject_string(sampler, "vflip"));
+    pthread_mutex_lock(&image_mutex);
 
-        channel->wrap = lookup_enum(wrap_enums,
-                                    jsobject_string(sampler, "wrap"));
+    if (--channel->pending_faces == 0) {
+        ready_channels[num_ready_channels++] = channel;
+        pthread_cond_signal(&image_ready_cond);
+    }
+    
+    pthread_mutex_unlock(&image_mutex);
+    
+}
 
-        channel->src_rb_idx = -1;
+//////////////////////////////////////////////////////////////////////
+// for channels whose pixels are already in memory, e.g. from a bundle
 
-        const char* ctype = jsobject_string(input_i, "ctype");
+void channel_ready(channel_t* channel) {
 
-        int src_is_file = 0;
-        const char* src = jsobject_first_string(input_i, src_strings, &src_is_file);
+    pthread_mutex_lock(&image_mutex);
 
-        char url[1024];
+    ++num_loading_channels;
+    ready_channels[num_ready_channels++] = channel;
+    
+    pthread_mutex_unlock(&image_mutex);
+    
+}
 
-        if (!src_is_file) { 
-            snprintf(url, 1024, "http://www.shadertoy.com%s", src);
-            src = url;
-       }
+//////////////////////////////////////////////////////////////////////
 
-        if (!strcmp(ctype, "keyboard")) {
-            
-            setup_keyboard(rb, cidx);
-            
-        } else if (!strcmp(ctype, "texture")) {
-            
-            channel->ctype = CTYPE_TEXTURE;
+int channel_faces(const channel_t* channel) {
+    return (channel->ctype == CTYPE_CUBEMAP) ? 6 : 1;
+}
 
-            load_image(channel, src, src_is_file);
+//////////////////////////////////////////////////////////////////////
+// where a decode_pool worker should write this image, which may mean
+// waiting for the main thread to map an unpack buffer for it
 
-        } else if (!strcmp(ctype, "cubemap")) {
-            
-            channel->target = GL_TEXTURE_CUBE_MAP;
-            channel->ctype = CTYPE_CUBEMAP;
+unsigned char* image_slice(image_request_t* req) {
 
-            const char* dot = strrchr(src, '.');
-            if (!dot) { dot = src + strlen(src); }
+    channel_t* channel = req->channel;
 
-            int base_len = dot - src;
-            int ext_len = strlen(dot);
+    pthread_mutex_lock(&image_mutex);
 
-            if (base_len + ext_len + 2 > 1023) {
-                fprintf(stderr, "error: filename too long!\n");
-                exit(1);
-            }
-            
-            char base[1024];
-            memcpy(base, src, base_len);
-            base[base_len] = 0;
+    while (channel->staging == STAGING_REQUESTED) {
+        pthread_cond_wait(&staging_cond, &image_mutex);
+    }
 
-            for (int i=0; i<6; ++i) {
+    unsigned char* dst = ((unsigned char*)channel->texture.data +
+                          req->face * channel->size);
+    
+    pthread_mutex_unlock(&image_mutex);
 
-                const char* src_i;
+    return dst;
+    
+}
 
-                if (i == 0) {
-                    src_i = src;
-                } else {
-                    int ii = i;
-                    if (channel->vflip) {
-                        if (ii == 2) { ii = 3; }
-                        else if (ii == 3) { ii = 2; }
-                    }
-                    snprintf(base + base_len, 1024-base_len, "_%d%s", ii, dot);
-                    src_i = base;
-                }
+//////////////////////////////////////////////////////////////////////
+// runs on a decode_pool worker thread
 
-                printf("loading %s\n", src_i);
-                load_image(channel, src_i, src_is_file);
-                
-            }
+void decode_image_job(void* arg) {
 
-        } else if (!strcmp(ctype, "buffer")) {
+    image_request_t* req = (image_request_t*)arg;
+    channel_t* channel = req->channel;
 
-            channel->ctype = CTYPE_BUFFER;
-            channel->src_rb_idx = jsobject_integer(input_i, "id");
+    pthread_mutex_lock(&image_mutex);
+    int staged = (channel->staging != STAGING_NONE);
+    pthread_mutex_unlock(&image_mutex);
 
-        } else {
+    unsigned char* dst = image_slice(req);
+    
+    read_image(&req->raw, req->info.type, channel->vflip,
+               max_texture_size, &req->info, dst);
 
-            fprintf(stderr, "warning: ignoring input type %s\n", ctype);
-                        
-        }
+    buf_free(&req->raw);
+
+    // unpack buffers are mapped write-only, and reading them back can
+    // be very slow, so a staged image is just the base level, which
+    // the GPU builds the rest from (see update_teximage()), and it
+    // doesn't go in the cache
+    if (!staged) {
+        
+        build_mipmaps(dst, channel->width, channel->height,
+                      channel->channels, channel->levels);
+
+        texcache_store(req->cache_key,
+                       channel->channels, channel->width, channel->height,
+                       channel->levels, dst, channel->size);
         
     }
 
+    image_done(req);
+
 }
 
 //////////////////////////////////////////////////////////////////////
+// runs on a decode_pool worker thread
 
-void load_json(int is_local) {
+void copy_cached_job(void* arg) {
 
-    json_root = jsparse(&json_buf);
+    image_request_t* req = (image_request_t*)arg;
 
-    json_t* shader = jsobject(json_root, "Shader", JSON_OBJECT);
+    // a staged channel only takes the base level of the chain
+    memcpy(image_slice(req), req->cached.data, req->channel->size);
+    texcache_free(&req->cached);
 
-    json_t* info = json_object_get(shader, "info");
-    if (info && json_typeof(info) == JSON_OBJECT) {
-        const char* name = jsobject_string(info, "name");
-        const char* author = jsobject_string(info, "username");
-        snprintf(window_title, BIG_STRING_LENGTH, "\"%s\" by %s",
-                 name, author);
-    }
+    image_done(req);
     
-    json_t* renderpass = jsobject(shader, "renderpass", JSON_ARRAY);
-
-    size_t len = json_array_size(renderpass);
+}
 
-    int image_index = -1;
-    json_t* common = NULL;
+//////////////////////////////////////////////////////////////////////
+// sizes the channel texture for all faces and mip levels the first
+// time through, and arranges for memory to put it in. A freshly
+// decoded image headed for the texture cache has to stay in client
+// memory; anything else goes straight into an unpack buffer, if
+// those are enabled, and gets its mips from the GPU.
 
-    const char* code_strings[3] = { "code", NULL, NULL };
-    
-    if (is_local) {
-        code_strings[1] = "code_file";
-    }
+void claim_image_slice(image_request_t* req, int from_cache,
+                       size_t channels, size_t width, size_t height) {
 
-    int output_ids[MAX_RENDERBUFFERS];
-    
-    for (int j=0; j<len; ++j) {
+    channel_t* channel = req->channel;
 
-        json_t* renderstep = jsarray(renderpass, j, JSON_OBJECT);
+    int faces = channel_faces(channel);
 
-        const char* type = jsobject_string(renderstep, "type");
+    if (!channel->size) {
 
-        if (!strcmp(type, "common")) {
-            
-            common = renderstep;
-            continue;
-            
-        } else if (!strcmp(type, "image")) {
-            
-            image_index = num_renderbuffers;
-            
-        } else if (strcmp(type, "buffer") != 0) {
+        pthread_mutex_lock(&image_mutex);
+        int staged = pbo_uploads && (from_cache || !texcache_enabled());
+        pthread_mutex_unlock(&image_mutex);
 
-            fprintf(stderr, "warning: render step type %s not supported yet!\n", type);
-            continue;
+        channel->channels = channels;
+        channel->width = width;
+        channel->height = height;
 
+        channel->levels = 1;
+        
+        if (channel->want_mipmaps && !staged) {
+            channel->levels = get_mip_levels(width, height);
         }
+        
+        channel->size = get_mip_chain_size(width, height, channels,
+                                           channel->levels);
 
-        // reserve one renderbuffer for downscale
-        if (num_renderbuffers >= MAX_RENDERBUFFERS - 1) {
-            fprintf(stderr, "maximum # render buffers exceeded!\n");
-            exit(1);
+        pthread_mutex_lock(&image_mutex);
+
+        if (staged) {
+            channel->staging = STAGING_REQUESTED;
+            staging_channels[num_staging_channels++] = channel;
+            pthread_cond_signal(&image_ready_cond);
+        } else {
+            buf_grow(&channel->texture, faces * channel->size);
+            channel->texture.size = faces * channel->size;
         }
 
-        renderbuffer_t* rb = renderbuffers + num_renderbuffers;
+        pthread_mutex_unlock(&image_mutex);
+        
+    } else if (channel->channels != channels ||
+               channel->width != width ||
+               channel->height != height) {
 
-        json_t* outputs = jsobject(renderstep, "outputs", JSON_ARRAY);
-        int nout = json_array_size(outputs);
+        fprintf(stderr, "error: cubemap faces for %s have mismatched sizes!\n",
+                req->src);
+        exit(1);
+        
+    }
 
-        rb->name = jsobject_string(renderstep, "name");
-        output_ids[num_renderbuffers] = -1;
+    require(req->face >= 0 && req->face < faces);
 
-        if (nout) {
-            
-            if (nout != 1) {
-                fprintf(stderr, "expected render pass to have 0 or 1 outputs!\n");
-                exit(1);
-            }
+}
 
-            json_t* output = jsarray(outputs, 0, JSON_OBJECT);
-            output_ids[num_renderbuffers] = jsobject_integer(output, "id");
-            
-            if (num_renderbuffers != image_index) {
-                rb->framebuffer_state = FRAMEBUFFER_UNINITIALIZED;
-            }
+//////////////////////////////////////////////////////////////////////
+// called as soon as the raw bytes for an image are available: reads
+// the header, then hands the actual decoding off to the pool
 
-        }
+void start_decode(image_request_t* req) {
 
-        dprintf("renderstep %s has output id %d\n",
-                rb->name, output_ids[num_renderbuffers]);
+    channel_t* channel = req->channel;
 
-        json_t* inputs = jsobject(renderstep, "inputs", JSON_ARRAY);
+    int type = get_image_type(req->src);
+    read_image(&req->raw, type, channel->vflip,
+               max_texture_size, &req->info, NULL);
 
-        load_inputs(rb, inputs, is_local);
+    const image_info_t* info = &req->info;
 
-        int code_is_file = 0;
+    printf("%s is %dx%dx%d", req->src, (int)info->src_width,
+           (int)info->src_height, (int)info->channels);
 
-        const char* code_string = jsobject_first_string(renderstep,
-                                                        code_strings, &code_is_file);
+    if (info->width != info->src_width) {
+        printf(", loading at %dx%d", (int)info->width, (int)info->height);
+    }
 
-        new_shader_source(rb);
+    printf("\n");
 
-        if (code_is_file) {
-            buf_append_file(&rb->shader_buf, code_string,
-                            MAX_PROGRAM_LENGTH, BUF_NULL_TERMINATE);
-        } else {
-            buf_append_mem(&rb->shader_buf, code_string,
-                           strlen(code_string), BUF_NULL_TERMINATE);
-        }
-        
-        rb->fragment_src[FRAG_SRC_MAINIMAGE_SLOT] = rb->shader_buf.data;
+    const int from_cache = 0;
 
-        ++num_renderbuffers;
-        
-    }
+    claim_image_slice(req, from_cache, req->info.channels,
+                      req->info.width, req->info.height);
 
+    tp_submit(decode_pool, decode_image_job, req);
     
-    if (image_index < 0) {
-        fprintf(stderr, "no image render stage in JSON!\n");
-        exit(1);
-    }
+}
 
-    if (common) {
+//////////////////////////////////////////////////////////////////////
+// the texture cache key for an image, which covers everything that
+// affects its decoded pixels
 
-        int code_is_file;
-        const char* code_string = jsobject_first_string(common,
-                                                        code_strings, &code_is_file);
+void get_cache_key(char key[BIG_STRING_LENGTH + 128], const char* src,
+                   int is_local_file, int vflip, int mipmap) {
 
-        if (code_is_file) {
-            buf_append_file(&common_buf, code_string,
-                            MAX_PROGRAM_LENGTH, BUF_NULL_TERMINATE);
-            code_string = common_buf.data;
-        }
+    int l = snprintf(key, BIG_STRING_LENGTH + 128,
+                     "%s|vflip=%d|max=%d|mipmap=%d",
+                     src, vflip, max_texture_size, mipmap);
 
-        for (int j=0; j<num_renderbuffers; ++j) {
-            renderbuffer_t* rb = renderbuffers + j;
-            rb->fragment_src[FRAG_SRC_COMMON_SLOT] = code_string;
+    if (is_local_file) {
+        struct stat sb;
+        if (stat(src, &sb) == 0) {
+            snprintf(key + l, BIG_STRING_LENGTH + 128 - l,
+                     "|size=%lld|mtime=%lld",
+                     (long long)sb.st_size, (long long)sb.st_mtime);
         }
-        
     }
 
-    //////////////////////////////////////////////////
-    // assign renderbuffers to channels
+}
 
-    // for each renderbuffer
-    for (int j=0; j<num_renderbuffers; ++j) {
+//////////////////////////////////////////////////////////////////////
+// like texcache_load, but also rejects entries without the expected
+// number of mip levels
 
-        renderbuffer_t* rb = renderbuffers + j;
+int load_cached(const char* key, int mipmap, texcache_entry_t* cached) {
 
-        // for each channel in this renderbuffer
-        for (int i=0; i<NUM_CHANNELS; ++i) {
-            
-            channel_t* channel = rb->channels + i;
-            
-            if (channel->ctype == CTYPE_BUFFER) {
-                
-                int found = 0;
+    if (!texcache_load(key, cached)) {
+        return 0;
+    }
 
-                dprintf("  looking for id %d to feed channel %d of %s\n",
-                        channel->src_rb_idx,
-                        i, rb->name);
+    int levels = mipmap ? get_mip_levels(cached->width, cached->height) : 1;
 
-                for (int k=0; k<num_renderbuffers; ++k) {
-                    
-                    if (output_ids[k] == channel->src_rb_idx) {
-                        
-                        dprintf("  channel %d of input %s is %s\n",
-                                i, rb->name, renderbuffers[k].name);
-                        channel->src_rb_idx = k;
-                        found = 1;
-                        break;
-                        
-                    }
-                }
+    if (cached->levels != levels) {
+        texcache_free(cached);
+        return 0;
+    }
 
-                if (!found) {
-                    fprintf(stderr, "source not found for %s channel %d with id %d\n",
-                            rb->name, i, channel->src_rb_idx);
-                    exit(1);
-                }
-                
-            }
-        }
+    return 1;
+    
+}
+
+//////////////////////////////////////////////////////////////////////
+// returns 1 if the decoded image (with mip levels, if needed) was
+// found in the texture cache, in which case it is already on its way
+
+int start_cached(image_request_t* req) {
+
+    channel_t* channel = req->channel;
+
+    get_cache_key(req->cache_key, req->src, req->is_local_file,
+                  channel->vflip, channel->want_mipmaps);
+
+    texcache_entry_t* cached = &req->cached;
+    
+    if (!load_cached(req->cache_key, channel->want_mipmaps, cached)) {
+        return 0;
     }
+
+    printf("using cached %dx%dx%d texture for %s\n",
+           (int)cached->width, (int)cached->height,
+           (int)cached->channels, req->src);
+
+    const int from_cache = 1;
+
+    claim_image_slice(req, from_cache,
+                      cached->channels, cached->width, cached->height);
+    require(cached->size >= channel->size);
+
+    tp_submit(decode_pool, copy_cached_job, req);
+
+    return 1;
     
-    //////////////////////////////////////////////////
-    // decide draw order
+}
 
-    int assigned[MAX_RENDERBUFFERS];
-    memset(assigned, 0, sizeof(assigned));
+//////////////////////////////////////////////////////////////////////
 
-    const char* buf_names[MAX_RENDERBUFFERS] = {
-        "Buf A", "Buf B", "Buf C", "Buf D", 0,
-    };
-    int cur_name_idx = 0;
+void image_fetched(int idx, buffer_t* buf, void* userdata) {
 
-    // for each position in draw order
-    for (int k=0; k<num_renderbuffers; ++k) {
+    image_request_t** url_reqs = (image_request_t**)userdata;
+    image_request_t* req = url_reqs[idx];
 
-        const char* cur_name = buf_names[cur_name_idx];
+    req->raw = *buf;
+    memset(buf, 0, sizeof(buffer_t));
 
-        int next = -1;
-        int name_match = 0;
+    start_decode(req);
+    
+}
 
-        // for each renderbuffer
-        for (int j=0; j<num_renderbuffers; ++j) {
-            
-            if (assigned[j]) { continue; }
-            
-            const renderbuffer_t* rb = renderbuffers + j;
-                
-            if (cur_name && !strcasecmp(rb->name, cur_name)) {
-                name_match = 1;
-                next = j;
-                ++cur_name_idx;
-                break; 
-            } else if (j != image_index &&
-                       (next == -1 || output_ids[j] < output_ids[next])) {
-                next = j;
-            }
-            
-        }
+//////////////////////////////////////////////////////////////////////
+// runs on the image_loader thread: reads local images and fetches
+// every remote one at once, starting to decode each as soon as its
+// bytes arrive
+
+void* load_images(void* unused) {
+
+    const char* urls[MAX_IMAGE_REQUESTS];
+    buffer_t url_bufs[MAX_IMAGE_REQUESTS];
+    image_request_t* url_reqs[MAX_IMAGE_REQUESTS];
+    int num_urls = 0;
+
+    for (int i=0; i<num_image_requests; ++i) {
         
-        const char* reason;
-        if (name_match) {
-            reason = "of name match";
-        } else if (next >= 0) {
-            reason = "of priority";
-        } else {
-            reason = "image goes last";
-        }
+        image_request_t* req = image_requests + i;
 
-        if (next < 0) {
-            require(k == num_renderbuffers-1);
-            next = image_index;
+        if (start_cached(req)) {
+            continue;
+        } else if (req->is_local_file) {
+            printf("loading %s\n", req->src);
+            buf_map_file(&req->raw, req->src);
+            start_decode(req);
+        } else {
+            urls[num_urls] = req->src;
+            url_reqs[num_urls] = req;
+            memset(url_bufs + num_urls, 0, sizeof(buffer_t));
+            ++num_urls;
         }
-            
-        dprintf("ordering %s with id %d at position %d because %s\n",
-                renderbuffers[next].name, output_ids[next], k, reason);
-                    
-        draw_order[k] = next;
-        assigned[next] = 1;
         
     }
 
-    dprintf("\n");
-    
+    fetch_urls(num_urls, urls, url_bufs, image_fetched, url_reqs);
+
+    return NULL;
+
 }
 
 //////////////////////////////////////////////////////////////////////
+// kick off loading all queued images in the background
 
-void dieusage() {
-    
-    fprintf(stderr,
-            "usage: st_glfw [OPTIONS] (-id SHADERID | BUNDLE.json | SHADER1.glsl [SHADER2.glsl ...])\n"
-            "\n"
-            "OPTIONS:\n"
-#ifdef ST_GLFW_USE_CURL            
-            "  -id        SHADERID  Load specified shader from Shadertoy.com\n"
-            "  -apikey    KEY       Set Shadertoy.com API key (needed to load shaders)\n"
-#endif            
-            "  -keyboard  CHANNEL   Set up keyboard input channel (raw GLSL only)\n"
-            "  -geometry  WxH       Initialize window with width W and height H\n"
-            "  -scale     FACTOR    Render at scale FACTOR before reducing to window\n"
-            "  -speedup   FACTOR    Speed up by this factor\n"
-            "  -record              Output one PNG file per frame\n" 
-            "  -profile             Uncap framerate and profile frame times\n"
-            "  -frames    COUNT     Record/profile for COUNT frames\n"
-            "  -duration  TIME      Record/profile for TIME seconds\n"
-            "  -fps       FPS       Target FPS for recording\n"
-            "  -starttime TIME      Starting value of iTime uniform in seconds\n"
-            "  -paused              Start out paused\n"
-            "  -D         KEY=VAL   Preprocessor define KEY=VAL\n"
-            "  -d                   Turn on debug output\n"
-            "\n"
-            );
-  
-    exit(1);
-  
-}
+void start_images() {
 
-void add_define(int argc, char** argv, int i) {
+    if (!num_image_requests) { return; }
 
-    if (i >= argc) {
-        fprintf(stderr, "error: must have name for -D argument!\n");
-        dieusage();
+    if (!decode_pool) {
+        decode_pool = tp_create(0);
     }
-    
-    const char* keyval = argv[i];
-    const char* val = "1";
-            
-    int keylen=0;
 
-    char* sep = strchr(keyval, '=');
-    if (sep == NULL) {
-        keylen = strlen(keyval);
-    } else {
-        keylen = sep - keyval;
-        val = sep+1;
+    if (pthread_create(&image_loader, NULL, load_images, NULL)) {
+        fprintf(stderr, "error creating image loader thread!\n");
+        exit(1);
     }
 
-    if (!keylen || !strlen(val)) {
-        fprintf(stderr, "error: -D define must be of form KEY or KEY=VAL!\n");
-        dieusage();
-    }
+    image_loader_running = 1;
+    
+}
 
-    char buf[1024];
-    int l = snprintf(buf, 1024, "#define %.*s %s\n", keylen, keyval, val);
+//////////////////////////////////////////////////////////////////////
 
-    if (l >= 1023) {
-        fprintf(stderr, "error: -D define too long!\n");
-        dieusage();
+void upload_image(channel_t* channel) {
+
+    dprintf("uploading %dx%d texture\n",
+            (int)channel->width, (int)channel->height);
+
+    if (!channel->target) { channel->target = GL_TEXTURE_2D; }
+
+    if (channel->pbo) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, channel->pbo);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        buf_free(&channel->texture);
     }
 
-    printf("%s", buf);
+    glGenTextures(1, &channel->tex_id);
+    debug_glBindTexture(channel->target, channel->tex_id);
 
-    buf_append_mem(&defines_buf, buf, l, BUF_RAW_APPEND);
+    // with an unpack buffer bound this just queues a copy on the GPU
+    update_teximage(channel);
+
+    if (channel->pbo) {
+        channel->upload_fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        cur_shader->inflight_uploads[cur_shader->num_inflight_uploads++] = channel;
+    }
+
+    check_opengl_errors("after uploading image");
     
 }
 
 //////////////////////////////////////////////////////////////////////
+// main thread only (it makes GL calls), from upload_ready_images():
+// create and map an unpack buffer for decoded images to be copied into
 
-double getdouble(int argc, char** argv, int i) {
-    if (i >= argc) {
-        fprintf(stderr, "error: expected number for %s\n", argv[i-1]);
-        dieusage();
-    }
-    char* endptr;
-    double x = strtod(argv[i], &endptr);
-    if (!endptr || *endptr || x <= 0.0) {
-        fprintf(stderr, "error: expected positive number for %s\n", argv[i-1]);
-        dieusage();
+void* map_staging_buffer(channel_t* channel) {
+
+    size_t size = channel_faces(channel) * channel->size;
+
+    glGenBuffers(1, &channel->pbo);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, channel->pbo);
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+
+    // decode_image_job() only ever writes here
+    void* ptr = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size,
+                                 GL_MAP_WRITE_BIT |
+                                 GL_MAP_INVALIDATE_BUFFER_BIT);
+    
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    if (!ptr) {
+        fprintf(stderr, "error mapping pixel unpack buffer!\n");
+        exit(1);
     }
-    return x;
+
+    check_opengl_errors("after mapping unpack buffer");
+
+    return ptr;
+    
 }
 
 //////////////////////////////////////////////////////////////////////
+// from here on, image memory comes from unpack buffers
 
-long getint(int argc, char** argv, int i) {
-    if (i >= argc) {
-        fprintf(stderr, "error: expected number for %s\n", argv[i-1]);
-        dieusage();
-    }
-    char* endptr;
-    long x = strtol(argv[i], &endptr, 10);
-    if (!endptr || *endptr || x < 0) {
-        fprintf(stderr, "error: expected non-negative number for %s\n", argv[i-1]);
-        dieusage();
-    }
-    return x;
+void enable_pbo_uploads() {
+
+    pthread_mutex_lock(&image_mutex);
+    pbo_uploads = 1;
+    pthread_mutex_unlock(&image_mutex);
+    
 }
 
 //////////////////////////////////////////////////////////////////////
-// parse command line options
+// upload every channel whose images have finished decoding; if
+// wait is set, keep going until all of them have been uploaded
 
-void get_options(int argc, char** argv) {
+void upload_ready_images(int wait) {
 
-    double rduration = 0.0;
+    pthread_mutex_lock(&image_mutex);
 
-    int input_start = argc;
-    int force_files = 0;
+    while (1) {
 
-    int key_cidx = -1;
+        while (wait && !num_ready_channels &&
+               !num_staging_channels && num_loading_channels) {
+            pthread_cond_wait(&image_ready_cond, &image_mutex);
+        }
 
-    int any_json = 0;
-    
-    for (int i=1; i<input_start; ++i) {
+        if (num_staging_channels) {
 
-        if (!strcmp(argv[i], "-record")) {
-            
-            recording = 1;
-            
-        } else if (!strcmp(argv[i], "-geometry")) {
-            
-            if (i+1 >= argc) {
-                fprintf(stderr, "error: expected WxH for -geometry\n");
-                dieusage();
-            }
-            
-            int chars;
-            
-            if (sscanf(argv[i+1], "%dx%d%n", window_size+0, window_size+1, &chars) != 2 ||
-                argv[i+1][chars] != '\0') {
-                fprintf(stderr, "error: bad format for -geometry\n");
-                dieusage();
-            }
-            
-            i += 1;
-            
-        } else if (!strcmp(argv[i], "-speedup")) {
-            
-            speedup = getdouble(argc, argv, i+1);
-            i += 1;
+            channel_t* channel = staging_channels[--num_staging_channels];
             
-        } else if (!strcmp(argv[i], "-paused")) {
-            
-            animating = 0;
-            
-        } else if (!strcmp(argv[i], "-starttime")) {
-            
-            starttime = getdouble(argc, argv, i+1);
-            i += 1;
+            pthread_mutex_unlock(&image_mutex);
+            void* ptr = map_staging_buffer(channel);
+            pthread_mutex_lock(&image_mutex);
 
+            buf_borrow(&channel->texture, ptr,
+                       channel_faces(channel) * channel->size);
             
-        } else if (!strcmp(argv[i], "-record")) {
+            channel->staging = STAGING_MAPPED;
+            pthread_cond_broadcast(&staging_cond);
 
-            recording = 1;
+            continue;
             
-        } else if (!strcmp(argv[i], "-profile")) {
+        }
 
-            profiling = 1;
-            
-        } else if (!strcmp(argv[i], "-duration")) {
-            
-            rduration = getdouble(argc, argv, i+1);
-            i += 1;
+        if (!num_ready_channels) { break; }
 
-        } else if (!strcmp(argv[i], "-scale")) {
-            
-            u_scale_factor = getint(argc, argv, i+1);
+        channel_t* channel = ready_channels[--num_ready_channels];
+        --num_loading_channels;
 
-            if (u_scale_factor <= 0) {
-                fprintf(stderr, "scale factor must be a positive integer!\n");
-                exit(1);
-            }
+        pthread_mutex_unlock(&image_mutex);
+        upload_image(channel);
+        pthread_mutex_lock(&image_mutex);
+        
+    }
 
-            is_scaled = 1;
-            
-            i += 1;
-            
-        } else if (!strcmp(argv[i], "-frames")) {
-            
-            stop_at_frame = getint(argc, argv, i+1);
-            i += 1;
-            
-        } else if (!strcmp(argv[i], "-keyboard")) {
+    pthread_mutex_unlock(&image_mutex);
+    
+}
 
-            key_cidx = getint(argc, argv, i+1);
-            
-            if (key_cidx < 0 || key_cidx >= NUM_CHANNELS) {
-                fprintf(stderr, "invalid channel for keyboard (must be 0-3)\n");
-                exit(1);
-            }
+//////////////////////////////////////////////////////////////////////
+// upload any remaining images and shut down the loader
 
-            i += 1;
-            
-        } else if (!strcmp(argv[i], "-fps")) {
-            
-            target_frame_duration = 1.0 / getdouble(argc, argv, i+1);
-            i += 1;
+void finish_images() {
 
-        } else if (!strcmp(argv[i], "-D")) {
+    upload_ready_images(1);
 
-            add_define(argc, argv, i+1);
-            i += 1;
+    if (image_loader_running) {
+        pthread_join(image_loader, NULL);
+        image_loader_running = 0;
+    }
 
-            
+    // with -playlist, the pool stays up for loading the next entry,
+    // see preload_entry()
+    if (decode_pool && !num_playlist_entries) {
+        tp_destroy(decode_pool);
+        decode_pool = NULL;
+    }
 
-#ifdef ST_GLFW_USE_CURL
-            
-        } else if (!strcmp(argv[i], "-id")) {
+    require(!num_loading_channels);
 
-            if (i+1 >= argc) {
-                fprintf(stderr, "error: expected id for %s\n", argv[i]);
-                dieusage();
-            }
-            
-            shadertoy_id = argv[i+1];
-            i += 1;
+    num_image_requests = 0;
+    
+}
 
-        } else if (!strcmp(argv[i], "-apikey")) {
+//////////////////////////////////////////////////////////////////////
+// resident set size in bytes, or 0 where /proc isn't available
 
-            if (i+1 >= argc) {
-                fprintf(stderr, "error: expected key for %s\n", argv[i]);
-                dieusage();
-            }
-            
-            api_key = argv[i+1];
-            i += 1;
-            
-#endif
-        } else if (!strcmp(argv[i], "-d")) {
+size_t get_resident_memory() {
 
-            debug_output = 1;
-            
-        } else if (argv[i][0] == '-' && !force_files) {
+    FILE* fp = fopen("/proc/self/statm", "r");
+    if (!fp) { return 0; }
 
-            fprintf(stderr, "error: unrecognized switch %s\n", argv[i]);
-            dieusage();
-            
-        } else {
-            
-            char* tmp = argv[i];
-            
-            for (int j=i; j<argc-1; ++j) {
-                argv[j] = argv[j+1];
-            }
+    unsigned long total, resident;
+    int ok = (fscanf(fp, "%lu %lu", &total, &resident) == 2);
 
-            const char* extension = get_extension(tmp);
-            if (!strcasecmp(extension, "js") || !strcasecmp(extension, "json")) {
-                any_json = 1;
-            }
+    fclose(fp);
 
-            argv[argc-1] = tmp;
-            input_start -=1;
-            i -= 1;
-            
-        }
+    return ok ? resident * (size_t)sysconf(_SC_PAGESIZE) : 0;
+    
+}
 
+//////////////////////////////////////////////////////////////////////
+// once everything is on the GPU, the decoded pixels are dead weight
 
-    }
+void release_textures() {
 
-    if ((recording || profiling) && rduration) {
-        stop_at_frame = floor(rduration / (target_frame_duration * speedup));
-    }
+    size_t before = get_resident_memory();
 
-    if (recording) {
-        printf("will record for %d frames\n", stop_at_frame);
-    } else if (profiling) {
-        printf("will profile for %d frames\n", stop_at_frame);
-        stop_at_frame += startup_frames;
-    }
+    for (int j=0; j<cur_shader->num_renderbuffers; ++j) {
         
+        renderbuffer_t* rb = cur_shader->renderbuffers + j;
 
-    int is_json_input = 0;
+        for (int i=0; i<NUM_CHANNELS; ++i) {
 
-    if (any_json) {
-        if (input_start == argc-1) {
-            is_json_input = 1;
-        } else {
-            fprintf(stderr, "if JSON input is provided, "
-                    "it must be the only input!\n");
-            exit(1);
+            channel_t* channel = rb->channels + i;
+
+            if (channel->ctype == CTYPE_TEXTURE ||
+                channel->ctype == CTYPE_CUBEMAP) {
+                buf_free(&channel->texture);
+            }
+            
         }
+        
     }
 
-    if ((is_json_input || shadertoy_id) && key_cidx >= 0) {
-        fprintf(stderr, "warning: ignoring -keyboard because reading JSON\n");
+    if (cur_shader->bundle.file.data) {
+        stbundle_release_pages(&cur_shader->bundle);
     }
 
-    if (shadertoy_id) {
+    size_t after = get_resident_memory();
 
-        if (input_start != argc) {
-            fprintf(stderr, "error: can't specify shadertoy ID and other sources!\n");
-            exit(1);
-        }
+    if (before) {
+        printf("resident memory %.1f MB before releasing textures, %.1f MB after\n",
+               before / (1024.0*1024.0), after / (1024.0*1024.0));
+    }
+    
+}
 
-        if (!api_key) {
-            fprintf(stderr, "error: must set shadertoy API key from command line!\n");
-            exit(1);
-        }
-        
-        char url[1024];
-        
-        snprintf(url, 1024,
-                 "http://www.shadertoy.com/api/v1/shaders/%s?key=%s",
-                 shadertoy_id, api_key);
+//////////////////////////////////////////////////////////////////////
+// compile every pass and set up its buffers and textures, uploading
+// images as they finish decoding; returns 0 if a pass didn't compile
+// (only possible when shader errors aren't fatal). This works in any
+// GL context that shares objects with the one that draws.
 
-        fetch_url(url, &json_buf);
+int setup_passes() {
 
-        const int is_local = 0;
-        load_json(is_local);
-        
-    } else if (is_json_input) {
+    for (int i=0; i<cur_shader->num_renderbuffers; ++i) {
+        renderbuffer_t* rb = cur_shader->renderbuffers + i;
+        setup_shaders(rb);
+        if (!rb->program) { return 0; }
+        setup_array(rb);
+        setup_textures(rb);
+        upload_ready_images(0);
+    }
 
-        buf_append_file(&json_buf, argv[argc-1],
-                        MAX_FILE_LENGTH, BUF_RAW_APPEND);
+    if (cur_shader->have_sound_pass) {
+        setup_shaders(&cur_shader->sound_pass);
+        if (!cur_shader->sound_pass.program) { return 0; }
+        setup_array(&cur_shader->sound_pass);
+        setup_textures(&cur_shader->sound_pass);
+    }
 
-        const int is_local = 1;
-        load_json(is_local);
-            
-    } else {
+    return 1;
 
-        num_renderbuffers = 1;
-        renderbuffers[0].name = "Image";
+}
 
-        renderbuffer_t* rb = renderbuffers + 0;
-            
-        if (key_cidx >= 0) { setup_keyboard(rb, key_cidx); }
-            
-        for (int i=input_start; i<argc; ++i) {
-                
-            const char* filename = argv[i];
-                
-            new_shader_source(rb);
-            buf_append_file(&rb->shader_buf, filename,
-                            MAX_PROGRAM_LENGTH, BUF_NULL_TERMINATE);
-            rb->fragment_src[FRAG_SRC_MAINIMAGE_SLOT] = rb->shader_buf.data;
-                
-        }
-            
-    }
+//////////////////////////////////////////////////////////////////////
+// stop every video and free its unpack buffers
 
-    if (is_scaled) {
+void free_videos() {
 
-        require(num_renderbuffers < MAX_RENDERBUFFERS);
+    for (int k=0; k<cur_shader->num_video_channels; ++k) {
 
-        int image_idx = draw_order[num_renderbuffers-1];
-        renderbuffer_t* rb_image = renderbuffers + image_idx;
+        channel_t* channel = cur_shader->video_channels[k];
 
-        rb_image->framebuffer_state = FRAMEBUFFER_UNINITIALIZED;
+        video_close(channel->video);
+        channel->video = NULL;
 
-        dprintf("final renderbuffer is %d with name %s\n",
-                image_idx, rb_image->name);
+        for (int slot=0; slot<VIDEO_SLOTS; ++slot) {
+            if (channel->video_fences[slot]) {
+                glDeleteSync(channel->video_fences[slot]);
+                channel->video_fences[slot] = 0;
+            }
+        }
 
-        renderbuffer_t* rb = renderbuffers + num_renderbuffers;
-        draw_order[num_renderbuffers] = num_renderbuffers;
-        ++num_renderbuffers;
+        glDeleteBuffers(VIDEO_SLOTS, channel->video_pbos);
+        memset(channel->video_pbos, 0, sizeof(channel->video_pbos));
         
-        rb->name = "Scaled output";
+    }
 
-        new_shader_source(rb);
+    cur_shader->num_video_channels = 0;
+    
+}
+
+//////////////////////////////////////////////////////////////////////
+
+void setup_pass_videos(renderbuffer_t* rb) {
+
+    for (int i=0; i<NUM_CHANNELS; ++i) {
         
-        rb->fragment_src[FRAG_SRC_MAINIMAGE_SLOT] = scale_render_mainimage;
+        channel_t* channel = rb->channels + i;
+        
+        if (channel->ctype == CTYPE_VIDEO && !channel->shared) {
+            setup_video(channel);
+        }
+        
+    }
+    
+}
 
-        channel_t* channel = rb->channels + 0;
+//////////////////////////////////////////////////////////////////////
+// vertex arrays and framebuffers can't be shared between GL contexts,
+// so they get set up after setup_passes(), in the context that draws;
+// so do videos, whose unpack buffers stay mapped while they play
 
-        channel->filter = GL_LINEAR_MIPMAP_LINEAR;
-        channel->srgb = 0;
-        channel->vflip = 0;
-        channel->wrap = GL_CLAMP_TO_EDGE;
+void setup_context_objects() {
 
-        channel->ctype = CTYPE_BUFFER;
-        channel->src_rb_idx = image_idx;
+    for (int j=0; j<cur_shader->num_renderbuffers; ++j) {
+        
+        renderbuffer_t* rb = cur_shader->renderbuffers + j;
+        
+        setup_vertex_array(rb);
+        
+        if (rb->framebuffer_state == FRAMEBUFFER_UNINITIALIZED) {
+            setup_framebuffer(rb);
+        }
 
+        setup_pass_videos(rb);
+        
     }
 
-    if (defines_buf.data) {
-        char null_term = '\0';
-        buf_append_mem(&defines_buf, &null_term, 1, BUF_RAW_APPEND);
+    if (cur_shader->have_sound_pass) {
+        setup_vertex_array(&cur_shader->sound_pass);
+        setup_pass_videos(&cur_shader->sound_pass);
     }
-
+    
 }
 
 //////////////////////////////////////////////////////////////////////
+// the reverse, for when the rest of the shader gets unloaded from
+// another context
 
-void error_callback(int error, const char* description) {
-    fprintf(stderr, "GLFW error: %s\n", description);
-}
+void free_context_objects() {
 
-//////////////////////////////////////////////////////////////////////
+    free_videos();
 
-void mouse_button_callback(GLFWwindow* window,
-                           int button, int action, int mods) {
+    for (int j=0; j<cur_shader->num_renderbuffers; ++j) {
+        
+        renderbuffer_t* rb = cur_shader->renderbuffers + j;
 
-    if (button == GLFW_MOUSE_BUTTON_LEFT) {
+        glDeleteVertexArrays(1, &rb->vao);
+        rb->vao = 0;
 
-        if (action == GLFW_PRESS) {
-            
-            u_mouse[0] = cur_mouse[0];
-            u_mouse[1] = cur_mouse[1];
-            
-            u_mouse[2] = cur_mouse[0];
-            u_mouse[3] = cur_mouse[1];
-            
-            mouse_down = 1;
-            
-        } else {
-            
-            u_mouse[2] = -u_mouse[2];
-            u_mouse[3] = -u_mouse[3];
-            
-            mouse_down = 0;
-            
+        if (rb->framebuffer_state != FRAMEBUFFER_NONE) {
+            glDeleteFramebuffers(2, rb->framebuffers);
+            glDeleteTextures(2, rb->draw_tex_ids);
+            memset(rb->framebuffers, 0, sizeof(rb->framebuffers));
+            memset(rb->draw_tex_ids, 0, sizeof(rb->draw_tex_ids));
+            rb->framebuffer_state = FRAMEBUFFER_UNINITIALIZED;
         }
         
-        need_render = 1;
-        
     }
 
-
+    glDeleteVertexArrays(1, &cur_shader->sound_pass.vao);
+    cur_shader->sound_pass.vao = 0;
+    
 }
 
 //////////////////////////////////////////////////////////////////////
 
-void cursor_pos_callback(GLFWwindow* window,
-                         double x, double y) {
+void free_pass(renderbuffer_t* rb) {
 
+    glDeleteProgram(rb->program);
+    glDeleteBuffers(1, &rb->vertex_buffer);
+    glDeleteBuffers(1, &rb->element_buffer);
+    glDeleteVertexArrays(1, &rb->vao);
 
-    cur_mouse[0] = (x) * pixel_scale[0];
-    cur_mouse[1] = (window_size[1] - y) * pixel_scale[1];
+    if (rb->framebuffer_state != FRAMEBUFFER_NONE) {
+        glDeleteFramebuffers(2, rb->framebuffers);
+        glDeleteTextures(2, rb->draw_tex_ids);
+    }
 
-    if (mouse_down) {
-        u_mouse[0] = cur_mouse[0];
-        u_mouse[1] = cur_mouse[1];
-        need_render = 1;
+    for (int i=0; i<NUM_CHANNELS; ++i) {
+
+        channel_t* channel = rb->channels + i;
+
+        if (channel->sampler) { glDeleteSamplers(1, &channel->sampler); }
+        if (channel->tex_id) { glDeleteTextures(1, &channel->tex_id); }
+
+        // only if the shader failed to load before setup_video()
+        if (channel->video) { video_close(channel->video); }
+
+        buf_free(&channel->texture);
+        
     }
+
+    buf_free(&rb->shader_buf);
+    buf_free(&rb->specialized_buf);
+
+    memset(rb, 0, sizeof(renderbuffer_t));
     
 }
 
 //////////////////////////////////////////////////////////////////////
-// thanks, http://keycode.info/
+// an empty shader, ready to load into
 
-int js_from_glfw_key(int key) {
+void init_shader(shader_t* shader) {
 
-    if ((key >= 'A' && key <= 'Z') ||
-        (key >= '0' && key <= '9') ||
-        key == ' ') {
+    memset(shader, 0, sizeof(shader_t));
 
-        return key;
+    shader->renderbuffers = shader->passes;
+    strcpy(shader->window_title, "Shadertoy GLFW");
+    
+}
+
+//////////////////////////////////////////////////////////////////////
+// free everything belonging to the current shader, so that another
+// one can be loaded into the same context
+
+void unload_passes() {
 
+    // lets every pending upload retire and give back its unpack buffer
+    glFinish();
+    retire_uploads();
+    require(!cur_shader->num_inflight_uploads);
+
+    free_videos();
+
+    // a shader that failed to load part way may have queued channels
+    pthread_mutex_lock(&image_mutex);
+    num_ready_channels = 0;
+    num_loading_channels = 0;
+    num_image_requests = 0;
+    pthread_mutex_unlock(&image_mutex);
+
+    for (int j=0; j<cur_shader->num_renderbuffers; ++j) {
+        free_pass(cur_shader->renderbuffers + j);
     }
 
-    switch (key) {
-    case GLFW_KEY_APOSTROPHE: return 222;
-    case GLFW_KEY_COMMA: return 188;
-    case GLFW_KEY_MINUS: return 189;
+    // a shader that failed to load part way may have left a pass half
+    // set up just past the ones counted
+    if (cur_shader->num_renderbuffers < MAX_RENDERBUFFERS) {
+        free_pass(cur_shader->renderbuffers + cur_shader->num_renderbuffers);
+    }
+
+    free_pass(&cur_shader->sound_pass);
+    cur_shader->have_sound_pass = 0;
+
+    cur_shader->num_renderbuffers = 0;
+    cur_shader->num_texture_sources = 0;
+    cur_shader->num_uniforms = 0;
+    cur_shader->keyboard_channel = NULL;
+
+    buf_free(&cur_shader->common_buf);
+    stbundle_close(&cur_shader->bundle);
+
+    check_opengl_errors("after unloading passes");
+    
+}
+
+//////////////////////////////////////////////////////////////////////
+// Shadertoy cubemaps are six images: the one named in the JSON, then
+// _1 through _5 before the extension, with 2 and 3 swapped by vflip
+
+void get_cubemap_face_src(const char* src, int vflip, int face,
+                          char face_src[1024]) {
+
+    const char* dot = strrchr(src, '.');
+    if (!dot) { dot = src + strlen(src); }
+
+    int base_len = dot - src;
+    int ext_len = strlen(dot);
+
+    if (base_len + ext_len + 2 > 1023) {
+        jsfail("error: filename too long!");
+    }
+
+    if (face == 0) {
+        strcpy(face_src, src);
+        return;
+    }
+
+    if (vflip) {
+        if (face == 2) { face = 3; }
+        else if (face == 3) { face = 2; }
+    }
+    
+    memcpy(face_src, src, base_len);
+    snprintf(face_src + base_len, 1024-base_len, "_%d%s", face, dot);
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// look up a string member of object in enums, which end with -1
+
+int jsobject_enum(const json_t* object, const char* key,
+                  const enum_info_t* enums) {
+
+    const char* value = jsobject_string(object, key);
+    int result = lookup_enum(enums, value);
+
+    if (result < 0) {
+        jsfail("error: no matching value for %s", value);
+    }
+
+    return result;
+    
+}
+
+//////////////////////////////////////////////////////////////////////
+// one entry of a pass's "inputs" in the JSON, as read by read_input()
+
+typedef struct shader_input {
+
+    int channel;
+
+    // CTYPE_NONE for input types we don't handle
+    texture_ctype_t ctype;
+    const char* ctype_name;
+
+    int filter;
+    int srgb;
+    int vflip;
+    int wrap;
+
+    // a full URL unless src_is_file is set
+    char src[1024];
+    int src_is_file;
+
+    // the pass a buffer or cubemap buffer input reads from
+    int src_rb_idx;
+
+    // the image for each face of a texture or cubemap
+    int num_images;
+    char image_srcs[6][1024];
+    
+} shader_input_t;
+
+//////////////////////////////////////////////////////////////////////
+// parse input i of inputs; like the rest of the loaders, this reports
+// malformed input with jsfail()
+
+void read_input(json_t* inputs, int i, int is_local, shader_input_t* input) {
+
+    const char* src_strings[3] = { "src", NULL, NULL };
+    
+    if (is_local) {
+        src_strings[1] = "src_file";
+    }
+
+    memset(input, 0, sizeof(shader_input_t));
+
+    json_t* input_i = jsarray(inputs, i, JSON_OBJECT);
+        
+    input->channel = jsobject_integer(input_i, "channel");
+        
+    if (input->channel < 0 || input->channel >= NUM_CHANNELS) {
+        jsfail("invalid channel for input %d", i);
+    }
+
+    json_t* sampler = jsobject(input_i, "sampler", JSON_OBJECT);
+
+    const enum_info_t filter_enums[] = {
+        { "nearest", GL_NEAREST },
+        { "mipmap", GL_LINEAR },
+        { "linear", GL_LINEAR_MIPMAP_LINEAR },
+        { 0, -1 },
+    };
+
+    const enum_info_t tf_enums[] = {
+        { "true", 1 },
+        { "false", 0 },
+        { 0, -1 },
+    };
+
+    const enum_info_t wrap_enums[] = {
+        { "clamp", GL_CLAMP_TO_EDGE },
+        { "repeat", GL_REPEAT },
+        { 0, -1 },
+    };
+        
+    input->filter = jsobject_enum(sampler, "filter", filter_enums);
+    input->srgb = jsobject_enum(sampler, "srgb", tf_enums);
+    input->vflip = jsobject_enum(sampler, "vflip", tf_enums);
+    input->wrap = jsobject_enum(sampler, "wrap", wrap_enums);
+
+    input->src_rb_idx = -1;
+
+    const char* ctype = jsobject_string(input_i, "ctype");
+    input->ctype_name = ctype;
+
+    const char* src = jsobject_first_string(input_i, src_strings,
+                                            &input->src_is_file);
+
+    if (input->src_is_file) {
+        if (strlen(src) >= sizeof(input->src)) {
+            jsfail("error: filename too long!");
+        }
+        strcpy(input->src, src);
+    } else {
+        snprintf(input->src, sizeof(input->src),
+                 "http://www.shadertoy.com%s", src);
+    }
+
+    if (!strcmp(ctype, "keyboard")) {
+
+        input->ctype = CTYPE_KEYBOARD;
+
+    } else if (!strcmp(ctype, "texture")) {
+
+        input->ctype = CTYPE_TEXTURE;
+        input->num_images = 1;
+        strcpy(input->image_srcs[0], input->src);
+
+    } else if (!strcmp(ctype, "cubemap") &&
+               strstr(input->src, "/media/previz/cubemap")) {
+
+        // the output of a cubemap pass, not an image
+        input->ctype = CTYPE_CUBEBUFFER;
+        input->src_rb_idx = jsobject_integer(input_i, "id");
+
+    } else if (!strcmp(ctype, "cubemap")) {
+
+        input->ctype = CTYPE_CUBEMAP;
+        input->num_images = 6;
+
+        for (int face=0; face<6; ++face) {
+            get_cubemap_face_src(input->src, input->vflip, face,
+                                 input->image_srcs[face]);
+        }
+
+    } else if (!strcmp(ctype, "buffer")) {
+
+        input->ctype = CTYPE_BUFFER;
+        input->src_rb_idx = jsobject_integer(input_i, "id");
+
+    } else if (!strcmp(ctype, "video") && input->src_is_file) {
+
+        input->ctype = CTYPE_VIDEO;
+
+    }
+
+}
+
+//////////////////////////////////////////////////////////////////////
+
+void load_inputs(renderbuffer_t* rb, json_t* inputs, int is_local) {
+
+    int ninputs = json_array_size(inputs);
+
+    for (int i=0; i<ninputs; ++i) {
+
+        shader_input_t input;
+        read_input(inputs, i, is_local, &input);
+
+        int cidx = input.channel;
+        channel_t* channel = rb->channels + cidx;
+
+        channel->filter = input.filter;
+        channel->srgb = input.srgb;
+        channel->vflip = input.vflip;
+        channel->wrap = input.wrap;
+
+        channel->want_mipmaps = (channel->filter == GL_LINEAR_MIPMAP_LINEAR);
+
+        channel->src_rb_idx = input.src_rb_idx;
+
+        if (input.ctype == CTYPE_CUBEMAP || input.ctype == CTYPE_CUBEBUFFER) {
+            channel->target = GL_TEXTURE_CUBE_MAP;
+        }
+
+        switch (input.ctype) {
+
+        case CTYPE_KEYBOARD:
+            setup_keyboard(rb, cidx);
+            break;
+
+        case CTYPE_TEXTURE:
+        case CTYPE_CUBEMAP:
+
+            channel->ctype = input.ctype;
+
+            if (!find_shared_texture(channel, input.src)) {
+                for (int face=0; face<input.num_images; ++face) {
+                    queue_image(channel, face, input.image_srcs[face],
+                                input.src_is_file);
+                }
+            }
+            
+            break;
+
+        case CTYPE_BUFFER:
+        case CTYPE_CUBEBUFFER:
+            channel->ctype = input.ctype;
+            break;
+
+        case CTYPE_VIDEO:
+
+            channel->ctype = CTYPE_VIDEO;
+
+            if (!find_shared_texture(channel, input.src)) {
+
+                video_info_t info;
+                
+                channel->video = video_open(input.src, video_fps,
+                                            channel->vflip, max_texture_size,
+                                            VIDEO_SLOTS, &info);
+
+                if (!channel->video) {
+                    jsfail("error: can't open video %s", input.src);
+                }
+
+                channel->channels = info.channels;
+                channel->width = info.width;
+                channel->height = info.height;
+                channel->size = info.frame_size;
+                channel->levels = 1;
+                channel->video_fps = info.fps;
+                channel->video_frames = info.num_frames;
+                
+            }
+
+            break;
+
+        default:
+            
+            fprintf(stderr, "warning: ignoring input type %s\n",
+                    input.ctype_name);
+            
+        }
+        
+    }
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// append the code in filename to buf
+
+void load_code_file(buffer_t* buf, const char* filename) {
+
+    if (!buf_try_append_file(buf, filename,
+                             MAX_PROGRAM_LENGTH, BUF_NULL_TERMINATE)) {
+        jsfail("error: can't read code file %s", filename);
+    }
+    
+}
+
+//////////////////////////////////////////////////////////////////////
+// the sound pass has the same inputs and code as any other pass, but
+// its code defines mainSound() instead of mainImage()
+
+void load_sound_pass(json_t* renderstep, const char** code_strings,
+                     int is_local) {
+
+    renderbuffer_t* rb = &cur_shader->sound_pass;
+
+    if (cur_shader->have_sound_pass) {
+        jsfail("error: expected at most one sound pass!");
+    }
+
+    snprintf(rb->name, MAX_PASS_NAME_LENGTH, "%s",
+             jsobject_string(renderstep, "name"));
+
+    json_t* inputs = jsobject(renderstep, "inputs", JSON_ARRAY);
+
+    load_inputs(rb, inputs, is_local);
+
+    for (int i=0; i<NUM_CHANNELS; ++i) {
+        if (rb->channels[i].ctype == CTYPE_BUFFER) {
+            jsfail("error: sound pass can't read from buffers!");
+        }
+    }
+
+    int code_is_file = 0;
+    
+    const char* code_string = jsobject_first_string(renderstep,
+                                                    code_strings, &code_is_file);
+
+    new_shader_source(rb);
+
+    if (code_is_file) {
+        load_code_file(&rb->shader_buf, code_string);
+    } else {
+        buf_append_mem(&rb->shader_buf, code_string,
+                       strlen(code_string), BUF_NULL_TERMINATE);
+    }
+
+    rb->fragment_src[FRAG_SRC_MAINIMAGE_SLOT] = rb->shader_buf.data;
+    rb->fragment_src[FRAG_SRC_MAIN_SLOT] = sound_main;
+
+    cur_shader->have_sound_pass = 1;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+
+void load_json(int is_local) {
+
+    cur_shader->json_root = jsparse(&cur_shader->json_buf);
+
+    // jansson keeps its own copy of everything
+    buf_free(&cur_shader->json_buf);
+
+    json_t* shader = jsobject(cur_shader->json_root, "Shader", JSON_OBJECT);
+
+    json_t* info = json_object_get(shader, "info");
+    if (info && json_typeof(info) == JSON_OBJECT) {
+        const char* name = jsobject_string(info, "name");
+        const char* author = jsobject_string(info, "username");
+        snprintf(cur_shader->window_title, BIG_STRING_LENGTH, "\"%s\" by %s",
+                 name, author);
+    }
+    
+    json_t* renderpass = jsobject(shader, "renderpass", JSON_ARRAY);
+
+    size_t len = json_array_size(renderpass);
+
+    int image_index = -1;
+    json_t* common = NULL;
+
+    const char* code_strings[3] = { "code", NULL, NULL };
+    
+    if (is_local) {
+        code_strings[1] = "code_file";
+    }
+
+    int output_ids[MAX_RENDERBUFFERS];
+    
+    for (int j=0; j<len; ++j) {
+
+        json_t* renderstep = jsarray(renderpass, j, JSON_OBJECT);
+
+        const char* type = jsobject_string(renderstep, "type");
+
+        if (!strcmp(type, "common")) {
+            
+            common = renderstep;
+            continue;
+            
+        } else if (!strcmp(type, "image")) {
+            
+            image_index = cur_shader->num_renderbuffers;
+            
+        } else if (!strcmp(type, "cubemap")) {
+
+            cur_shader->renderbuffers[cur_shader->num_renderbuffers].is_cubemap = 1;
+            
+        } else if (!strcmp(type, "sound")) {
+
+            if (sound_output) {
+                load_sound_pass(renderstep, code_strings, is_local);
+            } else {
+                fprintf(stderr, "warning: ignoring sound pass, "
+                        "use -sound-out to render it\n");
+            }
+            
+            continue;
+            
+        } else if (strcmp(type, "buffer") != 0) {
+
+            fprintf(stderr, "warning: render step type %s not supported yet!\n", type);
+            continue;
+
+        }
+
+        // reserve one renderbuffer for downscale
+        if (cur_shader->num_renderbuffers >= MAX_RENDERBUFFERS - 1) {
+            jsfail("maximum # render buffers exceeded!");
+        }
+
+        renderbuffer_t* rb = cur_shader->renderbuffers + cur_shader->num_renderbuffers;
+
+        json_t* outputs = jsobject(renderstep, "outputs", JSON_ARRAY);
+        int nout = json_array_size(outputs);
+
+        snprintf(rb->name, MAX_PASS_NAME_LENGTH, "%s",
+                 jsobject_string(renderstep, "name"));
+        output_ids[cur_shader->num_renderbuffers] = -1;
+
+        if (nout) {
+            
+            if (nout != 1) {
+                jsfail("expected render pass to have 0 or 1 outputs!");
+            }
+
+            json_t* output = jsarray(outputs, 0, JSON_OBJECT);
+            output_ids[cur_shader->num_renderbuffers] = jsobject_integer(output, "id");
+            
+            if (cur_shader->num_renderbuffers != image_index) {
+                rb->framebuffer_state = FRAMEBUFFER_UNINITIALIZED;
+            }
+
+        }
+
+        dprintf("renderstep %s has output id %d\n",
+                rb->name, output_ids[cur_shader->num_renderbuffers]);
+
+        json_t* inputs = jsobject(renderstep, "inputs", JSON_ARRAY);
+
+        load_inputs(rb, inputs, is_local);
+
+        int code_is_file = 0;
+
+        const char* code_string = jsobject_first_string(renderstep,
+                                                        code_strings, &code_is_file);
+
+        new_shader_source(rb);
+
+        if (code_is_file) {
+            load_code_file(&rb->shader_buf, code_string);
+            watch_source(code_string, cur_shader->num_renderbuffers);
+        } else {
+            buf_append_mem(&rb->shader_buf, code_string,
+                           strlen(code_string), BUF_NULL_TERMINATE);
+        }
+        
+        rb->fragment_src[FRAG_SRC_MAINIMAGE_SLOT] = rb->shader_buf.data;
+
+        if (rb->is_cubemap) {
+            rb->fragment_src[FRAG_SRC_MAIN_SLOT] = cubemap_main;
+        }
+
+        ++cur_shader->num_renderbuffers;
+        
+    }
+
+    
+    if (image_index < 0) {
+        jsfail("no image render stage in JSON!");
+    }
+
+    if (common) {
+
+        int code_is_file;
+        const char* code_string = jsobject_first_string(common,
+                                                        code_strings, &code_is_file);
+
+        // copied so the JSON can be freed below
+        if (code_is_file) {
+            load_code_file(&cur_shader->common_buf, code_string);
+            watch_source(code_string, SOURCE_COMMON);
+        } else {
+            buf_append_mem(&cur_shader->common_buf, code_string,
+                           strlen(code_string), BUF_NULL_TERMINATE);
+        }
+
+        for (int j=0; j<cur_shader->num_renderbuffers; ++j) {
+            renderbuffer_t* rb = cur_shader->renderbuffers + j;
+            rb->fragment_src[FRAG_SRC_COMMON_SLOT] = cur_shader->common_buf.data;
+        }
+
+        cur_shader->sound_pass.fragment_src[FRAG_SRC_COMMON_SLOT] =
+            cur_shader->common_buf.data;
+        
+    }
+
+    //////////////////////////////////////////////////
+    // assign renderbuffers to channels
+
+    // for each renderbuffer
+    for (int j=0; j<cur_shader->num_renderbuffers; ++j) {
+
+        renderbuffer_t* rb = cur_shader->renderbuffers + j;
+
+        // for each channel in this renderbuffer
+        for (int i=0; i<NUM_CHANNELS; ++i) {
+            
+            channel_t* channel = rb->channels + i;
+            
+            if (channel->ctype == CTYPE_BUFFER ||
+                channel->ctype == CTYPE_CUBEBUFFER) {
+                
+                int found = 0;
+
+                dprintf("  looking for id %d to feed channel %d of %s\n",
+                        channel->src_rb_idx,
+                        i, rb->name);
+
+                for (int k=0; k<cur_shader->num_renderbuffers; ++k) {
+                    
+                    if (output_ids[k] == channel->src_rb_idx) {
+                        
+                        dprintf("  channel %d of input %s is %s\n",
+                                i, rb->name, cur_shader->renderbuffers[k].name);
+
+                        if (cur_shader->renderbuffers[k].is_cubemap !=
+                            (channel->ctype == CTYPE_CUBEBUFFER)) {
+                            jsfail("error: %s channel %d reads %s as the "
+                                   "wrong kind of texture",
+                                   rb->name, i, cur_shader->renderbuffers[k].name);
+                        }
+                        
+                        channel->src_rb_idx = k;
+                        found = 1;
+                        break;
+                        
+                    }
+                }
+
+                if (!found) {
+                    jsfail("source not found for %s channel %d with id %d",
+                           rb->name, i, channel->src_rb_idx);
+                }
+                
+            }
+        }
+    }
+    
+    //////////////////////////////////////////////////
+    // decide draw order
+
+    int assigned[MAX_RENDERBUFFERS];
+    memset(assigned, 0, sizeof(assigned));
+
+    const char* buf_names[MAX_RENDERBUFFERS] = {
+        "Buf A", "Buf B", "Buf C", "Buf D", "Cube A", 0,
+    };
+    int cur_name_idx = 0;
+
+    // for each position in draw order
+    for (int k=0; k<cur_shader->num_renderbuffers; ++k) {
+
+        const char* cur_name = buf_names[cur_name_idx];
+
+        int next = -1;
+        int name_match = 0;
+
+        // for each renderbuffer
+        for (int j=0; j<cur_shader->num_renderbuffers; ++j) {
+            
+            if (assigned[j]) { continue; }
+            
+            const renderbuffer_t* rb = cur_shader->renderbuffers + j;
+                
+            if (cur_name && !strcasecmp(rb->name, cur_name)) {
+                name_match = 1;
+                next = j;
+                ++cur_name_idx;
+                break; 
+            } else if (j != image_index &&
+                       (next == -1 || output_ids[j] < output_ids[next])) {
+                next = j;
+            }
+            
+        }
+        
+        const char* reason;
+        if (name_match) {
+            reason = "of name match";
+        } else if (next >= 0) {
+            reason = "of priority";
+        } else {
+            reason = "image goes last";
+        }
+
+        if (next < 0) {
+            require(k == cur_shader->num_renderbuffers-1);
+            next = image_index;
+        }
+            
+        dprintf("ordering %s with id %d at position %d because %s\n",
+                cur_shader->renderbuffers[next].name, output_ids[next], k, reason);
+                    
+        cur_shader->draw_order[k] = next;
+        assigned[next] = 1;
+        
+    }
+
+    dprintf("\n");
+
+    // everything needed was copied out above
+    json_decref(cur_shader->json_root);
+    cur_shader->json_root = NULL;
+    
+}
+
+//////////////////////////////////////////////////////////////////////
+// source slots worth saving in a bundle; the channel declarations get
+// regenerated by setup_shaders()
+
+const int bundle_source_slots[] = {
+    FRAG_SRC_VERSION_SLOT,
+    FRAG_SRC_DEFINES_SLOT,
+    FRAG_SRC_COMMON_SLOT,
+    FRAG_SRC_UNIFORMS_SLOT,
+    FRAG_SRC_MAINIMAGE_SLOT,
+    FRAG_SRC_MAIN_SLOT,
+    -1
+};
+
+//////////////////////////////////////////////////////////////////////
+// write everything loaded so far (minus any -scale pass) to a bundle
+
+void write_bundle(const char* filename) {
+
+    int num_passes = cur_shader->num_renderbuffers - (is_scaled ? 1 : 0);
+    int image_idx = cur_shader->draw_order[num_passes-1];
+
+    require(num_passes <= STBUNDLE_MAX_PASSES);
+
+    stbundle_writer_t w;
+    memset(&w, 0, sizeof(w));
+
+    stbundle_info_t info;
+    memset(&info, 0, sizeof(info));
+
+    snprintf(info.title, STBUNDLE_TITLE_LENGTH, "%s", cur_shader->window_title);
+    info.num_passes = num_passes;
+
+    for (int k=0; k<num_passes; ++k) {
+        info.draw_order[k] = cur_shader->draw_order[k];
+    }
+
+    stbundle_add(&w, STBUNDLE_SECTION_INFO, 0, 0, 0, &info, sizeof(info));
+
+    stbundle_pass_t passes[MAX_RENDERBUFFERS];
+    void* binaries[MAX_RENDERBUFFERS];
+
+    memset(passes, 0, sizeof(passes));
+    memset(binaries, 0, sizeof(binaries));
+
+    int use_binaries = program_binaries_supported();
+    
+    for (int j=0; j<num_passes; ++j) {
+
+        const renderbuffer_t* rb = cur_shader->renderbuffers + j;
+        stbundle_pass_t* pass = passes + j;
+
+        snprintf(pass->name, STBUNDLE_NAME_LENGTH, "%s", rb->name);
+
+        pass->has_framebuffer = (j != image_idx &&
+                                 rb->framebuffer_state != FRAMEBUFFER_NONE);
+        pass->is_cubemap = rb->is_cubemap;
+        pass->resolution_scale = rb->resolution_scale;
+
+        for (int i=0; i<NUM_CHANNELS; ++i) {
+
+            const channel_t* channel = rb->channels + i;
+            stbundle_channel_t* dst = pass->channels + i;
+
+            dst->ctype = channel->ctype;
+            dst->target = channel->target;
+            dst->src_pass = channel->src_rb_idx;
+            dst->filter = channel->filter;
+            dst->srgb = channel->srgb;
+            dst->vflip = channel->vflip;
+            dst->wrap = channel->wrap;
+            dst->channels = channel->channels;
+            dst->width = channel->width;
+            dst->height = channel->height;
+            dst->levels = channel->levels;
+            dst->size = channel->size;
+
+            dst->shared_pass = -1;
+            dst->shared_channel = -1;
+
+            if (channel->ctype == CTYPE_VIDEO) {
+                fprintf(stderr, "error: can't pack video inputs into a bundle!\n");
+                exit(1);
+            }
+
+            if (channel->shared && channel->ctype != CTYPE_KEYBOARD) {
+
+                for (int k=0; k<num_passes; ++k) {
+                    const renderbuffer_t* rb_k = cur_shader->renderbuffers + k;
+                    for (int c=0; c<NUM_CHANNELS; ++c) {
+                        if (channel->shared == rb_k->channels + c) {
+                            dst->shared_pass = k;
+                            dst->shared_channel = c;
+                        }
+                    }
+                }
+
+                require(dst->shared_pass >= 0);
+
+            } else if (channel->ctype == CTYPE_TEXTURE ||
+                       channel->ctype == CTYPE_CUBEMAP) {
+                
+                stbundle_add(&w, STBUNDLE_SECTION_TEXTURE, j, i, 0,
+                             channel->texture.data, channel->texture.size);
+                
+            }
+
+        }
+
+        stbundle_add(&w, STBUNDLE_SECTION_PASS, j, 0, 0, pass, sizeof(*pass));
+
+        for (int k=0; bundle_source_slots[k] >= 0; ++k) {
+            int slot = bundle_source_slots[k];
+            const char* src = rb->fragment_src[slot];
+            stbundle_add(&w, STBUNDLE_SECTION_SOURCE, j, slot, 0,
+                         src, strlen(src)+1);
+        }
+
+        GLint length = 0;
+
+        if (use_binaries) {
+            glGetProgramiv(rb->program, GL_PROGRAM_BINARY_LENGTH, &length);
+        }
+
+        if (length > 0) {
+
+            GLenum format;
+
+            binaries[j] = malloc(length);
+            
+            if (!binaries[j]) {
+                fprintf(stderr, "out of memory getting program binary!\n");
+                exit(1);
+            }
+
+            glGetProgramBinary(rb->program, length, NULL, &format, binaries[j]);
+            check_opengl_errors("after getting program binary");
+
+            stbundle_add(&w, STBUNDLE_SECTION_PROGRAM, j, 0, format,
+                         binaries[j], length);
+            
+        }
+        
+    }
+
+    if (!stbundle_write(&w, filename)) {
+        exit(1);
+    }
+
+    printf("wrote %s with %d passes%s\n", filename, num_passes,
+           use_binaries ? " and program binaries" : "");
+
+    for (int j=0; j<num_passes; ++j) {
+        free(binaries[j]);
+    }
+
+    stbundle_writer_free(&w);
+    
+}
+
+//////////////////////////////////////////////////////////////////////
+// set up passes and channels from the sections of bundle, which is
+// already open; filename is just for error messages. Reports a
+// malformed bundle with jsfail(), like the JSON loaders.
+
+void load_opened_bundle(const char* filename) {
+
+    const stbundle_section_t* section;
+
+    section = stbundle_find(&cur_shader->bundle, STBUNDLE_SECTION_INFO, 0, 0);
+
+    if (!section || section->size != sizeof(stbundle_info_t)) {
+        jsfail("error: bundle %s has no info section!", filename);
+    }
+
+    const stbundle_info_t* info = stbundle_data(&cur_shader->bundle, section);
+
+    // reserve one renderbuffer for downscale
+    if (info->num_passes < 1 || info->num_passes > MAX_RENDERBUFFERS - 1) {
+        jsfail("error: bad # of passes in bundle %s!", filename);
+    }
+
+    snprintf(cur_shader->window_title, BIG_STRING_LENGTH, "%.*s",
+             STBUNDLE_TITLE_LENGTH-1, info->title);
+
+    cur_shader->num_renderbuffers = info->num_passes;
+
+    for (int k=0; k<cur_shader->num_renderbuffers; ++k) {
+        cur_shader->draw_order[k] = info->draw_order[k];
+        if (cur_shader->draw_order[k] < 0 ||
+            cur_shader->draw_order[k] >= cur_shader->num_renderbuffers) {
+            jsfail("error: bad draw order in bundle %s!", filename);
+        }
+    }
+
+    for (int j=0; j<cur_shader->num_renderbuffers; ++j) {
+
+        renderbuffer_t* rb = cur_shader->renderbuffers + j;
+
+        section = stbundle_find(&cur_shader->bundle, STBUNDLE_SECTION_PASS, j, 0);
+
+        if (!section || section->size != sizeof(stbundle_pass_t)) {
+            jsfail("error: bundle %s is missing pass %d!", filename, j);
+        }
+
+        const stbundle_pass_t* pass = stbundle_data(&cur_shader->bundle, section);
+
+        if (!memchr(pass->name, 0, STBUNDLE_NAME_LENGTH)) {
+            jsfail("error: bad name for pass %d in bundle %s!", j, filename);
+        }
+        snprintf(rb->name, MAX_PASS_NAME_LENGTH, "%s", pass->name);
+
+        if (pass->has_framebuffer) {
+            rb->framebuffer_state = FRAMEBUFFER_UNINITIALIZED;
+        }
+
+        rb->is_cubemap = pass->is_cubemap;
+        rb->resolution_scale = pass->resolution_scale;
+
+        for (int k=0; bundle_source_slots[k] >= 0; ++k) {
+
+            int slot = bundle_source_slots[k];
+            
+            section = stbundle_find(&cur_shader->bundle,
+                                    STBUNDLE_SECTION_SOURCE, j, slot);
+            if (!section) { continue; }
+
+            const char* src = stbundle_data(&cur_shader->bundle, section);
+            if (!section->size || src[section->size-1]) {
+                jsfail("error: bad source for %s in bundle %s!",
+                       rb->name, filename);
+            }
+            
+            rb->fragment_src[slot] = src;
+            
+        }
+
+        for (int i=0; i<NUM_CHANNELS; ++i) {
+
+            channel_t* channel = rb->channels + i;
+            const stbundle_channel_t* src = pass->channels + i;
+
+            channel->ctype = src->ctype;
+            channel->target = src->target;
+            channel->src_rb_idx = src->src_pass;
+            channel->filter = src->filter;
+            channel->srgb = src->srgb;
+            channel->vflip = src->vflip;
+            channel->wrap = src->wrap;
+            channel->channels = src->channels;
+            channel->width = src->width;
+            channel->height = src->height;
+            channel->levels = src->levels;
+            channel->size = src->size;
+
+            switch (channel->ctype) {
+                
+            case CTYPE_NONE:
+                break;
+                
+            case CTYPE_KEYBOARD:
+                setup_keyboard(rb, i);
+                break;
+                
+            case CTYPE_BUFFER:
+            case CTYPE_CUBEBUFFER:
+                if (channel->src_rb_idx < 0 ||
+                    channel->src_rb_idx >= cur_shader->num_renderbuffers) {
+                    jsfail("error: bad buffer for channel %d of %s "
+                           "in bundle %s!", i, rb->name, filename);
+                }
+                break;
+                
+            case CTYPE_TEXTURE:
+            case CTYPE_CUBEMAP: {
+
+                if (src->shared_pass >= 0) {
+                    if (src->shared_pass >= cur_shader->num_renderbuffers ||
+                        src->shared_channel < 0 ||
+                        src->shared_channel >= NUM_CHANNELS) {
+                        jsfail("error: bad shared texture for channel %d "
+                               "of %s in bundle %s!", i, rb->name, filename);
+                    }
+                    renderbuffer_t* owner = (cur_shader->renderbuffers +
+                                             src->shared_pass);
+                    channel->shared = owner->channels + src->shared_channel;
+                    break;
+                }
+
+                int faces = (channel->ctype == CTYPE_CUBEMAP) ? 6 : 1;
+                
+                section = stbundle_find(&cur_shader->bundle,
+                                        STBUNDLE_SECTION_TEXTURE, j, i);
+
+                if (!section || section->size != faces * channel->size ||
+                    channel->channels < 1 || channel->channels > 4 ||
+                    channel->levels < 1 ||
+                    channel->levels > get_mip_levels(channel->width,
+                                                     channel->height) ||
+                    channel->size < get_mip_chain_size(channel->width, channel->height,
+                                                       channel->channels,
+                                                       channel->levels)) {
+                    jsfail("error: bad texture for channel %d of %s "
+                           "in bundle %s!", i, rb->name, filename);
+                }
+
+                // uploaded straight out of the mapping
+                buf_borrow(&channel->texture,
+                           stbundle_data(&cur_shader->bundle, section), section->size);
+
+                channel_ready(channel);
+                break;
+                
+            }
+                
+            default:
+                jsfail("error: bad channel type in bundle %s!", filename);
+                
+            }
+            
+        }
+
+        section = stbundle_find(&cur_shader->bundle, STBUNDLE_SECTION_PROGRAM, j, 0);
+
+        if (section) {
+            rb->program_binary = stbundle_data(&cur_shader->bundle, section);
+            rb->program_binary_length = section->size;
+            rb->program_binary_format = section->param;
+        }
+        
+    }
+
+}
+
+//////////////////////////////////////////////////////////////////////
+
+void load_bundle(const char* filename) {
+
+    if (!stbundle_try_open(&cur_shader->bundle, filename)) {
+        jsfail("error: can't open bundle %s", filename);
+    }
+
+    load_opened_bundle(filename);
+    
+}
+
+//////////////////////////////////////////////////////////////////////
+
+int is_json_file(const char* filename) {
+
+    const char* extension = get_extension(filename);
+    
+    return (!strcasecmp(extension, "js") ||
+            !strcasecmp(extension, "json"));
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// load a local JSON file or bundle, going by its extension
+
+void load_shader_file(const char* filename) {
+
+    if (is_json_file(filename)) {
+        
+        if (!buf_try_map_file(&cur_shader->json_buf, filename)) {
+            jsfail("error: can't read %s", filename);
+        }
+        
+        const int is_local = 1;
+        load_json(is_local);
+        
+    } else {
+        
+        load_bundle(filename);
+        
+    }
+    
+}
+
+//////////////////////////////////////////////////////////////////////
+// run one of the loaders above, which report malformed input with
+// jsfail(); returns 0 if that happened, with the reason in
+// jsfail_message and whatever got set up left for unload_passes()
+
+int try_load(void (*loader)(const char*), const char* filename) {
+
+    jmp_buf* prev_jmp = jsfail_jmp;
+    jmp_buf env;
+
+    if (setjmp(env)) {
+        
+        jsfail_jmp = prev_jmp;
+        
+        buf_free(&cur_shader->json_buf);
+        
+        if (cur_shader->json_root) {
+            json_decref(cur_shader->json_root);
+            cur_shader->json_root = NULL;
+        }
+        
+        return 0;
+        
+    }
+
+    jsfail_jmp = &env;
+    loader(filename);
+    jsfail_jmp = prev_jmp;
+
+    return 1;
+    
+}
+
+//////////////////////////////////////////////////////////////////////
+// read a -playlist file: one "SECONDS FILE" line per entry, where
+// FILE is a local .json or .stbundle; blank lines and lines starting
+// with # are skipped
+
+void read_playlist(const char* filename) {
+
+    FILE* fp = fopen(filename, "r");
+
+    if (!fp) {
+        fprintf(stderr, "error: can't read playlist %s\n", filename);
+        exit(1);
+    }
+
+    char line[BIG_STRING_LENGTH + 64];
+    int line_number = 0;
+
+    while (fgets(line, sizeof(line), fp)) {
+
+        ++line_number;
+
+        char* start = line;
+        while (isspace(*start)) { ++start; }
+
+        if (!*start || *start == '#') { continue; }
+
+        char* end = start + strlen(start);
+        while (end > start && isspace(end[-1])) { *--end = '\0'; }
+
+        if (num_playlist_entries >= MAX_PLAYLIST_ENTRIES) {
+            fprintf(stderr, "error: too many entries in playlist %s\n", filename);
+            exit(1);
+        }
+
+        playlist_entry_t* entry = playlist + num_playlist_entries;
+        int length;
+
+        if (sscanf(start, "%lf %n", &entry->duration, &length) != 1 ||
+            entry->duration <= 0 || !start[length] ||
+            strlen(start + length) >= BIG_STRING_LENGTH) {
+            fprintf(stderr, "error: expected SECONDS FILE on line %d of "
+                    "playlist %s\n", line_number, filename);
+            exit(1);
+        }
+
+        strcpy(entry->path, start + length);
+
+        if (!is_json_file(entry->path) &&
+            strcasecmp(get_extension(entry->path), "stbundle")) {
+            fprintf(stderr, "error: playlist entry %s is not .json or .stbundle\n",
+                    entry->path);
+            exit(1);
+        }
+
+        ++num_playlist_entries;
+        
+    }
+
+    fclose(fp);
+
+    if (!num_playlist_entries) {
+        fprintf(stderr, "error: playlist %s is empty\n", filename);
+        exit(1);
+    }
+    
+}
+
+//////////////////////////////////////////////////////////////////////
+
+void dieusage() {
+    
+    fprintf(stderr,
+            "usage: st_glfw [OPTIONS] (-id SHADERID | BUNDLE.json | BUNDLE.stbundle |\n"
+            "                         SHADER1.glsl [SHADER2.glsl ...])\n"
+            "\n"
+            "OPTIONS:\n"
+#ifdef ST_GLFW_USE_CURL            
+            "  -id        SHADERID  Load specified shader from Shadertoy.com\n"
+            "  -apikey    KEY       Set Shadertoy.com API key (needed to load shaders)\n"
+#endif            
+            "  -keyboard  CHANNEL   Set up keyboard input channel (raw GLSL only)\n"
+            "  -geometry  WxH       Initialize window with width W and height H\n"
+            "  -scale     FACTOR    Render at scale FACTOR before reducing to window\n"
+            "  -checkerboard        Shade half the image pixels each frame\n"
+            "  -mosaic              Draw each GLSL input in its own tile, with\n"
+            "                       -geometry giving the tile size\n"
+            "  -pass-scale NAME=F   Render buffer pass NAME at F times full size\n"
+            "  -pass-interval NAME=N[:P]\n"
+            "                       Draw buffer pass NAME every Nth frame, at phase P\n"
+            "  -speedup   FACTOR    Speed up by this factor\n"
+            "  -record              Output one PNG file per frame\n" 
+            "  -profile             Uncap framerate and profile frame times\n"
+            "  -specialize          Compile fixed uniforms in as constants when\n"
+            "                       recording or profiling\n"
+            "  -frames    COUNT     Record/profile for COUNT frames\n"
+            "  -duration  TIME      Record/profile for TIME seconds\n"
+            "  -fps       FPS       Target FPS for recording\n"
+            "  -sound-out FILE      Render the sound pass to a .wav file\n"
+            "  -max-texture-size N  Downscale textures larger than N pixels\n"
+            "  -video-fps FPS       Frame rate of image sequence video inputs\n"
+            "  -cache     DIR       Cache decoded textures in DIR\n"
+            "  -cache-size MB       Limit the texture cache to MB megabytes,\n"
+            "                       0 for no limit (default 1024)\n"
+            "  -nocache             Don't cache decoded textures\n"
+            "  -nowatch             Don't reload shader files when they change\n"
+            "  -pack      FILE      Write a .stbundle for fast startup and exit\n"
+            "  -serve     SOCKET    Render on request for clients of a Unix socket\n"
+            "  -playlist  FILE      Cycle through the shaders listed in FILE, one\n"
+            "                       \"SECONDS SHADER.json|SHADER.stbundle\" per line\n"
+            "  -starttime TIME      Starting value of iTime uniform in seconds\n"
+            "  -paused              Start out paused\n"
+            "  -D         KEY=VAL   Preprocessor define KEY=VAL\n"
+            "  -sweep     KEY=V1,V2,...\n"
+            "                       Profile every combination of these defines\n"
+            "  -sweep-max-error E   Only pick variants within RMS error E of the first\n"
+            "  -d                   Turn on debug output\n"
+            "\n"
+            );
+  
+    exit(1);
+  
+}
+
+void add_define(int argc, char** argv, int i) {
+
+    if (i >= argc) {
+        fprintf(stderr, "error: must have name for -D argument!\n");
+        dieusage();
+    }
+    
+    const char* keyval = argv[i];
+    const char* val = "1";
+            
+    int keylen=0;
+
+    char* sep = strchr(keyval, '=');
+    if (sep == NULL) {
+        keylen = strlen(keyval);
+    } else {
+        keylen = sep - keyval;
+        val = sep+1;
+    }
+
+    if (!keylen || !strlen(val)) {
+        fprintf(stderr, "error: -D define must be of form KEY or KEY=VAL!\n");
+        dieusage();
+    }
+
+    char buf[1024];
+    int l = snprintf(buf, 1024, "#define %.*s %s\n", keylen, keyval, val);
+
+    if (l >= 1023) {
+        fprintf(stderr, "error: -D define too long!\n");
+        dieusage();
+    }
+
+    printf("%s", buf);
+
+    buf_append_mem(&defines_buf, buf, l, BUF_RAW_APPEND);
+    
+}
+
+//////////////////////////////////////////////////////////////////////
+
+double getdouble(int argc, char** argv, int i) {
+    if (i >= argc) {
+        fprintf(stderr, "error: expected number for %s\n", argv[i-1]);
+        dieusage();
+    }
+    char* endptr;
+    double x = strtod(argv[i], &endptr);
+    if (!endptr || *endptr || x <= 0.0) {
+        fprintf(stderr, "error: expected positive number for %s\n", argv[i-1]);
+        dieusage();
+    }
+    return x;
+}
+
+//////////////////////////////////////////////////////////////////////
+
+long getint(int argc, char** argv, int i) {
+    if (i >= argc) {
+        fprintf(stderr, "error: expected number for %s\n", argv[i-1]);
+        dieusage();
+    }
+    char* endptr;
+    long x = strtol(argv[i], &endptr, 10);
+    if (!endptr || *endptr || x < 0) {
+        fprintf(stderr, "error: expected non-negative number for %s\n", argv[i-1]);
+        dieusage();
+    }
+    return x;
+}
+
+//////////////////////////////////////////////////////////////////////
+
+void setup_texture_cache() {
+
+    char dir[BIG_STRING_LENGTH];
+    
+    const char* xdg_cache = getenv("XDG_CACHE_HOME");
+    const char* home = getenv("HOME");
+
+    if (cache_dir) {
+        snprintf(dir, BIG_STRING_LENGTH, "%s", cache_dir);
+    } else if (xdg_cache && *xdg_cache) {
+        snprintf(dir, BIG_STRING_LENGTH, "%s/st_glfw", xdg_cache);
+    } else if (home && *home) {
+        snprintf(dir, BIG_STRING_LENGTH, "%s/.cache/st_glfw", home);
+    } else {
+        return;
+    }
+
+    texcache_init(dir, (size_t)cache_size_mb << 20);
+    
+}
+
+//////////////////////////////////////////////////////////////////////
+// split a NAME=VALUE pass option in place (argv is ours to modify)
+// and return VALUE; exits if there's no NAME or VALUE
+
+char* split_pass_option(int argc, char** argv, int i) {
+
+    if (i >= argc) {
+        fprintf(stderr, "error: expected NAME=VALUE for %s\n", argv[i-1]);
+        dieusage();
+    }
+
+    char* equals = strrchr(argv[i], '=');
+
+    if (!equals || equals == argv[i] || !*(equals+1)) {
+        fprintf(stderr, "error: bad format for %s, expected NAME=VALUE\n",
+                argv[i-1]);
+        dieusage();
+    }
+
+    if (num_pass_options >= MAX_PASS_OPTIONS) {
+        fprintf(stderr, "error: too many per-pass options\n");
+        exit(1);
+    }
+
+    *equals = '\0';
+
+    return equals+1;
+    
+}
+
+//////////////////////////////////////////////////////////////////////
+
+void add_pass_scale(int argc, char** argv, int i) {
+
+    const char* value = split_pass_option(argc, argv, i);
+    
+    char* endptr = NULL;
+    float factor = strtof(value, &endptr);
+
+    if (*endptr || !(factor > 0 && factor <= 1)) {
+        fprintf(stderr, "error: pass scale must be between 0 and 1\n");
+        dieusage();
+    }
+
+    pass_option_t* opt = pass_options + num_pass_options++;
+    
+    opt->name = argv[i];
+    opt->scale = factor;
+    
+}
+
+//////////////////////////////////////////////////////////////////////
+
+void add_pass_interval(int argc, char** argv, int i) {
+
+    const char* value = split_pass_option(argc, argv, i);
+
+    int interval = 0, phase = 0, chars = 0;
+
+    // the phase is optional
+    sscanf(value, "%d%n:%d%n", &interval, &chars, &phase, &chars);
+
+    if (!chars || value[chars] || interval < 1 ||
+        phase < 0 || phase >= interval) {
+        fprintf(stderr, "error: bad format for -pass-interval, expected "
+                "NAME=N or NAME=N:PHASE with 0 <= PHASE < N\n");
+        dieusage();
+    }
+
+    pass_option_t* opt = pass_options + num_pass_options++;
+    
+    opt->name = argv[i];
+    opt->interval = interval;
+    opt->phase = phase;
+    
+}
+
+//////////////////////////////////////////////////////////////////////
+// only buffers can be scaled or skipped, the image pass is always
+// drawn at full size
+
+void apply_pass_options() {
+
+    int image_idx = cur_shader->draw_order[cur_shader->num_renderbuffers-1];
+
+    for (int k=0; k<num_pass_options; ++k) {
+
+        const pass_option_t* opt = pass_options + k;
+        int found = 0;
+
+        for (int j=0; j<cur_shader->num_renderbuffers; ++j) {
+
+            renderbuffer_t* rb = cur_shader->renderbuffers + j;
+
+            if (strcasecmp(rb->name, opt->name)) { continue; }
+
+            if (j == image_idx || rb->framebuffer_state == FRAMEBUFFER_NONE ||
+                (opt->scale && rb->is_cubemap)) {
+                fprintf(stderr, "error: can't apply that option to %s, "
+                        "only to buffer passes\n", rb->name);
+                exit(1);
+            }
+
+            if (opt->scale) {
+                rb->resolution_scale = opt->scale;
+            }
+
+            if (opt->interval) {
+                rb->update_interval = opt->interval;
+                rb->update_phase = opt->phase;
+            }
+            
+            found = 1;
+            
+        }
+
+        if (!found) {
+            fprintf(stderr, "error: no pass named %s\n", opt->name);
+            exit(1);
+        }
+        
+    }
+    
+}
+
+//////////////////////////////////////////////////////////////////////
+// once a shader's own passes are loaded, apply the pass options and
+// add the passes that produce the final output
+
+void add_output_passes() {
+
+    apply_pass_options();
+
+    if (checkerboard) {
+
+        if (bundle_output) {
+            fprintf(stderr, "error: -checkerboard is for playback, "
+                    "leave it off when packing\n");
+            exit(1);
+        }
+
+        require(cur_shader->num_renderbuffers < MAX_RENDERBUFFERS);
+
+        int image_idx = cur_shader->draw_order[cur_shader->num_renderbuffers-1];
+        renderbuffer_t* rb_image = cur_shader->renderbuffers + image_idx;
+
+        rb_image->framebuffer_state = FRAMEBUFFER_UNINITIALIZED;
+        rb_image->checkerboard = 1;
+        rb_image->fragment_src[FRAG_SRC_MAIN_SLOT] = checkerboard_main;
+
+        renderbuffer_t* rb = cur_shader->renderbuffers + cur_shader->num_renderbuffers;
+        cur_shader->draw_order[cur_shader->num_renderbuffers] =
+            cur_shader->num_renderbuffers;
+        ++cur_shader->num_renderbuffers;
+
+        snprintf(rb->name, MAX_PASS_NAME_LENGTH, "Checkerboard resolve");
+
+        new_shader_source(rb);
+
+        rb->fragment_src[FRAG_SRC_MAINIMAGE_SLOT] = checkerboard_resolve_mainimage;
+
+        // this frame's half, then last frame's
+        for (int i=0; i<2; ++i) {
+            
+            channel_t* channel = rb->channels + i;
+
+            channel->filter = GL_NEAREST;
+            channel->srgb = 0;
+            channel->vflip = 0;
+            channel->wrap = GL_CLAMP_TO_EDGE;
+
+            channel->ctype = CTYPE_BUFFER;
+            channel->src_rb_idx = image_idx;
+            channel->previous_frame = i;
+            
+        }
+
+    }
+
+    if (is_scaled) {
+
+        require(cur_shader->num_renderbuffers < MAX_RENDERBUFFERS);
+
+        int image_idx = cur_shader->draw_order[cur_shader->num_renderbuffers-1];
+        renderbuffer_t* rb_image = cur_shader->renderbuffers + image_idx;
+
+        rb_image->framebuffer_state = FRAMEBUFFER_UNINITIALIZED;
+
+        dprintf("final renderbuffer is %d with name %s\n",
+                image_idx, rb_image->name);
+
+        renderbuffer_t* rb = cur_shader->renderbuffers + cur_shader->num_renderbuffers;
+        cur_shader->draw_order[cur_shader->num_renderbuffers] =
+            cur_shader->num_renderbuffers;
+        ++cur_shader->num_renderbuffers;
+        
+        snprintf(rb->name, MAX_PASS_NAME_LENGTH, "Scaled output");
+
+        new_shader_source(rb);
+        
+        rb->fragment_src[FRAG_SRC_MAINIMAGE_SLOT] = scale_render_mainimage;
+
+        channel_t* channel = rb->channels + 0;
+
+        channel->filter = GL_LINEAR_MIPMAP_LINEAR;
+        channel->srgb = 0;
+        channel->vflip = 0;
+        channel->wrap = GL_CLAMP_TO_EDGE;
+
+        channel->ctype = CTYPE_BUFFER;
+        channel->src_rb_idx = image_idx;
+
+    }
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// parse command line options
+
+void get_options(int argc, char** argv) {
+
+    double rduration = 0.0;
+
+    int input_start = argc;
+    int force_files = 0;
+
+    int key_cidx = -1;
+
+    int any_json = 0;
+    int any_bundle = 0;
+    
+    for (int i=1; i<input_start; ++i) {
+
+        if (!strcmp(argv[i], "-record")) {
+            
+            recording = 1;
+            
+        } else if (!strcmp(argv[i], "-geometry")) {
+            
+            if (i+1 >= argc) {
+                fprintf(stderr, "error: expected WxH for -geometry\n");
+                dieusage();
+            }
+            
+            int chars;
+            
+            if (sscanf(argv[i+1], "%dx%d%n", window_size+0, window_size+1, &chars) != 2 ||
+                argv[i+1][chars] != '\0') {
+                fprintf(stderr, "error: bad format for -geometry\n");
+                dieusage();
+            }
+            
+            i += 1;
+            
+        } else if (!strcmp(argv[i], "-speedup")) {
+            
+            speedup = getdouble(argc, argv, i+1);
+            i += 1;
+            
+        } else if (!strcmp(argv[i], "-paused")) {
+            
+            animating = 0;
+            
+        } else if (!strcmp(argv[i], "-starttime")) {
+            
+            starttime = getdouble(argc, argv, i+1);
+            i += 1;
+
+            
+        } else if (!strcmp(argv[i], "-record")) {
+
+            recording = 1;
+            
+        } else if (!strcmp(argv[i], "-profile")) {
+
+            profiling = 1;
+
+        } else if (!strcmp(argv[i], "-specialize")) {
+
+            specialize = 1;
+            
+        } else if (!strcmp(argv[i], "-duration")) {
+            
+            rduration = getdouble(argc, argv, i+1);
+            i += 1;
+
+        } else if (!strcmp(argv[i], "-scale")) {
+            
+            u_scale_factor = getint(argc, argv, i+1);
+
+            if (u_scale_factor <= 0) {
+                fprintf(stderr, "scale factor must be a positive integer!\n");
+                exit(1);
+            }
+
+            is_scaled = 1;
+            
+            i += 1;
+            
+        } else if (!strcmp(argv[i], "-checkerboard")) {
+
+            checkerboard = 1;
+
+        } else if (!strcmp(argv[i], "-mosaic")) {
+
+            mosaic = 1;
+            
+        } else if (!strcmp(argv[i], "-frames")) {
+            
+            stop_at_frame = getint(argc, argv, i+1);
+            i += 1;
+            
+        } else if (!strcmp(argv[i], "-keyboard")) {
+
+            key_cidx = getint(argc, argv, i+1);
+            
+            if (key_cidx < 0 || key_cidx >= NUM_CHANNELS) {
+                fprintf(stderr, "invalid channel for keyboard (must be 0-3)\n");
+                exit(1);
+            }
+
+            i += 1;
+            
+        } else if (!strcmp(argv[i], "-fps")) {
+            
+            target_frame_duration = 1.0 / getdouble(argc, argv, i+1);
+            i += 1;
+
+        } else if (!strcmp(argv[i], "-max-texture-size")) {
+
+            max_texture_size = getint(argc, argv, i+1);
+            i += 1;
+
+        } else if (!strcmp(argv[i], "-sound-out")) {
+
+            if (i+1 >= argc) {
+                fprintf(stderr, "error: expected filename for %s\n", argv[i]);
+                dieusage();
+            }
+
+            sound_output = argv[i+1];
+            i += 1;
+
+        } else if (!strcmp(argv[i], "-video-fps")) {
+
+            video_fps = getdouble(argc, argv, i+1);
+            i += 1;
+
+        } else if (!strcmp(argv[i], "-nowatch")) {
+
+            watching = 0;
+
+        } else if (!strcmp(argv[i], "-cache")) {
+
+            if (i+1 >= argc) {
+                fprintf(stderr, "error: expected directory for %s\n", argv[i]);
+                dieusage();
+            }
+
+            cache_dir = argv[i+1];
+            i += 1;
+
+        } else if (!strcmp(argv[i], "-cache-size")) {
+
+            cache_size_mb = getint(argc, argv, i+1);
+            i += 1;
+
+        } else if (!strcmp(argv[i], "-nocache")) {
+
+            use_cache = 0;
+
+        } else if (!strcmp(argv[i], "-pass-scale")) {
+
+            add_pass_scale(argc, argv, i+1);
+            i += 1;
+
+        } else if (!strcmp(argv[i], "-pass-interval")) {
+
+            add_pass_interval(argc, argv, i+1);
+            i += 1;
+
+        } else if (!strcmp(argv[i], "-pack")) {
+
+            if (i+1 >= argc) {
+                fprintf(stderr, "error: expected filename for %s\n", argv[i]);
+                dieusage();
+            }
+
+            bundle_output = argv[i+1];
+            i += 1;
+
+        } else if (!strcmp(argv[i], "-serve")) {
+
+            if (i+1 >= argc) {
+                fprintf(stderr, "error: expected socket path for %s\n", argv[i]);
+                dieusage();
+            }
+
+            serve_path = argv[i+1];
+            i += 1;
+
+        } else if (!strcmp(argv[i], "-playlist")) {
+
+            if (i+1 >= argc) {
+                fprintf(stderr, "error: expected filename for %s\n", argv[i]);
+                dieusage();
+            }
+
+            read_playlist(argv[i+1]);
+            i += 1;
+
+        } else if (!strcmp(argv[i], "-sweep")) {
+
+            if (i+1 >= argc || !strchr(argv[i+1], '=') ||
+                argv[i+1][0] == '=' || !strchr(argv[i+1], '=')[1]) {
+                fprintf(stderr, "error: expected KEY=V1,V2,... for -sweep\n");
+                dieusage();
+            }
+
+            if (num_sweep_keys >= MAX_SWEEP_KEYS) {
+                fprintf(stderr, "error: too many -sweep options\n");
+                exit(1);
+            }
+
+            sweep_keys[num_sweep_keys++] = argv[i+1];
+            profiling = 1;
+            i += 1;
+
+        } else if (!strcmp(argv[i], "-sweep-max-error")) {
+
+            sweep_max_error = getdouble(argc, argv, i+1);
+            i += 1;
+
+        } else if (!strcmp(argv[i], "-D")) {
+
+            add_define(argc, argv, i+1);
+            i += 1;
+
+            
+
+#ifdef ST_GLFW_USE_CURL
+            
+        } else if (!strcmp(argv[i], "-id")) {
+
+            if (i+1 >= argc) {
+                fprintf(stderr, "error: expected id for %s\n", argv[i]);
+                dieusage();
+            }
+            
+            shadertoy_id = argv[i+1];
+            i += 1;
+
+        } else if (!strcmp(argv[i], "-apikey")) {
+
+            if (i+1 >= argc) {
+                fprintf(stderr, "error: expected key for %s\n", argv[i]);
+                dieusage();
+            }
+            
+            api_key = argv[i+1];
+            i += 1;
+            
+#endif
+        } else if (!strcmp(argv[i], "-d")) {
+
+            debug_output = 1;
+            
+        } else if (argv[i][0] == '-' && !force_files) {
+
+            fprintf(stderr, "error: unrecognized switch %s\n", argv[i]);
+            dieusage();
+            
+        } else {
+            
+            char* tmp = argv[i];
+            
+            for (int j=i; j<argc-1; ++j) {
+                argv[j] = argv[j+1];
+            }
+
+            const char* extension = get_extension(tmp);
+            if (!strcasecmp(extension, "js") || !strcasecmp(extension, "json")) {
+                any_json = 1;
+            } else if (!strcasecmp(extension, "stbundle")) {
+                any_bundle = 1;
+            }
+
+            argv[argc-1] = tmp;
+            input_start -=1;
+            i -= 1;
+            
+        }
+
+
+    }
+
+    if (use_cache) {
+        setup_texture_cache();
+    }
+
+    if (serve_path) {
+
+        if (recording || profiling || bundle_output || sound_output) {
+            fprintf(stderr, "error: -serve can't be combined with -record, "
+                    "-profile, -pack or -sound-out\n");
+            exit(1);
+        }
+
+        // time only moves when a client renders
+        animating = 0;
+        offscreen = 1;
+        
+    }
+
+    if (num_playlist_entries &&
+        (recording || profiling || bundle_output || serve_path ||
+         mosaic || sound_output)) {
+        fprintf(stderr, "error: -playlist can't be combined with -record, "
+                "-profile, -pack, -serve, -mosaic or -sound-out\n");
+        exit(1);
+    }
+
+    // only worth it when someone is watching, and the playlist
+    // replaces sources from under the watcher
+    if (recording || profiling || bundle_output || serve_path ||
+        num_playlist_entries) {
+        watching = 0;
+    }
+
+    if ((recording || profiling) && rduration) {
+        stop_at_frame = floor(rduration / (target_frame_duration * speedup));
+    }
+
+    // sound lasts as long as the recording, if any, played back at
+    // its nominal frame rate (-speedup only changes what's in it)
+    if (recording) {
+        sound_duration = stop_at_frame * target_frame_duration;
+    } else if (rduration) {
+        sound_duration = rduration;
+    } else {
+        sound_duration = DEFAULT_SOUND_DURATION;
+    }
+
+    if (recording) {
+        printf("will record for %d frames\n", stop_at_frame);
+    } else if (profiling) {
+        printf("will profile for %d frames\n", stop_at_frame);
+        stop_at_frame += startup_frames;
+    }
+        
+
+    int is_json_input = 0;
+    int is_bundle_input = 0;
+
+    if (any_json || any_bundle) {
+        if (input_start == argc-1) {
+            is_json_input = any_json;
+            is_bundle_input = any_bundle;
+        } else {
+            fprintf(stderr, "if JSON or bundle input is provided, "
+                    "it must be the only input!\n");
+            exit(1);
+        }
+    }
+
+    if (num_playlist_entries && (input_start != argc || shadertoy_id)) {
+        fprintf(stderr, "error: can't specify a playlist and other sources!\n");
+        exit(1);
+    }
+
+    if (mosaic && (is_json_input || is_bundle_input || shadertoy_id ||
+                   is_scaled || checkerboard || bundle_output || serve_path)) {
+        fprintf(stderr, "error: -mosaic only works with GLSL inputs, and not "
+                "with -scale, -checkerboard, -pack or -serve\n");
+        exit(1);
+    }
+
+    if ((is_json_input || shadertoy_id) && key_cidx >= 0) {
+        fprintf(stderr, "warning: ignoring -keyboard because reading JSON\n");
+    } else if (is_bundle_input && key_cidx >= 0) {
+        fprintf(stderr, "warning: ignoring -keyboard because reading bundle\n");
+    }
+
+    if (shadertoy_id) {
+
+        if (input_start != argc) {
+            fprintf(stderr, "error: can't specify shadertoy ID and other sources!\n");
+            exit(1);
+        }
+
+        if (!api_key) {
+            fprintf(stderr, "error: must set shadertoy API key from command line!\n");
+            exit(1);
+        }
+        
+        char url[1024];
+        
+        snprintf(url, 1024,
+                 "http://www.shadertoy.com/api/v1/shaders/%s?key=%s",
+                 shadertoy_id, api_key);
+
+        fetch_url(url, &cur_shader->json_buf);
+
+        const int is_local = 0;
+        load_json(is_local);
+        
+    } else if (is_json_input) {
+
+        buf_map_file(&cur_shader->json_buf, argv[argc-1]);
+
+        const int is_local = 1;
+        load_json(is_local);
+
+    } else if (is_bundle_input) {
+
+        load_bundle(argv[argc-1]);
+            
+    } else if (num_playlist_entries) {
+
+        load_shader_file(playlist[0].path);
+        
+    } else if (mosaic) {
+
+        cur_shader->num_renderbuffers = argc - input_start;
+
+        if (cur_shader->num_renderbuffers < 1 ||
+            cur_shader->num_renderbuffers > MAX_MOSAIC_TILES) {
+            fprintf(stderr, "error: -mosaic needs 1 to %d GLSL inputs\n",
+                    MAX_MOSAIC_TILES);
+            exit(1);
+        }
+
+        cur_shader->renderbuffers = mosaic_tiles;
+
+        mosaic_cols = ceil(sqrt(cur_shader->num_renderbuffers));
+        mosaic_rows = (cur_shader->num_renderbuffers + mosaic_cols - 1) / mosaic_cols;
+
+        window_size[0] *= mosaic_cols;
+        window_size[1] *= mosaic_rows;
+
+        for (int j=0; j<cur_shader->num_renderbuffers; ++j) {
+
+            const char* filename = argv[input_start + j];
+            renderbuffer_t* rb = cur_shader->renderbuffers + j;
+
+            // tiles are named after their files, minus directory and
+            // extension
+            const char* name = strrchr(filename, '/');
+            name = name ? name+1 : filename;
+
+            int length = strlen(name);
+            const char* extension = get_extension(name);
+            if (*extension) { length -= strlen(extension) + 1; }
+
+            snprintf(rb->name, MAX_PASS_NAME_LENGTH, "%.*s", length, name);
+            
+            cur_shader->draw_order[j] = j;
+
+            if (key_cidx >= 0) { setup_keyboard(rb, key_cidx); }
+
+            new_shader_source(rb);
+            buf_append_file(&rb->shader_buf, filename,
+                            MAX_PROGRAM_LENGTH, BUF_NULL_TERMINATE);
+            watch_source(filename, j);
+            
+            rb->fragment_src[FRAG_SRC_MAINIMAGE_SLOT] = rb->shader_buf.data;
+            rb->fragment_src[FRAG_SRC_MAIN_SLOT] = mosaic_main;
+
+        }
+
+    } else {
+
+        cur_shader->num_renderbuffers = 1;
+        snprintf(cur_shader->renderbuffers[0].name, MAX_PASS_NAME_LENGTH, "Image");
+
+        renderbuffer_t* rb = cur_shader->renderbuffers + 0;
+            
+        if (key_cidx >= 0) { setup_keyboard(rb, key_cidx); }
+            
+        for (int i=input_start; i<argc; ++i) {
+                
+            const char* filename = argv[i];
+                
+            new_shader_source(rb);
+            buf_append_file(&rb->shader_buf, filename,
+                            MAX_PROGRAM_LENGTH, BUF_NULL_TERMINATE);
+            watch_source(filename, 0);
+            rb->fragment_src[FRAG_SRC_MAINIMAGE_SLOT] = rb->shader_buf.data;
+                
+        }
+            
+    }
+
+    add_output_passes();
+
+    if (sound_output && !cur_shader->have_sound_pass) {
+        fprintf(stderr, "error: -sound-out needs a JSON input with a sound pass!\n");
+        exit(1);
+    }
+
+    if (specialize && !(recording || profiling)) {
+        fprintf(stderr, "warning: ignoring -specialize without -record or -profile\n");
+        specialize = 0;
+    }
+
+    // lets shaders tell, and keeps bundled program binaries out of it
+    if (specialize) {
+        const char* define = "#define ST_GLFW_SPECIALIZED 1\n";
+        buf_append_mem(&defines_buf, define, strlen(define), BUF_RAW_APPEND);
+    }
+
+    if (defines_buf.data) {
+        char null_term = '\0';
+        buf_append_mem(&defines_buf, &null_term, 1, BUF_RAW_APPEND);
+    }
+
+}
+
+//////////////////////////////////////////////////////////////////////
+
+void error_callback(int error, const char* description) {
+    fprintf(stderr, "GLFW error: %s\n", description);
+}
+
+//////////////////////////////////////////////////////////////////////
+
+void mouse_button_callback(GLFWwindow* window,
+                           int button, int action, int mods) {
+
+    if (button == GLFW_MOUSE_BUTTON_LEFT) {
+
+        if (action == GLFW_PRESS) {
+            
+            u_mouse[0] = cur_mouse[0];
+            u_mouse[1] = cur_mouse[1];
+            
+            u_mouse[2] = cur_mouse[0];
+            u_mouse[3] = cur_mouse[1];
+            
+            mouse_down = 1;
+            
+        } else {
+            
+            u_mouse[2] = -u_mouse[2];
+            u_mouse[3] = -u_mouse[3];
+            
+            mouse_down = 0;
+            
+        }
+        
+        need_render = 1;
+        
+    }
+
+
+}
+
+//////////////////////////////////////////////////////////////////////
+
+void cursor_pos_callback(GLFWwindow* window,
+                         double x, double y) {
+
+
+    cur_mouse[0] = (x) * pixel_scale[0];
+    cur_mouse[1] = (window_size[1] - y) * pixel_scale[1];
+
+    if (mouse_down) {
+        u_mouse[0] = cur_mouse[0];
+        u_mouse[1] = cur_mouse[1];
+        need_render = 1;
+    }
+    
+}
+
+//////////////////////////////////////////////////////////////////////
+// thanks, http://keycode.info/
+
+int js_from_glfw_key(int key) {
+
+    if ((key >= 'A' && key <= 'Z') ||
+        (key >= '0' && key <= '9') ||
+        key == ' ') {
+
+        return key;
+
+    }
+
+    switch (key) {
+    case GLFW_KEY_APOSTROPHE: return 222;
+    case GLFW_KEY_COMMA: return 188;
+    case GLFW_KEY_MINUS: return 189;
     case GLFW_KEY_PERIOD: return 190;
     case GLFW_KEY_SLASH: return 191;
     case GLFW_KEY_SEMICOLON: return 186;
@@ -2061,211 +5345,1286 @@ int js_from_glfw_key(int key) {
     
 }
 
+//////////////////////////////////////////////////////////////////////
+// press or release a key by its JavaScript key code
+
+void set_key(int jskey, int down) {
+
+    if (down) {
+
+        for (int c=0; c<3; ++c) {
+            key_press[3*jskey+c] = 255;
+            key_toggle[3*jskey+c] = ~key_toggle[3*jskey+c];
+            key_state[3*jskey+c] = 255;
+        }
+
+        keymap_dirty_rows = KEYMAP_ALL_DIRTY;
+        any_key_pressed = 1;
+
+        last_key = jskey;
+
+    } else {
+
+        for (int c=0; c<3; ++c) {
+            key_state[3*jskey+c] = 0;
+            key_press[3*jskey+c] = 0;
+        }
+
+        keymap_dirty_rows |= KEY_STATE_DIRTY | KEY_PRESS_DIRTY;
+
+    }
+
+    need_render = 1;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+
+void key_callback(GLFWwindow* window, int key,
+                  int scancode, int action, int mods) {
+
+    int jskey = js_from_glfw_key(key);
+
+#ifdef __APPLE__    
+    int ctrl_pressed = mods & GLFW_MOD_SUPER;
+#else
+    int ctrl_pressed = mods & GLFW_MOD_CONTROL;
+#endif
+        
+
+    if (action == GLFW_PRESS) {
+        
+        if (key == 'Q' && ctrl_pressed) {
+            
+            glfwSetWindowShouldClose(window, GL_TRUE);
+            
+        } else if ((key == GLFW_KEY_BACKSPACE || key == GLFW_KEY_DELETE) &&
+                   ctrl_pressed) {
+
+            reset();
+            
+        } else if (key == '`' && ctrl_pressed) {
+
+            animating = !animating;
+            
+            if (animating == 1) {
+                printf("resumed at %f\n", u_time);
+                last_frame_start = 0;
+                glfwSetTime(0);
+            } else {
+                printf("paused at %f\n", u_time);
+            }
+            
+        } else if (toupper(key) == 'S' && ctrl_pressed) {
+
+            printf("saving a screenshot!\n");
+            single_shot = 1;
+            need_render = 1;
+
+        } else if (jskey >= 0 && jskey < 256) {
+
+            set_key(jskey, 1);
+
+        }
+        
+    } else if (action == GLFW_RELEASE && jskey >= 0 && jskey < 256) {
+        
+        set_key(jskey, 0);
+
+    } else if (action == GLFW_REPEAT && jskey >= 0 && jskey < 256) {
+
+        int was_pressed = key_state[3*jskey];
+        
+        for (int c=0; c<3; ++c) {
+            key_state[3*jskey+c] = was_pressed ? 0 : 255;
+            key_press[3*jskey+c] = was_pressed ? 0 : 255;
+        }
+
+        keymap_dirty_rows |= KEY_STATE_DIRTY | KEY_PRESS_DIRTY;
+        any_key_pressed = any_key_pressed || !was_pressed;
+
+        need_render = 1;
+
+    }
+
+    
+}
+
+//////////////////////////////////////////////////////////////////////
+
+void framebuffer_size_updated(GLFWwindow* window) {
+
+    glfwGetFramebufferSize(window,
+                           display_framebuffer_size+0,
+                           display_framebuffer_size+1);
+
+    for (int i=0; i<2; ++i) {
+        render_framebuffer_size[i] = display_framebuffer_size[i] * u_scale_factor;
+        float denom = window_size[i] ? window_size[i] : 1;
+        pixel_scale[i] = render_framebuffer_size[i] / denom;
+    }
+
+    dprintf("pixel scale=%f %f\n", pixel_scale[0], pixel_scale[1]);
+    
+}
+
+//////////////////////////////////////////////////////////////////////
+
+void window_size_callback(GLFWwindow* window,
+                          int w, int h) {
+
+    window_size[0] = w;
+    window_size[1] = h;
+
+    framebuffer_size_updated(window);
+    
+    for (int j=0; j<cur_shader->num_renderbuffers; ++j) {
+        renderbuffer_t* rb = cur_shader->renderbuffers + j;
+        if (rb->framebuffer_state != FRAMEBUFFER_NONE && !rb->is_cubemap) {
+            rb->framebuffer_state = FRAMEBUFFER_BADSIZE;
+        }
+    }
+
+    render(window);
+    
+}
+
+//////////////////////////////////////////////////////////////////////
+// returns NULL if there's no GL to be had
+
+GLFWwindow* setup_window() {
+
+    if (!glfwInit()) {
+        fprintf(stderr, "Error initializing GLFW!\n");
+        return NULL;
+    }
+
+    glfwSetErrorCallback(error_callback);
+
+
+#ifdef __APPLE__    
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);    
+#endif
+
+    glfwWindowHint(GLFW_DOUBLEBUFFER, GL_TRUE);
+
+    // packing only needs a context to compile in
+    if (bundle_output || offscreen) {
+        glfwWindowHint(GLFW_VISIBLE, GL_FALSE);
+    }
+
+
+    float xscale=1.0, yscale=1.0;
+
+#if (GLFW_VERSION_MAJOR >= 3 && GLFW_VERSION_MINOR >= 3)    
+
+    glfwGetMonitorContentScale(glfwGetPrimaryMonitor(), &xscale, &yscale);
+
+    dprintf("monitor scale=%f, %f\n", xscale, yscale);
+
+#endif    
+    
+    GLFWwindow* window = glfwCreateWindow(window_size[0]/(xscale),
+                                          window_size[1]/(yscale),
+                                          cur_shader->window_title, NULL, NULL);
+    if (!window) {
+        fprintf(stderr, "Error creating window!\n");
+        glfwTerminate();
+        return NULL;
+    }
+
+    glfwGetWindowSize(window, window_size+0, window_size+1);
+
+    framebuffer_size_updated(window);
+    
+    glfwSetKeyCallback(window, key_callback);
+    glfwSetCursorPosCallback(window, cursor_pos_callback);
+    glfwSetMouseButtonCallback(window, mouse_button_callback);
+    glfwSetWindowSizeCallback(window, window_size_callback);
+    
+    glfwMakeContextCurrent(window);
+#ifdef ST_GLFW_USE_GLEW
+    glewInit();
+#endif
+    glfwSwapInterval((profiling || offscreen) ? 0 : 1);
+
+    // like WebGL 2, filter across cube map face edges
+    glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
+    
+    check_opengl_errors("after setting up glfw & glew");
+
+    return window;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// root mean squared difference of two RGB screens, in 0-255 units
+
+double screen_rms_error(const unsigned char* a, const unsigned char* b,
+                        int w, int h, int stride) {
+
+    double total = 0;
+
+    for (int y=0; y<h; ++y) {
+        const unsigned char* ra = a + y*stride;
+        const unsigned char* rb = b + y*stride;
+        for (int x=0; x<w*3; ++x) {
+            double d = (double)ra[x] - (double)rb[x];
+            total += d*d;
+        }
+    }
+
+    return sqrt(total / (w*h*3.0));
+    
+}
+
+//////////////////////////////////////////////////////////////////////
+// compile, profile and capture every combination of the -sweep
+// defines, then report them all against the first one
+
+void run_sweep(GLFWwindow* window) {
+
+    int counts[MAX_SWEEP_KEYS];
+    int num_variants = 1;
+
+    for (int k=0; k<num_sweep_keys; ++k) {
+        
+        const char* values = strchr(sweep_keys[k], '=') + 1;
+
+        counts[k] = 1;
+        for (const char* c=values; *c; ++c) {
+            if (*c == ',') { ++counts[k]; }
+        }
+        
+        num_variants *= counts[k];
+        
+        if (num_variants > MAX_SWEEP_VARIANTS) {
+            fprintf(stderr, "error: more than %d sweep variants!\n",
+                    MAX_SWEEP_VARIANTS);
+            exit(1);
+        }
+        
+    }
+
+    // the defines from -D stay put in front of the swept ones
+    size_t base_size = defines_buf.data ? defines_buf.size - 1 : 0;
+
+    char labels[MAX_SWEEP_VARIANTS][BIG_STRING_LENGTH];
+    double means[MAX_SWEEP_VARIANTS], stds[MAX_SWEEP_VARIANTS];
+    double errors[MAX_SWEEP_VARIANTS];
+
+    unsigned char* reference = NULL;
+    int ref_size[2] = { 0, 0 };
+
+    float N = (stop_at_frame - startup_frames);
+    int num_done = 0;
+
+    for (int v=0; v<num_variants && !glfwWindowShouldClose(window); ++v) {
+
+        defines_buf.size = base_size;
+        labels[v][0] = '\0';
+        
+        int idx = v;
+
+        for (int k=0; k<num_sweep_keys; ++k) {
+
+            int which = idx % counts[k];
+            idx /= counts[k];
+
+            const char* key = sweep_keys[k];
+            const char* equals = strchr(key, '=');
+            const char* value = equals + 1;
+            
+            for (int c=0; c<which; ++c) {
+                value = strchr(value, ',') + 1;
+            }
+
+            const char* end = strchr(value, ',');
+            if (!end) { end = value + strlen(value); }
+
+            char keyval[BIG_STRING_LENGTH];
+            snprintf(keyval, BIG_STRING_LENGTH, "%.*s=%.*s",
+                     (int)(equals - key), key, (int)(end - value), value);
+
+            char* define_args[1] = { keyval };
+            add_define(1, define_args, 0);
+
+            size_t l = strlen(labels[v]);
+            snprintf(labels[v] + l, BIG_STRING_LENGTH - l, "%s%s",
+                     l ? " " : "", keyval);
+            
+        }
+
+        char null_term = '\0';
+        buf_append_mem(&defines_buf, &null_term, 1, BUF_RAW_APPEND);
+
+        for (int j=0; j<cur_shader->num_renderbuffers; ++j) {
+            recompile_program(cur_shader->renderbuffers + j);
+        }
+
+        total_delta = total_delta2 = 0;
+        reset();
+
+        while (u_frame < stop_at_frame && !glfwWindowShouldClose(window)) {
+            render(window);
+            glfwPollEvents();
+        }
+
+        if (u_frame < stop_at_frame) { break; }
+
+        means[v] = total_delta / N;
+        stds[v] = sqrt(N*total_delta2 - total_delta*total_delta) / N;
+
+        // one more, untimed frame to compare against the reference
+        capture_next_frame = 1;
+        render(window);
+
+        errors[v] = -1;
+
+        if (!reference) {
+            reference = captured_pixels;
+            ref_size[0] = render_framebuffer_size[0];
+            ref_size[1] = render_framebuffer_size[1];
+            captured_pixels = NULL;
+            errors[v] = 0;
+        } else if (render_framebuffer_size[0] == ref_size[0] &&
+                   render_framebuffer_size[1] == ref_size[1]) {
+            errors[v] = screen_rms_error(reference, captured_pixels,
+                                         ref_size[0], ref_size[1],
+                                         captured_stride);
+        }
+
+        printf("%s: %.3f ms/frame\n", labels[v], 1e3*means[v]);
+
+        ++num_done;
+        
+    }
+
+    printf("\n%-40s %10s %10s %10s\n", "variant", "ms/frame", "std.", "rms error");
+
+    int best = -1;
+
+    for (int v=0; v<num_done; ++v) {
+
+        char error[64];
+        if (errors[v] < 0) {
+            snprintf(error, 64, "n/a");
+        } else {
+            snprintf(error, 64, "%.3f", errors[v]);
+        }
+
+        printf("%-40s %10.3f %10.3f %10s\n", labels[v],
+               1e3*means[v], 1e3*stds[v], error);
+
+        int ok = (sweep_max_error < 0 ||
+                  (errors[v] >= 0 && errors[v] <= sweep_max_error));
+
+        if (ok && (best < 0 || means[v] < means[best])) {
+            best = v;
+        }
+        
+    }
+
+    if (best >= 0) {
+        printf("\nfastest%s: %s at %.3f ms/frame\n",
+               sweep_max_error < 0 ? "" : " within error threshold",
+               labels[best], 1e3*means[best]);
+    } else {
+        printf("\nno variant was within the error threshold\n");
+    }
+
+    free(reference);
+    free(captured_pixels);
+    captured_pixels = NULL;
+    
+}
+
+//////////////////////////////////////////////////////////////////////
+// re-read a pass's source files and swap in its new program; if
+// anything goes wrong the old one keeps running. Returns 1 on success.
+
+int reload_pass(int pass) {
+
+    renderbuffer_t* rb = cur_shader->renderbuffers + pass;
+
+    buffer_t prev_buf = rb->shader_buf;
+    int prev_count = rb->shader_count;
+
+    memset(&rb->shader_buf, 0, sizeof(buffer_t));
+    rb->shader_count = 0;
+
+    int ok = 1;
+
+    for (int id=0; ok && id<num_watched_sources; ++id) {
+        if (source_passes[id] == pass) {
+            new_shader_source(rb);
+            ok = buf_try_append_file(&rb->shader_buf, watch_path(watcher, id),
+                                     MAX_PROGRAM_LENGTH, BUF_NULL_TERMINATE);
+        }
+    }
+
+    if (ok) {
+        rb->fragment_src[FRAG_SRC_MAINIMAGE_SLOT] = rb->shader_buf.data;
+        ok = recompile_program(rb);
+    }
+
+    if (!ok) {
+        buf_free(&rb->shader_buf);
+        rb->shader_buf = prev_buf;
+        rb->shader_count = prev_count;
+        rb->fragment_src[FRAG_SRC_MAINIMAGE_SLOT] = prev_buf.data;
+        return 0;
+    }
+
+    buf_free(&prev_buf);
+    
+    return 1;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// recompile just the passes whose sources changed on disk, or all of
+// them if the common code did; framebuffers, textures and time are
+// all left as they are
+
+void reload_changed_sources() {
+
+    int changed[WATCH_MAX_FILES];
+
+    if (!watch_poll(watcher, changed)) { return; }
+
+    int reload[MAX_PASSES];
+    memset(reload, 0, sizeof(reload));
+
+    int reload_sound = 0;
+
+    shader_errors_fatal = 0;
+
+    for (int id=0; id<num_watched_sources; ++id) {
+
+        if (!changed[id]) { continue; }
+
+        if (source_passes[id] != SOURCE_COMMON) {
+            reload[source_passes[id]] = 1;
+            continue;
+        }
+
+        buffer_t new_common;
+        memset(&new_common, 0, sizeof(new_common));
+
+        if (!buf_try_append_file(&new_common, watch_path(watcher, id),
+                                 MAX_PROGRAM_LENGTH, BUF_NULL_TERMINATE)) {
+            continue;
+        }
+
+        // only the passes from the JSON use the common code, not the
+        // ones add_output_passes() tacked on
+        const char* old_common = cur_shader->common_buf.data;
+
+        for (int j=0; j<cur_shader->num_renderbuffers; ++j) {
+            renderbuffer_t* rb = cur_shader->renderbuffers + j;
+            if (rb->fragment_src[FRAG_SRC_COMMON_SLOT] == old_common) {
+                rb->fragment_src[FRAG_SRC_COMMON_SLOT] = new_common.data;
+                reload[j] = 1;
+            }
+        }
+
+        if (cur_shader->have_sound_pass &&
+            cur_shader->sound_pass.fragment_src[FRAG_SRC_COMMON_SLOT] == old_common) {
+            cur_shader->sound_pass.fragment_src[FRAG_SRC_COMMON_SLOT] =
+                new_common.data;
+            reload_sound = 1;
+        }
+
+        // programs that fail below were linked already, so they don't
+        // need the old common code any more either
+        buf_free(&cur_shader->common_buf);
+        cur_shader->common_buf = new_common;
+        
+    }
+
+    for (int j=0; j<cur_shader->num_renderbuffers; ++j) {
+
+        if (!reload[j]) { continue; }
+
+        renderbuffer_t* rb = cur_shader->renderbuffers + j;
+        int has_files = 0;
+        
+        for (int id=0; id<num_watched_sources; ++id) {
+            if (source_passes[id] == j) { has_files = 1; }
+        }
+
+        int ok = has_files ? reload_pass(j) : recompile_program(rb);
+
+        if (ok) {
+            printf("reloaded %s\n", rb->name);
+        } else {
+            fprintf(stderr, "%s didn't compile, keeping the old program\n",
+                    rb->name);
+        }
+        
+    }
+
+    // the sound was rendered at startup, but keep its program in step
+    if (reload_sound) {
+        if (recompile_program(&cur_shader->sound_pass)) {
+            printf("reloaded %s\n", cur_shader->sound_pass.name);
+        } else {
+            fprintf(stderr, "%s didn't compile, keeping the old program\n",
+                    cur_shader->sound_pass.name);
+        }
+    }
+
+    shader_errors_fatal = 1;
+    need_render = 1;
+    
+}
+
+//////////////////////////////////////////////////////////////////////
+// compile a freshly loaded shader (after unload_passes) and upload
+// its textures, in any context that shares objects with the one that
+// draws; if a pass doesn't compile, everything gets unloaded again and
+// this returns 0 (only possible when shader errors aren't fatal)
+
+int prepare_loaded_shader() {
+
+    add_output_passes();
+
+    start_images();
+
+    if (!setup_passes()) {
+        finish_images();
+        unload_passes();
+        return 0;
+    }
+    
+    setup_uniforms();
+    finish_images();
+    release_textures();
+
+    return 1;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// the same, then make the shader ready to draw in this context
+
+int start_loaded_shader() {
+
+    if (!prepare_loaded_shader()) {
+        return 0;
+    }
+
+    setup_context_objects();
+    reset();
+
+    return 1;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// replace the current shader with a local JSON file or bundle;
+// returns NULL on success, otherwise what went wrong
+
+const char* serve_load(const char* filename) {
+
+    const char* extension = get_extension(filename);
+
+    if (!is_json_file(filename) && strcasecmp(extension, "stbundle")) {
+        return "can only load .json or .stbundle files";
+    }
+
+    if (access(filename, R_OK)) {
+        return "can't read file";
+    }
+
+    static char message[JSFAIL_MESSAGE_LENGTH + 64];
+
+    unload_passes();
+
+    if (!try_load(load_shader_file, filename)) {
+        unload_passes();
+        snprintf(message, sizeof(message), "%s, nothing is loaded now",
+                 jsfail_message);
+        return message;
+    }
+
+    // a bad shader leaves nothing loaded rather than ending the server
+    shader_errors_fatal = 0;
+    int ok = start_loaded_shader();
+    shader_errors_fatal = 1;
+
+    if (!ok) {
+        return "shader didn't compile, nothing is loaded now";
+    }
+
+    return NULL;
+    
+}
+
+//////////////////////////////////////////////////////////////////////
+// copy the last captured frame out as RGB rows from the top down
+
+void copy_captured_frame(unsigned char* dst, size_t stride) {
+
+    int w = render_framebuffer_size[0];
+    int h = render_framebuffer_size[1];
+
+    // glReadPixels goes bottom up
+    for (int y=0; y<h; ++y) {
+        memcpy(dst + stride*y,
+               captured_pixels + captured_stride*(h-1-y),
+               3*w);
+    }
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// render [COUNT [raw|png [FILE]]]: draw COUNT frames and send back the
+// last one, or write it to FILE (e.g. somewhere in /dev/shm). Raw
+// frames are packed RGB rows from the top down. Replies right away,
+// since the reply carries the frame.
+
+void serve_render(GLFWwindow* window, const char* args, double start) {
+
+    int count = 1;
+    char format[8] = "";
+    char filename[BIG_STRING_LENGTH] = "";
+    char extra;
+
+    int fields = sscanf(args, "%d %7s %1023s %c",
+                        &count, format, filename, &extra);
+
+    if (fields == 0 || fields == 4 || count < 1 ||
+        (fields >= 2 && strcmp(format, "raw") && strcmp(format, "png"))) {
+        server_printf(server, "error usage: render [COUNT [raw|png [FILE]]]\n");
+        return;
+    }
+
+    if (!cur_shader->num_renderbuffers) {
+        server_printf(server, "error no shader loaded\n");
+        return;
+    }
+
+    for (int k=0; k<count; ++k) {
+        capture_next_frame = (format[0] && k == count-1);
+        render(window);
+    }
+
+    if (!format[0]) {
+        server_printf(server, "ok %.3f\n", (get_wallclock() - start) * 1e3);
+        return;
+    }
+
+    int w = render_framebuffer_size[0];
+    int h = render_framebuffer_size[1];
+
+    char* data = NULL;
+    size_t size = 0;
+
+    if (!strcmp(format, "raw")) {
+
+        size = 3*w*h;
+        data = (char*)malloc(size);
+
+        if (!data) {
+            fprintf(stderr, "out of memory in serve_render!\n");
+            exit(1);
+        }
+
+        copy_captured_frame((unsigned char*)data, 3*w);
+
+    } else {
+
+        FILE* fp = open_memstream(&data, &size);
+
+        if (!fp ||
+            !write_png_stream(fp, captured_pixels, w, h, captured_stride,
+                              1, pixel_scale) ||
+            fclose(fp)) {
+            fprintf(stderr, "error encoding PNG!\n");
+            exit(1);
+        }
+
+    }
+
+    free(captured_pixels);
+    captured_pixels = NULL;
+
+    if (filename[0]) {
+
+        FILE* fp = fopen(filename, "wb");
+
+        int ok = fp && fwrite(data, 1, size, fp) == size;
+
+        if (!fp || fclose(fp) || !ok) {
+            server_printf(server, "error can't write %s\n", filename);
+        } else {
+            server_printf(server, "ok %.3f %d %d 0\n",
+                          (get_wallclock() - start) * 1e3, w, h);
+        }
+
+    } else if (server_printf(server, "ok %.3f %d %d %zu\n",
+                             (get_wallclock() - start) * 1e3,
+                             w, h, size)) {
+        
+        server_write(server, data, size);
+        
+    }
+
+    free(data);
+    
+}
+
+//////////////////////////////////////////////////////////////////////
+// with -serve: keep the context and the current shader around, and
+// take commands a line at a time. Each one gets a reply of either
+// "ok MS ..." with the milliseconds it took, or "error MESSAGE".
+//
+//   load FILE           replace the shader (.json or .stbundle)
+//   time T              set iTime
+//   frame N             set iFrame
+//   mouse X Y Z W       set iMouse
+//   key CODE 0|1        release or press a key (JavaScript key code)
+//   reset               back to the start time, clearing buffers
+//   render ...          see serve_render()
+//   quit                shut down the server
+
+void run_server(GLFWwindow* window) {
+
+    server = server_create(serve_path);
+    printf("listening on %s\n", serve_path);
+
+    char line[SERVER_MAX_LINE];
+
+    while (1) {
+
+        server_read_line(server, line);
+
+        double start = get_wallclock();
+
+        char command[32];
+        int length;
+
+        // blank lines are ignored
+        if (sscanf(line, "%31s%n", command, &length) != 1) { continue; }
+
+        const char* args = line + length;
+        while (isspace(*args)) { ++args; }
+
+        const char* error = NULL;
+        const char* usage = NULL;
+
+        float f[4];
+        int n[2];
+        char extra;
+
+        if (!strcmp(command, "quit")) {
+
+            server_printf(server, "ok %.3f\n", (get_wallclock() - start) * 1e3);
+            break;
+            
+        } else if (!strcmp(command, "render")) {
+
+            serve_render(window, args, start);
+            continue;
+
+        } else if (!strcmp(command, "load")) {
+
+            if (!*args) {
+                usage = "load FILE";
+            } else {
+                error = serve_load(args);
+            }
+            
+        } else if (!strcmp(command, "time")) {
+
+            if (sscanf(args, "%f %c", f, &extra) != 1) {
+                usage = "time T";
+            } else {
+                u_time = f[0];
+            }
+            
+        } else if (!strcmp(command, "frame")) {
+
+            if (sscanf(args, "%d %c", n, &extra) != 1) {
+                usage = "frame N";
+            } else {
+                u_frame = n[0];
+            }
+            
+        } else if (!strcmp(command, "mouse")) {
+
+            if (sscanf(args, "%f %f %f %f %c",
+                       f+0, f+1, f+2, f+3, &extra) != 4) {
+                usage = "mouse X Y Z W";
+            } else {
+                memcpy(u_mouse, f, sizeof(u_mouse));
+            }
+            
+        } else if (!strcmp(command, "key")) {
+
+            if (sscanf(args, "%d %d %c", n+0, n+1, &extra) != 2 ||
+                n[0] < 0 || n[0] >= 256) {
+                usage = "key CODE 0|1";
+            } else {
+                set_key(n[0], n[1]);
+            }
+            
+        } else if (!strcmp(command, "reset")) {
+
+            reset();
+            
+        } else {
+
+            error = "unknown command";
+            
+        }
+
+        if (usage) {
+            server_printf(server, "error usage: %s\n", usage);
+        } else if (error) {
+            server_printf(server, "error %s\n", error);
+        } else {
+            server_printf(server, "ok %.3f\n", (get_wallclock() - start) * 1e3);
+        }
+
+    }
+
+    server_free(server);
+    server = NULL;
+    
+}
+
+//////////////////////////////////////////////////////////////////////
+// runs on the preloader thread: unload the shader that was playing
+// before the last switch, then load the next entry into next_shader
+// and compile and upload all of it in preload_context, so that
+// switching to it is just a matter of setting up its vertex arrays
+// and framebuffers. A broken entry prints a message and gets skipped.
+
+void* preload_entry(void* unused) {
+
+    const char* filename = playlist[preload_pos].path;
+
+    cur_shader = next_shader;
+    shader_errors_fatal = 0;
+    gl_errors_fatal = 0;
+    gl_error_seen = 0;
+
+    glfwMakeContextCurrent(preload_context);
+
+    unload_passes();
+    init_shader(cur_shader);
+
+    int ok = (try_load(load_shader_file, filename) &&
+              prepare_loaded_shader() &&
+              !gl_error_seen);
+
+    if (!ok) {
+        fprintf(stderr, "warning: skipping %s\n", filename);
+        unload_passes();
+    }
+
+    // the window's context can only count on what's finished here
+    glFinish();
+    retire_uploads();
+    
+    glfwMakeContextCurrent(NULL);
+
+    pthread_mutex_lock(&preload_mutex);
+    preload_ok = ok;
+    preload_done = 1;
+    pthread_mutex_unlock(&preload_mutex);
+
+    return NULL;
+
+}
+
 //////////////////////////////////////////////////////////////////////
 
-void key_callback(GLFWwindow* window, int key,
-                  int scancode, int action, int mods) {
+void start_preload(int pos) {
 
-    int jskey = js_from_glfw_key(key);
+    preload_pos = pos;
+    preload_ok = 0;
+    preload_done = 0;
 
-#ifdef __APPLE__    
-    int ctrl_pressed = mods & GLFW_MOD_SUPER;
-#else
-    int ctrl_pressed = mods & GLFW_MOD_CONTROL;
-#endif
-        
+    if (!decode_pool) {
+        decode_pool = tp_create(0);
+    }
+    
+    if (pthread_create(&preloader, NULL, preload_entry, NULL)) {
+        fprintf(stderr, "error creating preloader thread!\n");
+        exit(1);
+    }
 
-    if (action == GLFW_PRESS) {
-        
-        if (key == 'Q' && ctrl_pressed) {
-            
-            glfwSetWindowShouldClose(window, GL_TRUE);
-            
-        } else if ((key == GLFW_KEY_BACKSPACE || key == GLFW_KEY_DELETE) &&
-                   ctrl_pressed) {
+    preloader_running = 1;
+    
+}
 
-            reset();
-            
-        } else if (key == '`' && ctrl_pressed) {
+//////////////////////////////////////////////////////////////////////
+// returns 1 once the preloader is done with the next entry
 
-            animating = !animating;
-            
-            if (animating == 1) {
-                printf("resumed at %f\n", u_time);
-                last_frame_start = 0;
-                glfwSetTime(0);
-            } else {
-                printf("paused at %f\n", u_time);
-            }
-            
-        } else if (toupper(key) == 'S' && ctrl_pressed) {
+int preload_finished() {
 
-            printf("saving a screenshot!\n");
-            single_shot = 1;
-            need_render = 1;
+    pthread_mutex_lock(&preload_mutex);
+    int done = preload_done;
+    pthread_mutex_unlock(&preload_mutex);
 
-        } else if (jskey >= 0 && jskey < 256) {
+    return done;
+    
+}
 
-            for (int c=0; c<3; ++c) {
-                key_press[3*jskey+c] = 255;
-                key_toggle[3*jskey+c] = ~key_toggle[3*jskey+c];
-                key_state[3*jskey+c] = 255;
-            }
+//////////////////////////////////////////////////////////////////////
 
-            last_key = jskey;
-            need_render = 1;
+void finish_preload() {
 
-        }
-        
-    } else if (action == GLFW_RELEASE && jskey >= 0 && jskey < 256) {
-        
-        for (int c=0; c<3; ++c) {
-            key_state[3*jskey+c] = 0;
-            key_press[3*jskey+c] = 0;
-        }
+    if (preloader_running) {
+        pthread_join(preloader, NULL);
+        preloader_running = 0;
+    }
+    
+}
 
-        need_render = 1;
+//////////////////////////////////////////////////////////////////////
 
-    } else if (action == GLFW_REPEAT && jskey >= 0 && jskey < 256) {
+void start_playlist(GLFWwindow* window) {
 
-        int was_pressed = key_state[3*jskey];
-        
-        for (int c=0; c<3; ++c) {
-            key_state[3*jskey+c] = was_pressed ? 0 : 255;
-            key_press[3*jskey+c] = was_pressed ? 0 : 255;
-        }
+    playlist_pos = 0;
+    playlist_switch_time = get_wallclock() + playlist[0].duration;
 
-        need_render = 1;
+    if (num_playlist_entries == 1) {
+        return;
+    }
 
+    // windows have to be created on the main thread
+    glfwWindowHint(GLFW_VISIBLE, GL_FALSE);
+    preload_context = glfwCreateWindow(1, 1, "preload", NULL, window);
+
+    if (!preload_context) {
+        fprintf(stderr, "error creating a shared context for -playlist!\n");
+        exit(1);
     }
 
+    init_shader(next_shader);
+    start_preload(1);
     
 }
 
 //////////////////////////////////////////////////////////////////////
+// swap the current shader out for the next one on the playlist, and
+// start preloading the one after that; until the next one is ready,
+// the current one keeps playing
 
-void framebuffer_size_updated(GLFWwindow* window) {
+void next_playlist_entry(GLFWwindow* window) {
 
-    glfwGetFramebufferSize(window,
-                           display_framebuffer_size+0,
-                           display_framebuffer_size+1);
+    // a single entry just keeps playing
+    if (num_playlist_entries == 1) {
+        playlist_switch_time += playlist[0].duration;
+        return;
+    }
 
-    for (int i=0; i<2; ++i) {
-        render_framebuffer_size[i] = display_framebuffer_size[i] * u_scale_factor;
-        float denom = window_size[i] ? window_size[i] : 1;
-        pixel_scale[i] = render_framebuffer_size[i] / denom;
+    if (!preload_finished()) {
+        return;
     }
+    
+    double start = get_wallclock();
 
-    dprintf("pixel scale=%f %f\n", pixel_scale[0], pixel_scale[1]);
+    int pos = preload_pos;
+    const playlist_entry_t* entry = playlist + pos;
+
+    finish_preload();
+
+    // keep showing the current shader, and try the one after the bad
+    // one as soon as it's preloaded
+    if (!preload_ok) {
+        start_preload((pos + 1) % num_playlist_entries);
+        return;
+    }
+
+    // the rest of the old shader gets unloaded on the preloader thread
+    free_context_objects();
+
+    shader_t* prev_shader = cur_shader;
+    cur_shader = next_shader;
+    next_shader = prev_shader;
+
+    setup_context_objects();
+    reset();
+    
+    glfwSetWindowTitle(window, cur_shader->window_title);
+
+    printf("switched to %s in %.1f ms\n", entry->path,
+           (get_wallclock() - start) * 1e3);
+
+    playlist_pos = pos;
+    playlist_switch_time = get_wallclock() + entry->duration;
+
+    start_preload((pos + 1) % num_playlist_entries);
     
 }
 
 //////////////////////////////////////////////////////////////////////
+// the st_render API, see st_render.h; each context keeps its own
+// shader, but the window, timing and image loading state is shared
+// with the command line tool, hence one context at a time
 
-void window_size_callback(GLFWwindow* window,
-                          int w, int h) {
-
-    window_size[0] = w;
-    window_size[1] = h;
+struct st_render {
 
-    framebuffer_size_updated(window);
+    GLFWwindow* window;
+    shader_t shader;
     
-    for (int j=0; j<num_renderbuffers; ++j) {
-        renderbuffer_t* rb = renderbuffers + j;
-        if (rb->framebuffer_state != FRAMEBUFFER_NONE) {
-            rb->framebuffer_state = FRAMEBUFFER_BADSIZE;
-        }
+};
+
+//////////////////////////////////////////////////////////////////////
+// every st_render call starts here: returns 0 if r isn't the live
+// context, otherwise points everything at r's shader and has GL
+// errors get counted instead of exiting
+
+int begin_render_call(const st_render_t* r, const char* func) {
+
+    if (!r || r != render_context) {
+        fprintf(stderr, "error: %s called with a bad st_render context\n",
+                func);
+        return 0;
     }
 
-    render(window);
+    cur_shader = &render_context->shader;
+    
+    gl_errors_fatal = 0;
+    gl_error_seen = 0;
+
+    return 1;
     
 }
 
 //////////////////////////////////////////////////////////////////////
+// returns 0 if there were GL errors since begin_render_call()
 
-GLFWwindow* setup_window() {
+int end_render_call() {
 
-    if (!glfwInit()) {
-        fprintf(stderr, "Error initializing GLFW!\n");
-        exit(1);
+    cur_shader = &main_shader;
+    gl_errors_fatal = 1;
+
+    return !gl_error_seen;
+    
+}
+
+//////////////////////////////////////////////////////////////////////
+
+st_render_t* st_render_create(int width, int height) {
+
+    if (render_context) {
+        fprintf(stderr, "error: only one st_render context can exist at a time\n");
+        return NULL;
     }
 
-    glfwSetErrorCallback(error_callback);
+    if (width <= 0 || height <= 0) {
+        fprintf(stderr, "error: bad size %dx%d for st_render_create\n",
+                width, height);
+        return NULL;
+    }
 
+    st_render_t* r = (st_render_t*)malloc(sizeof(st_render_t));
 
-#ifdef __APPLE__    
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
-    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
-    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);    
-#endif
+    if (!r) {
+        fprintf(stderr, "out of memory in st_render_create!\n");
+        return NULL;
+    }
 
-    glfwWindowHint(GLFW_DOUBLEBUFFER, GL_TRUE);
+    init_shader(&r->shader);
+    render_context = r;
 
+    begin_render_call(r, "st_render_create");
 
-    float xscale=1.0, yscale=1.0;
+    startup_time = get_wallclock();
 
-#if (GLFW_VERSION_MAJOR >= 3 && GLFW_VERSION_MINOR >= 3)    
+    window_size[0] = width;
+    window_size[1] = height;
 
-    glfwGetMonitorContentScale(glfwGetPrimaryMonitor(), &xscale, &yscale);
+    offscreen = 1;
+    animating = 0;
+    
+    r->window = setup_window();
 
-    dprintf("monitor scale=%f, %f\n", xscale, yscale);
+    if (!r->window || !end_render_call()) {
+        if (r->window) {
+            glfwDestroyWindow(r->window);
+            glfwTerminate();
+        }
+        render_context = NULL;
+        free(r);
+        return NULL;
+    }
+    
+    enable_pbo_uploads();
 
-#endif    
+    return r;
     
-    GLFWwindow* window = glfwCreateWindow(window_size[0]/(xscale),
-                                          window_size[1]/(yscale),
-                                          window_title, NULL, NULL);
-    if (!window) {
-        fprintf(stderr, "Error creating window!\n");
-        exit(1);
+}
+
+//////////////////////////////////////////////////////////////////////
+
+void st_render_get_size(const st_render_t* r, int* width, int* height) {
+
+    if (!begin_render_call(r, "st_render_get_size")) {
+        *width = *height = 0;
+        return;
     }
 
-    glfwGetWindowSize(window, window_size+0, window_size+1);
+    *width = render_framebuffer_size[0];
+    *height = render_framebuffer_size[1];
 
-    framebuffer_size_updated(window);
+    end_render_call();
     
-    glfwSetKeyCallback(window, key_callback);
-    glfwSetCursorPosCallback(window, cursor_pos_callback);
-    glfwSetMouseButtonCallback(window, mouse_button_callback);
-    glfwSetWindowSizeCallback(window, window_size_callback);
+}
+
+//////////////////////////////////////////////////////////////////////
+
+int st_render_load_bundle(st_render_t* r, const void* data, size_t size) {
+
+    if (!begin_render_call(r, "st_render_load_bundle")) {
+        return 0;
+    }
+
+    unload_passes();
+
+    // a program that won't link leaves nothing loaded
+    shader_errors_fatal = 0;
+
+    int ok = (stbundle_open_mem(&cur_shader->bundle, data, size, "bundle") &&
+              try_load(load_opened_bundle, "bundle") &&
+              start_loaded_shader() &&
+              !gl_error_seen);
+
+    shader_errors_fatal = 1;
+
+    if (!ok) {
+        unload_passes();
+    }
+
+    end_render_call();
+
+    return ok;
     
-    glfwMakeContextCurrent(window);
-#ifdef ST_GLFW_USE_GLEW
-    glewInit();
-#endif
-    glfwSwapInterval(profiling ? 0 : 1);
+}
+
+//////////////////////////////////////////////////////////////////////
+
+int st_render_frame(st_render_t* r, double time,
+                    unsigned char* pixels, size_t stride) {
+
+    if (!begin_render_call(r, "st_render_frame")) {
+        return 0;
+    }
+
+    if (!cur_shader->num_renderbuffers) {
+        end_render_call();
+        return 0;
+    }
+
+    u_time = time;
+
+    capture_next_frame = 1;
+    render(r->window);
+
+    copy_captured_frame(pixels, stride);
+
+    free(captured_pixels);
+    captured_pixels = NULL;
+
+    return end_render_call();
     
-    check_opengl_errors("after setting up glfw & glew");
+}
 
-    return window;
+//////////////////////////////////////////////////////////////////////
 
+void st_render_free(st_render_t* r) {
+
+    if (!r || !begin_render_call(r, "st_render_free")) { return; }
+
+    unload_passes();
+
+    end_render_call();
+
+    glfwDestroyWindow(r->window);
+    glfwTerminate();
+
+    free(r);
+    render_context = NULL;
+    
 }
 
 //////////////////////////////////////////////////////////////////////
-// main function
+// the whole command line tool; main.c just calls this
 
-int main(int argc, char** argv) {
+int st_glfw_main(int argc, char** argv) {
 
     // zero out all renderbuffers
-    memset(renderbuffers, 0, sizeof(renderbuffers));
+    init_shader(&main_shader);
+    memset(mosaic_tiles, 0, sizeof(mosaic_tiles));
+
+    startup_time = get_wallclock();
 
     // parse command line options
     get_options(argc, argv);
 
+    // images fetch and decode in the background from here on
+    start_images();
+
     GLFWwindow* window = setup_window();
 
-    for (int i=0; i<num_renderbuffers; ++i) {
-        renderbuffer_t* rb = renderbuffers + i;
-        setup_shaders(rb);
-        setup_array(rb);
-        setup_textures(rb);
+    if (!window) {
+        exit(1);
+    }
+    
+    log_startup("window created");
+
+    // packing needs the pixels to stay in client memory
+    if (!bundle_output) {
+        enable_pbo_uploads();
     }
 
+    setup_passes();
+    setup_context_objects();
+    
+    log_startup("shaders compiled");
+
     setup_uniforms();
+
+    finish_images();
+    log_startup("textures uploaded");
+
+    if (bundle_output) {
+        write_bundle(bundle_output);
+        glfwSetWindowShouldClose(window, GL_TRUE);
+    }
+
+    if (cur_shader->have_sound_pass) {
+        render_sound();
+    }
+
+    release_textures();
     
     reset();
 
+    if (num_sweep_keys) {
+        run_sweep(window);
+        glfwSetWindowShouldClose(window, GL_TRUE);
+    }
+
+    if (serve_path) {
+        run_server(window);
+        glfwSetWindowShouldClose(window, GL_TRUE);
+    }
+
+    if (num_playlist_entries) {
+        start_playlist(window);
+    }
+
     while (!glfwWindowShouldClose(window)) {
 
         if (animating || recording || need_render) {
@@ -2274,9 +6633,20 @@ int main(int argc, char** argv) {
         
         if (animating || recording) {
             glfwPollEvents();
+        } else if (watcher || num_playlist_entries) {
+            // wake up now and then to look for edits or move on
+            glfwWaitEventsTimeout(0.25);
         } else {
             glfwWaitEvents();
         }
+
+        if (watcher) {
+            reload_changed_sources();
+        }
+
+        if (num_playlist_entries && get_wallclock() >= playlist_switch_time) {
+            next_playlist_entry(window);
+        }
         
         if ((recording || profiling) && stop_at_frame == u_frame) {
             break;
@@ -2284,7 +6654,7 @@ int main(int argc, char** argv) {
         
     }
 
-    if (profiling) {
+    if (profiling && !num_sweep_keys) {
         float N = (stop_at_frame - startup_frames);
         float mean = total_delta / N;
         float std = sqrt(N*total_delta2 - total_delta*total_delta)/N;
@@ -2292,17 +6662,45 @@ int main(int argc, char** argv) {
                1e3*mean, 1e3*std);
     }
 
+    for (int k=0; k<cur_shader->num_video_channels; ++k) {
+        video_close(cur_shader->video_channels[k]->video);
+    }
+
+    watch_free(watcher);
+
+    finish_preload();
+
+    // the entry that was preloaded but never shown
+    if (preload_ok) {
+        shader_t* shown = cur_shader;
+        cur_shader = next_shader;
+        unload_passes();
+        cur_shader = shown;
+    }
+
+    if (preload_context) {
+        glfwDestroyWindow(preload_context);
+    }
+
+    if (decode_pool) {
+        tp_destroy(decode_pool);
+        decode_pool = NULL;
+    }
+
     glfwDestroyWindow(window);
     glfwTerminate();
 
     buf_free(&defines_buf);
-    buf_free(&common_buf);
-    buf_free(&json_buf);
+    buf_free(&cur_shader->common_buf);
+    buf_free(&cur_shader->json_buf);
+
+    www_cleanup();
 
-    for (int j=0; j<num_renderbuffers; ++j) {
+    for (int j=0; j<cur_shader->num_renderbuffers; ++j) {
         
-        renderbuffer_t* rb = renderbuffers + j;
+        renderbuffer_t* rb = cur_shader->renderbuffers + j;
         buf_free(&rb->shader_buf);
+        buf_free(&rb->specialized_buf);
         
         for (int i=0; i<NUM_CHANNELS; ++i) {
             
@@ -2312,8 +6710,12 @@ int main(int argc, char** argv) {
         }
         
     }
+
+    buf_free(&cur_shader->sound_pass.shader_buf);
     
-    if (json_root) { json_decref(json_root); }
+    if (cur_shader->json_root) { json_decref(cur_shader->json_root); }
+
+    stbundle_close(&cur_shader->bundle);
     
     return 0;
     
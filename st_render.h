@@ -0,0 +1,52 @@
+#ifndef _ST_RENDER_H_
+#define _ST_RENDER_H_
+
+#include <stddef.h>
+
+// Renders packed shaders (.stbundle files, see -pack) from inside
+// another program: load a bundle from memory, then draw frames at
+// whatever times you like straight into your own pixel buffers.
+//
+// Rendering happens in a hidden GLFW window on the calling thread.
+// Each context has its own loaded shader, but the window and timing
+// state is shared, so only one context can exist at a time. Short of
+// running out of memory, nothing here exits: failures, including GL
+// errors and passing a context other than the live one, print a
+// message to stderr and return NULL or 0.
+
+// the library is built with hidden visibility; only these are exported
+#ifdef __GNUC__
+#define ST_RENDER_API __attribute__((visibility("default")))
+#else
+#define ST_RENDER_API
+#endif
+
+typedef struct st_render st_render_t;
+
+// returns NULL if a context already exists or there's no GL
+ST_RENDER_API st_render_t* st_render_create(int width, int height);
+
+// size of the frames st_render_frame() draws, in pixels, which can be
+// bigger than asked for on high-DPI displays; 0x0 for a bad context
+ST_RENDER_API void st_render_get_size(const st_render_t* r, int* width, int* height);
+
+// replaces any shader loaded before; the bundle is used in place, so
+// data has to stay put (and 8-byte aligned) until the next load or
+// st_render_free(). Returns 0 if the bundle is bad or won't compile,
+// which leaves nothing loaded.
+ST_RENDER_API int st_render_load_bundle(st_render_t* r,
+                                        const void* data, size_t size);
+
+// draw the next frame with iTime set to time, into RGB pixels, rows
+// from the top down, stride bytes apart. iFrame counts up from 0
+// after each load. Returns 0 if nothing is loaded or drawing hit a GL
+// error.
+ST_RENDER_API int st_render_frame(st_render_t* r, double time,
+                                  unsigned char* pixels, size_t stride);
+
+ST_RENDER_API void st_render_free(st_render_t* r);
+
+// the whole st_glfw command line tool
+ST_RENDER_API int st_glfw_main(int argc, char** argv);
+
+#endif
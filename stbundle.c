@@ -0,0 +1,292 @@
+#include "stbundle.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+enum {
+    STBUNDLE_VERSION = 3,
+    STBUNDLE_BYTE_ORDER = 0x01020304,
+    STBUNDLE_PAGE_ALIGN = 4096,
+    STBUNDLE_ALIGN = 64
+};
+
+typedef struct stbundle_header {
+
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+
+    uint64_t num_sections;
+    uint64_t table_offset;
+
+} stbundle_header_t;
+
+//////////////////////////////////////////////////////////////////////
+
+size_t stbundle_align(size_t offset, size_t align) {
+    return (offset + align - 1) & ~(align - 1);
+}
+
+//////////////////////////////////////////////////////////////////////
+
+void stbundle_add(stbundle_writer_t* w,
+                  uint32_t type, uint32_t pass,
+                  uint32_t index, uint32_t param,
+                  const void* data, size_t size) {
+
+    if (w->num_sections == w->alloc) {
+
+        w->alloc = w->alloc ? 2*w->alloc : 32;
+
+        w->sections = (stbundle_section_t*)realloc(w->sections,
+                                                   w->alloc * sizeof(stbundle_section_t));
+        w->data = (const void**)realloc(w->data, w->alloc * sizeof(const void*));
+
+        if (!w->sections || !w->data) {
+            fprintf(stderr, "out of memory in stbundle_add!\n");
+            exit(1);
+        }
+
+    }
+
+    stbundle_section_t* s = w->sections + w->num_sections;
+    memset(s, 0, sizeof(stbundle_section_t));
+
+    s->type = type;
+    s->pass = pass;
+    s->index = index;
+    s->param = param;
+    s->size = size;
+
+    w->data[w->num_sections] = data;
+    ++w->num_sections;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+
+int stbundle_write(stbundle_writer_t* w, const char* filename) {
+
+    stbundle_header_t header;
+    memset(&header, 0, sizeof(header));
+
+    memcpy(header.magic, "STBUNDLE", 8);
+    header.version = STBUNDLE_VERSION;
+    header.byte_order = STBUNDLE_BYTE_ORDER;
+    header.num_sections = w->num_sections;
+    header.table_offset = sizeof(header);
+
+    size_t offset = header.table_offset + w->num_sections * sizeof(stbundle_section_t);
+
+    for (size_t i=0; i<w->num_sections; ++i) {
+        stbundle_section_t* s = w->sections + i;
+        size_t align = (s->type == STBUNDLE_SECTION_TEXTURE ?
+                        STBUNDLE_PAGE_ALIGN : STBUNDLE_ALIGN);
+        offset = stbundle_align(offset, align);
+        s->offset = offset;
+        offset += s->size;
+    }
+
+    size_t tmp_length = strlen(filename) + 8;
+    char tmp_path[tmp_length];
+    snprintf(tmp_path, tmp_length, "%s.tmp", filename);
+
+    FILE* fp = fopen(tmp_path, "wb");
+
+    if (!fp) {
+        fprintf(stderr, "error: can't write %s\n", tmp_path);
+        return 0;
+    }
+
+    int ok = (fwrite(&header, sizeof(header), 1, fp) == 1 &&
+              fwrite(w->sections, sizeof(stbundle_section_t),
+                     w->num_sections, fp) == w->num_sections);
+
+    char pad[STBUNDLE_PAGE_ALIGN];
+    memset(pad, 0, sizeof(pad));
+
+    size_t pos = header.table_offset + w->num_sections * sizeof(stbundle_section_t);
+
+    for (size_t i=0; ok && i<w->num_sections; ++i) {
+
+        const stbundle_section_t* s = w->sections + i;
+        size_t npad = s->offset - pos;
+
+        ok = (fwrite(pad, 1, npad, fp) == npad &&
+              fwrite(w->data[i], 1, s->size, fp) == s->size);
+
+        pos = s->offset + s->size;
+
+    }
+
+    if (fclose(fp) || !ok || rename(tmp_path, filename)) {
+        fprintf(stderr, "error writing %s\n", filename);
+        unlink(tmp_path);
+        return 0;
+    }
+
+    return 1;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+
+void stbundle_writer_free(stbundle_writer_t* w) {
+
+    free(w->sections);
+    free(w->data);
+    memset(w, 0, sizeof(stbundle_writer_t));
+
+}
+
+//////////////////////////////////////////////////////////////////////
+
+// checks the header and section table of the bundle in b->file,
+// returning 0 if they're bad
+int stbundle_check(stbundle_t* b, const char* filename) {
+
+    stbundle_header_t header;
+    size_t size = b->file.size;
+
+    if (size < sizeof(header)) {
+        fprintf(stderr, "error: %s is too small to be a bundle\n", filename);
+        return 0;
+    }
+
+    memcpy(&header, b->file.data, sizeof(header));
+
+    if (memcmp(header.magic, "STBUNDLE", 8)) {
+        fprintf(stderr, "error: %s is not a bundle\n", filename);
+        return 0;
+    }
+
+    if (header.version != STBUNDLE_VERSION ||
+        header.byte_order != STBUNDLE_BYTE_ORDER) {
+        fprintf(stderr, "error: %s was written by an incompatible version "
+                "or machine, please repack it\n", filename);
+        return 0;
+    }
+
+    if (header.table_offset % sizeof(uint64_t) ||
+        header.table_offset > size ||
+        header.num_sections > (size - header.table_offset) / sizeof(stbundle_section_t)) {
+        fprintf(stderr, "error: %s has a bad section table\n", filename);
+        return 0;
+    }
+
+    b->sections = (const stbundle_section_t*)(b->file.data + header.table_offset);
+    b->num_sections = header.num_sections;
+
+    for (size_t i=0; i<b->num_sections; ++i) {
+        const stbundle_section_t* s = b->sections + i;
+        if (s->offset > size || s->size > size - s->offset) {
+            fprintf(stderr, "error: %s is truncated\n", filename);
+            return 0;
+        }
+    }
+
+    return 1;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+
+void stbundle_open(stbundle_t* b, const char* filename) {
+
+    if (!stbundle_try_open(b, filename)) {
+        exit(1);
+    }
+
+}
+
+//////////////////////////////////////////////////////////////////////
+
+int stbundle_try_open(stbundle_t* b, const char* filename) {
+
+    memset(b, 0, sizeof(stbundle_t));
+
+    if (!buf_try_map_file(&b->file, filename)) {
+        return 0;
+    }
+
+    if (!stbundle_check(b, filename)) {
+        stbundle_close(b);
+        return 0;
+    }
+
+    return 1;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+
+int stbundle_open_mem(stbundle_t* b, const void* data, size_t size,
+                      const char* name) {
+
+    memset(b, 0, sizeof(stbundle_t));
+
+    // the section table gets read in place
+    if ((uintptr_t)data % sizeof(uint64_t)) {
+        fprintf(stderr, "error: %s must be 8-byte aligned in memory\n", name);
+        return 0;
+    }
+
+    buf_borrow(&b->file, data, size);
+
+    if (!stbundle_check(b, name)) {
+        stbundle_close(b);
+        return 0;
+    }
+
+    return 1;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+
+const stbundle_section_t* stbundle_find(const stbundle_t* b,
+                                        uint32_t type, uint32_t pass,
+                                        uint32_t index) {
+
+    for (size_t i=0; i<b->num_sections; ++i) {
+        const stbundle_section_t* s = b->sections + i;
+        if (s->type == type && s->pass == pass && s->index == index) {
+            return s;
+        }
+    }
+
+    return NULL;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+
+const void* stbundle_data(const stbundle_t* b,
+                          const stbundle_section_t* section) {
+
+    return b->file.data + section->offset;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+
+void stbundle_release_pages(stbundle_t* b) {
+
+    // borrowed memory isn't ours to drop
+    if (b->file.storage == BUF_STORAGE_MAPPED) {
+        madvise(b->file.data, b->file.size, MADV_DONTNEED);
+    }
+
+}
+
+//////////////////////////////////////////////////////////////////////
+
+void stbundle_close(stbundle_t* b) {
+
+    buf_free(&b->file);
+    memset(b, 0, sizeof(stbundle_t));
+
+}
@@ -0,0 +1,133 @@
+#ifndef _STBUNDLE_H_
+#define _STBUNDLE_H_
+
+#include <stdint.h>
+#include "buffer.h"
+
+// A .stbundle is a single file holding everything needed to start a
+// shader without parsing JSON, fetching anything or decoding images:
+// a header, a table of sections, then the section payloads. Textures
+// are page-aligned so they can be uploaded straight out of a
+// read-only mapping. Numbers are in host byte order, so bundles are
+// meant to be played back on the same kind of machine that built them.
+
+enum {
+    STBUNDLE_SECTION_INFO = 1,    // one stbundle_info_t
+    STBUNDLE_SECTION_PASS = 2,    // one stbundle_pass_t per pass
+    STBUNDLE_SECTION_SOURCE = 3,  // NUL-terminated source, index is slot
+    STBUNDLE_SECTION_TEXTURE = 4, // all faces and levels, index is channel
+    STBUNDLE_SECTION_PROGRAM = 5, // program binary, param is format
+};
+
+enum {
+    STBUNDLE_MAX_PASSES = 16,
+    STBUNDLE_NUM_CHANNELS = 4,
+    STBUNDLE_NAME_LENGTH = 64,
+    STBUNDLE_TITLE_LENGTH = 256
+};
+
+typedef struct stbundle_info {
+
+    char title[STBUNDLE_TITLE_LENGTH];
+
+    uint32_t num_passes;
+    uint32_t draw_order[STBUNDLE_MAX_PASSES];
+
+} stbundle_info_t;
+
+typedef struct stbundle_channel {
+
+    uint32_t ctype;
+    uint32_t target;
+    int32_t src_pass;
+
+    // another channel's texture is reused if shared_pass >= 0
+    int32_t shared_pass, shared_channel;
+
+    int32_t filter, srgb, vflip, wrap;
+
+    uint32_t channels, width, height, levels;
+    uint64_t size; // bytes per face, including all levels
+
+} stbundle_channel_t;
+
+typedef struct stbundle_pass {
+
+    char name[STBUNDLE_NAME_LENGTH];
+    uint32_t has_framebuffer;
+    uint32_t is_cubemap;
+
+    float resolution_scale; // 0 means full size
+    uint32_t reserved;
+
+    stbundle_channel_t channels[STBUNDLE_NUM_CHANNELS];
+
+} stbundle_pass_t;
+
+typedef struct stbundle_section {
+
+    uint32_t type, pass, index, param;
+    uint64_t offset, size;
+
+} stbundle_section_t;
+
+//////////////////////////////////////////////////////////////////////
+
+typedef struct stbundle_writer {
+
+    stbundle_section_t* sections;
+    const void** data;
+    size_t num_sections, alloc;
+
+} stbundle_writer_t;
+
+// sections just point at their data, which has to stay put until
+// stbundle_write() returns
+void stbundle_add(stbundle_writer_t* w,
+                  uint32_t type, uint32_t pass,
+                  uint32_t index, uint32_t param,
+                  const void* data, size_t size);
+
+// returns 1 on success
+int stbundle_write(stbundle_writer_t* w, const char* filename);
+
+void stbundle_writer_free(stbundle_writer_t* w);
+
+//////////////////////////////////////////////////////////////////////
+
+typedef struct stbundle {
+
+    buffer_t file;
+
+    const stbundle_section_t* sections;
+    size_t num_sections;
+
+} stbundle_t;
+
+// maps the bundle and checks its table of sections, exiting on error
+void stbundle_open(stbundle_t* b, const char* filename);
+
+// same, but returns 0 instead of exiting
+int stbundle_try_open(stbundle_t* b, const char* filename);
+
+// same, but for a bundle that's already in memory, which has to stay
+// put until stbundle_close(); name is just for error messages. Returns
+// 0 instead of exiting if the bundle is bad.
+int stbundle_open_mem(stbundle_t* b, const void* data, size_t size,
+                      const char* name);
+
+// returns NULL if there is no such section
+const stbundle_section_t* stbundle_find(const stbundle_t* b,
+                                        uint32_t type, uint32_t pass,
+                                        uint32_t index);
+
+const void* stbundle_data(const stbundle_t* b,
+                          const stbundle_section_t* section);
+
+// drop the mapping's resident pages; anything touched again afterwards
+// just faults back in from the file (does nothing for stbundle_open_mem)
+void stbundle_release_pages(stbundle_t* b);
+
+void stbundle_close(stbundle_t* b);
+
+#endif
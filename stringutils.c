@@ -16,8 +16,10 @@ const char* get_extension(const char* filename) {
 //////////////////////////////////////////////////////////////////////
 
 int lookup_enum(const enum_info_t* enums, const char* value) {
+
+    int i;
     
-    for (int i=0; enums[i].string; ++i) {
+    for (i=0; enums[i].string; ++i) {
 
         if (!strcmp(enums[i].string, value)) {
             return enums[i].value;
@@ -25,7 +27,6 @@ int lookup_enum(const enum_info_t* enums, const char* value) {
         
     }
 
-    fprintf(stderr, "error: no matching value for %s\n", value);
-    exit(1);
+    return enums[i].value;
     
 }
@@ -6,6 +6,8 @@ typedef struct enum_info {
     int value;
 } enum_info_t;
 
+// the list ends with a NULL string, whose value comes back if nothing
+// else matches
 int lookup_enum(const enum_info_t* enums, const char* value);
 
 
@@ -0,0 +1,379 @@
+#include "texcache.h"
+#include "image.h"
+#include "require.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+enum {
+    TEXCACHE_VERSION = 1,
+    TEXCACHE_ALIGN = 64,
+    TEXCACHE_MAX_PATH = 4096,
+    TEXCACHE_STALE_TMP_SECONDS = 60
+};
+
+typedef struct texcache_header {
+
+    char magic[4];
+    uint32_t version;
+    
+    uint32_t channels, width, height, levels;
+    uint64_t size;
+
+    uint32_t key_length;
+    uint32_t data_offset;
+    
+} texcache_header_t;
+
+char texcache_dir[TEXCACHE_MAX_PATH] = "";
+
+size_t texcache_max_size = 0;
+
+// protects texcache_total_size, which is just this process's estimate
+// between scans of the directory
+pthread_mutex_t texcache_mutex = PTHREAD_MUTEX_INITIALIZER;
+size_t texcache_total_size = 0;
+
+typedef struct texcache_file {
+
+    char name[32];
+    size_t size;
+    time_t mtime;
+    
+} texcache_file_t;
+
+//////////////////////////////////////////////////////////////////////
+
+uint64_t texcache_hash(const char* key) {
+
+    // FNV-1a
+    uint64_t h = 0xcbf29ce484222325ull;
+    
+    for ( ; *key; ++key) {
+        h ^= (unsigned char)*key;
+        h *= 0x100000001b3ull;
+    }
+
+    return h;
+    
+}
+
+//////////////////////////////////////////////////////////////////////
+
+void texcache_path(const char* key, char* path) {
+
+    snprintf(path, TEXCACHE_MAX_PATH, "%s/%016llx.sttex",
+             texcache_dir, (unsigned long long)texcache_hash(key));
+    
+}
+
+//////////////////////////////////////////////////////////////////////
+
+int make_dirs(char* path) {
+
+    for (char* p=path+1; *p; ++p) {
+        if (*p == '/') {
+            *p = 0;
+            int rval = mkdir(path, 0755);
+            *p = '/';
+            if (rval && errno != EEXIST) { return 0; }
+        }
+    }
+
+    return !mkdir(path, 0755) || errno == EEXIST;
+    
+}
+
+//////////////////////////////////////////////////////////////////////
+
+int compare_mtimes(const void* a, const void* b) {
+
+    time_t ta = ((const texcache_file_t*)a)->mtime;
+    time_t tb = ((const texcache_file_t*)b)->mtime;
+
+    return (ta > tb) - (ta < tb);
+    
+}
+
+//////////////////////////////////////////////////////////////////////
+// rescan the directory to total up the entries, and if they're over
+// the limit, delete the least recently used ones until there's a
+// quarter of it free, so that the next few stores don't rescan.
+// Temporary files left behind by a writer that died are deleted too.
+// Called with texcache_mutex held.
+
+void texcache_prune() {
+
+    time_t now = time(NULL);
+
+    DIR* d = opendir(texcache_dir);
+    if (!d) { return; }
+
+    texcache_file_t* files = NULL;
+    size_t num_files = 0, alloc = 0;
+
+    size_t total = 0;
+
+    struct dirent* ent;
+
+    while ((ent = readdir(d))) {
+
+        const char* name = ent->d_name;
+        size_t length = strlen(name);
+
+        if (length > 4 && !strcmp(name + length - 4, ".tmp") &&
+            strstr(name, ".sttex.")) {
+
+            char path[TEXCACHE_MAX_PATH];
+            snprintf(path, sizeof(path), "%s/%s", texcache_dir, name);
+
+            struct stat sb;
+            if (!stat(path, &sb) &&
+                sb.st_mtime + TEXCACHE_STALE_TMP_SECONDS < now) {
+                unlink(path);
+            }
+
+            continue;
+            
+        }
+
+        if (length < 6 || length >= sizeof(files->name) ||
+            strcmp(name + length - 6, ".sttex")) {
+            continue;
+        }
+
+        char path[TEXCACHE_MAX_PATH];
+        snprintf(path, sizeof(path), "%s/%s", texcache_dir, name);
+
+        struct stat sb;
+        if (stat(path, &sb)) { continue; }
+
+        if (num_files == alloc) {
+            alloc = alloc ? 2*alloc : 256;
+            texcache_file_t* grown = (texcache_file_t*)realloc(
+                files, alloc * sizeof(texcache_file_t));
+            if (!grown) { break; }
+            files = grown;
+        }
+
+        texcache_file_t* f = files + num_files++;
+        
+        strcpy(f->name, name);
+        f->size = sb.st_size;
+        f->mtime = sb.st_mtime;
+
+        total += f->size;
+        
+    }
+
+    closedir(d);
+
+    if (texcache_max_size && total > texcache_max_size) {
+
+        qsort(files, num_files, sizeof(texcache_file_t), compare_mtimes);
+
+        size_t target = texcache_max_size / 4 * 3;
+
+        for (size_t i=0; i<num_files && total > target; ++i) {
+
+            char path[TEXCACHE_MAX_PATH];
+            snprintf(path, sizeof(path), "%s/%s", texcache_dir, files[i].name);
+
+            if (!unlink(path)) {
+                total -= files[i].size;
+            }
+            
+        }
+        
+    }
+
+    texcache_total_size = total;
+
+    free(files);
+    
+}
+
+//////////////////////////////////////////////////////////////////////
+
+void texcache_init(const char* dir, size_t max_size) {
+
+    texcache_dir[0] = 0;
+    texcache_max_size = max_size;
+
+    if (!dir) { return; }
+
+    if (strlen(dir) + 32 >= TEXCACHE_MAX_PATH) {
+        fprintf(stderr, "warning: texture cache path too long, not caching\n");
+        return;
+    }
+
+    strcpy(texcache_dir, dir);
+
+    if (!make_dirs(texcache_dir)) {
+        fprintf(stderr, "warning: can't create texture cache %s, not caching\n",
+                texcache_dir);
+        texcache_dir[0] = 0;
+        return;
+    }
+
+    pthread_mutex_lock(&texcache_mutex);
+    texcache_prune();
+    pthread_mutex_unlock(&texcache_mutex);
+    
+}
+
+//////////////////////////////////////////////////////////////////////
+
+int texcache_enabled() {
+    return texcache_dir[0] != 0;
+}
+
+//////////////////////////////////////////////////////////////////////
+
+int texcache_load(const char* key, texcache_entry_t* entry) {
+
+    memset(entry, 0, sizeof(texcache_entry_t));
+
+    if (!texcache_enabled()) { return 0; }
+
+    char path[TEXCACHE_MAX_PATH];
+    texcache_path(key, path);
+
+    struct stat sb;
+    if (stat(path, &sb) || (size_t)sb.st_size < sizeof(texcache_header_t)) {
+        return 0;
+    }
+
+    if (!buf_try_map_file(&entry->file, path)) { return 0; }
+    
+    texcache_header_t header;
+    memcpy(&header, entry->file.data, sizeof(header));
+
+    size_t key_length = strlen(key);
+
+    if (memcmp(header.magic, "STTX", 4) ||
+        header.version != TEXCACHE_VERSION ||
+        header.key_length != key_length ||
+        sizeof(header) + key_length > entry->file.size ||
+        memcmp(entry->file.data + sizeof(header), key, key_length) ||
+        header.data_offset + header.size != entry->file.size ||
+        header.channels < 1 || header.channels > 4 ||
+        !header.width || !header.height || header.levels < 1 ||
+        header.levels > get_mip_levels(header.width, header.height) ||
+        header.size != get_mip_chain_size(header.width, header.height,
+                                          header.channels, header.levels)) {
+
+        // stale, colliding or corrupt entry, it'll get overwritten
+        texcache_free(entry);
+        return 0;
+        
+    }
+
+    entry->channels = header.channels;
+    entry->width = header.width;
+    entry->height = header.height;
+    entry->levels = header.levels;
+    entry->size = header.size;
+    entry->data = (const unsigned char*)entry->file.data + header.data_offset;
+
+    // mark it recently used so pruning keeps it
+    utimensat(AT_FDCWD, path, NULL, 0);
+
+    return 1;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+
+void texcache_free(texcache_entry_t* entry) {
+
+    buf_free(&entry->file);
+    memset(entry, 0, sizeof(texcache_entry_t));
+    
+}
+
+//////////////////////////////////////////////////////////////////////
+
+void texcache_store(const char* key,
+                    size_t channels, size_t width, size_t height,
+                    size_t levels,
+                    const void* data, size_t size) {
+
+    if (!texcache_enabled()) { return; }
+
+    char path[TEXCACHE_MAX_PATH], tmp_path[TEXCACHE_MAX_PATH+64];
+    texcache_path(key, path);
+
+    // write under a unique name and rename into place so concurrent
+    // readers and writers never see a partial file
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%d.%lx.tmp", path,
+             (int)getpid(), (unsigned long)pthread_self());
+
+    size_t key_length = strlen(key);
+    size_t header_size = sizeof(texcache_header_t) + key_length;
+    size_t data_offset = (header_size + TEXCACHE_ALIGN - 1) & ~(size_t)(TEXCACHE_ALIGN - 1);
+
+    texcache_header_t header;
+    memset(&header, 0, sizeof(header));
+
+    memcpy(header.magic, "STTX", 4);
+    header.version = TEXCACHE_VERSION;
+    header.channels = channels;
+    header.width = width;
+    header.height = height;
+    header.levels = levels;
+    header.size = size;
+    header.key_length = key_length;
+    header.data_offset = data_offset;
+
+    FILE* fp = fopen(tmp_path, "wb");
+    
+    if (!fp) {
+        fprintf(stderr, "warning: can't write %s\n", tmp_path);
+        return;
+    }
+
+    char pad[TEXCACHE_ALIGN];
+    memset(pad, 0, sizeof(pad));
+
+    int ok = (fwrite(&header, sizeof(header), 1, fp) == 1 &&
+              fwrite(key, 1, key_length, fp) == key_length &&
+              fwrite(pad, 1, data_offset - header_size, fp) == data_offset - header_size &&
+              fwrite(data, 1, size, fp) == size);
+
+    // an entry being replaced is already counted
+    struct stat sb;
+    size_t replaced_size = stat(path, &sb) ? 0 : sb.st_size;
+
+    if (fclose(fp) || !ok || rename(tmp_path, path)) {
+        fprintf(stderr, "warning: error writing texture cache entry %s\n", path);
+        unlink(tmp_path);
+        return;
+    }
+
+    pthread_mutex_lock(&texcache_mutex);
+
+    texcache_total_size += data_offset + size;
+    
+    if (texcache_total_size > replaced_size) {
+        texcache_total_size -= replaced_size;
+    } else {
+        texcache_total_size = 0;
+    }
+
+    if (texcache_max_size && texcache_total_size > texcache_max_size) {
+        texcache_prune();
+    }
+
+    pthread_mutex_unlock(&texcache_mutex);
+
+}
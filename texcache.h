@@ -0,0 +1,41 @@
+#ifndef _TEXCACHE_H_
+#define _TEXCACHE_H_
+
+#include "buffer.h"
+
+// On-disk cache of decoded textures (one image or cubemap face each,
+// including any mip levels) so that later runs can skip fetching and
+// decoding entirely. Entries are looked up by an arbitrary key string
+// which should capture everything that affects the decoded pixels.
+// Each hit bumps the entry's mtime, and once the cache grows past its
+// size limit the least recently used entries get deleted.
+
+typedef struct texcache_entry {
+
+    size_t channels, width, height, levels;
+
+    const unsigned char* data;
+    size_t size;
+
+    buffer_t file;
+    
+} texcache_entry_t;
+
+// set the cache directory (creating it if needed), or NULL to disable;
+// max_size is in bytes, 0 for no limit
+void texcache_init(const char* dir, size_t max_size);
+
+int texcache_enabled();
+
+// returns 1 and fills in entry on a hit, 0 otherwise
+int texcache_load(const char* key, texcache_entry_t* entry);
+
+void texcache_free(texcache_entry_t* entry);
+
+// safe to call from multiple threads at once
+void texcache_store(const char* key,
+                    size_t channels, size_t width, size_t height,
+                    size_t levels,
+                    const void* data, size_t size);
+
+#endif
@@ -0,0 +1,172 @@
+#include "threadpool.h"
+#include "require.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+typedef struct tp_job {
+
+    tp_func_t func;
+    void* arg;
+    struct tp_job* next;
+    
+} tp_job_t;
+
+struct threadpool {
+
+    pthread_mutex_t mutex;
+    pthread_cond_t job_available;
+    pthread_cond_t all_done;
+
+    tp_job_t* head;
+    tp_job_t* tail;
+
+    int pending; // queued or running
+    int shutdown;
+
+    int nthreads;
+    pthread_t* threads;
+    
+};
+
+//////////////////////////////////////////////////////////////////////
+
+int tp_num_cpus() {
+
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+    
+}
+
+//////////////////////////////////////////////////////////////////////
+
+void* tp_worker(void* p) {
+
+    threadpool_t* pool = (threadpool_t*)p;
+
+    pthread_mutex_lock(&pool->mutex);
+
+    while (1) {
+
+        while (!pool->head && !pool->shutdown) {
+            pthread_cond_wait(&pool->job_available, &pool->mutex);
+        }
+
+        if (!pool->head) { break; }
+
+        tp_job_t* job = pool->head;
+        pool->head = job->next;
+        if (!pool->head) { pool->tail = NULL; }
+
+        pthread_mutex_unlock(&pool->mutex);
+
+        job->func(job->arg);
+        free(job);
+
+        pthread_mutex_lock(&pool->mutex);
+
+        if (--pool->pending == 0) {
+            pthread_cond_broadcast(&pool->all_done);
+        }
+        
+    }
+
+    pthread_mutex_unlock(&pool->mutex);
+
+    return NULL;
+    
+}
+
+//////////////////////////////////////////////////////////////////////
+
+threadpool_t* tp_create(int nthreads) {
+
+    if (nthreads <= 0) { nthreads = tp_num_cpus(); }
+
+    threadpool_t* pool = calloc(1, sizeof(threadpool_t));
+    require(pool);
+
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->job_available, NULL);
+    pthread_cond_init(&pool->all_done, NULL);
+
+    pool->nthreads = nthreads;
+    pool->threads = malloc(nthreads * sizeof(pthread_t));
+    require(pool->threads);
+
+    for (int i=0; i<nthreads; ++i) {
+        if (pthread_create(pool->threads + i, NULL, tp_worker, pool)) {
+            fprintf(stderr, "error creating worker thread!\n");
+            exit(1);
+        }
+    }
+
+    return pool;
+    
+}
+
+//////////////////////////////////////////////////////////////////////
+
+void tp_submit(threadpool_t* pool, tp_func_t func, void* arg) {
+
+    tp_job_t* job = malloc(sizeof(tp_job_t));
+    require(job);
+
+    job->func = func;
+    job->arg = arg;
+    job->next = NULL;
+
+    pthread_mutex_lock(&pool->mutex);
+
+    if (pool->tail) {
+        pool->tail->next = job;
+    } else {
+        pool->head = job;
+    }
+    
+    pool->tail = job;
+    ++pool->pending;
+
+    pthread_cond_signal(&pool->job_available);
+    pthread_mutex_unlock(&pool->mutex);
+    
+}
+
+//////////////////////////////////////////////////////////////////////
+
+void tp_wait(threadpool_t* pool) {
+
+    pthread_mutex_lock(&pool->mutex);
+    
+    while (pool->pending) {
+        pthread_cond_wait(&pool->all_done, &pool->mutex);
+    }
+    
+    pthread_mutex_unlock(&pool->mutex);
+    
+}
+
+//////////////////////////////////////////////////////////////////////
+
+void tp_destroy(threadpool_t* pool) {
+
+    tp_wait(pool);
+
+    pthread_mutex_lock(&pool->mutex);
+    pool->shutdown = 1;
+    pthread_cond_broadcast(&pool->job_available);
+    pthread_mutex_unlock(&pool->mutex);
+
+    for (int i=0; i<pool->nthreads; ++i) {
+        pthread_join(pool->threads[i], NULL);
+    }
+
+    pthread_mutex_destroy(&pool->mutex);
+    pthread_cond_destroy(&pool->job_available);
+    pthread_cond_destroy(&pool->all_done);
+
+    free(pool->threads);
+    free(pool);
+    
+}
@@ -0,0 +1,22 @@
+#ifndef _THREADPOOL_H_
+#define _THREADPOOL_H_
+
+typedef void (*tp_func_t)(void* arg);
+
+typedef struct threadpool threadpool_t;
+
+// create a pool with nthreads workers (0 means one per CPU)
+threadpool_t* tp_create(int nthreads);
+
+// queue func(arg) to run on some worker thread
+void tp_submit(threadpool_t* pool, tp_func_t func, void* arg);
+
+// block until every job submitted so far has finished
+void tp_wait(threadpool_t* pool);
+
+// wait for outstanding jobs, then join and free all workers
+void tp_destroy(threadpool_t* pool);
+
+int tp_num_cpus();
+
+#endif
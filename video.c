@@ -0,0 +1,649 @@
+#include "video.h"
+#include "image.h"
+#include "buffer.h"
+#include "require.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+enum {
+    VIDEO_Y4M = 1,
+    VIDEO_SEQUENCE = 2,
+    VIDEO_MAX_PATH = 4096
+};
+
+enum {
+    Y4M_CHROMA_420 = 0,
+    Y4M_CHROMA_444 = 1,
+    Y4M_CHROMA_MONO = 2
+};
+
+enum {
+    SLOT_EMPTY = 0,    // no memory, or the caller has it
+    SLOT_FREE = 1,     // ready to decode into
+    SLOT_DECODING = 2,
+    SLOT_READY = 3,
+    SLOT_FAILED = 4    // decoding went wrong, see video_acquire()
+};
+
+typedef struct video_slot {
+
+    unsigned char* data;
+    long seq;
+    int state;
+
+} video_slot_t;
+
+struct video {
+
+    int kind;
+    video_info_t info;
+    int vflip, max_size;
+
+    // y4m
+    buffer_t file;
+    size_t* frame_offsets;
+    int chroma;
+    int full_range;
+
+    // y4m frames bigger than max_size get converted at full size into
+    // scratch, then box filtered down by factor
+    size_t src_width, src_height, factor;
+    unsigned char* scratch;
+
+    // image sequence
+    char pattern[VIDEO_MAX_PATH];
+    int first_index;
+
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    int quit;
+
+    video_slot_t slots[VIDEO_MAX_SLOTS];
+    int num_slots;
+
+    // earliest sequence number still wanted
+    long position;
+
+};
+
+//////////////////////////////////////////////////////////////////////
+// returns 0 after printing a message if the file is malformed
+
+int y4m_open(video_t* video, const char* filename) {
+
+    if (!buf_try_map_file(&video->file, filename)) {
+        return 0;
+    }
+
+    const char* data = video->file.data;
+    size_t size = video->file.size;
+
+    const char* magic = "YUV4MPEG2 ";
+
+    if (size < strlen(magic) || memcmp(data, magic, strlen(magic))) {
+        fprintf(stderr, "error: %s is not a YUV4MPEG2 file\n", filename);
+        return 0;
+    }
+
+    const char* end = memchr(data, '\n', size);
+
+    if (!end) {
+        fprintf(stderr, "error: bad header in %s\n", filename);
+        return 0;
+    }
+
+    int fps_num = 0, fps_den = 0;
+    int width = 0, height = 0;
+
+    video->chroma = Y4M_CHROMA_420;
+
+    const char* p = data + strlen(magic);
+
+    while (p < end) {
+
+        const char* token_end = p;
+        while (token_end < end && *token_end != ' ') { ++token_end; }
+
+        char token[256];
+        int length = token_end - p;
+        if (length >= (int)sizeof(token)) { length = sizeof(token)-1; }
+
+        memcpy(token, p, length);
+        token[length] = 0;
+
+        switch (token[0]) {
+        case 'W':
+            width = atoi(token+1);
+            break;
+        case 'H':
+            height = atoi(token+1);
+            break;
+        case 'F':
+            sscanf(token+1, "%d:%d", &fps_num, &fps_den);
+            break;
+        case 'C':
+            if (!strncmp(token+1, "420", 3)) {
+                video->chroma = Y4M_CHROMA_420;
+            } else if (!strncmp(token+1, "444", 3) && !token[4]) {
+                video->chroma = Y4M_CHROMA_444;
+            } else if (!strcmp(token+1, "mono")) {
+                video->chroma = Y4M_CHROMA_MONO;
+            } else {
+                fprintf(stderr, "error: unsupported colorspace %s in %s\n",
+                        token+1, filename);
+                return 0;
+            }
+            break;
+        case 'X':
+            if (!strcmp(token+1, "COLORRANGE=FULL")) {
+                video->full_range = 1;
+            }
+            break;
+        default:
+            break;
+        }
+
+        p = token_end + 1;
+
+    }
+
+    if (width <= 0 || height <= 0) {
+        fprintf(stderr, "error: missing size in %s\n", filename);
+        return 0;
+    }
+
+    size_t luma_size = (size_t)width * height;
+    size_t chroma_size = 0;
+
+    if (video->chroma == Y4M_CHROMA_420) {
+        chroma_size = 2 * (size_t)((width+1)/2) * ((height+1)/2);
+    } else if (video->chroma == Y4M_CHROMA_444) {
+        chroma_size = 2 * luma_size;
+    }
+
+    size_t frame_bytes = luma_size + chroma_size;
+
+    video->info.channels = (video->chroma == Y4M_CHROMA_MONO) ? 1 : 3;
+
+    video->src_width = width;
+    video->src_height = height;
+    video->factor = (size_t)1 << get_reduction(width, height, video->max_size);
+
+    get_downsampled_size(width, height, video->factor,
+                         &video->info.width, &video->info.height);
+    
+    video->info.frame_size = (video->info.width * video->info.height *
+                              video->info.channels);
+
+    if (video->factor > 1) {
+        video->scratch = (unsigned char*)malloc(luma_size * video->info.channels);
+        if (!video->scratch) {
+            fprintf(stderr, "out of memory opening %s\n", filename);
+            exit(1);
+        }
+    }
+
+    video->info.fps = (fps_num > 0 && fps_den > 0) ? (double)fps_num / fps_den : 30.0;
+
+    // index the frames, which may each have their own parameters
+    size_t alloc = 0;
+    size_t pos = end - data + 1;
+
+    while (pos + 5 < size && !memcmp(data + pos, "FRAME", 5)) {
+
+        const char* nl = memchr(data + pos, '\n', size - pos);
+        if (!nl) { break; }
+
+        size_t offset = nl - data + 1;
+        if (frame_bytes > size - offset) { break; }
+
+        if ((size_t)video->info.num_frames == alloc) {
+            alloc = alloc ? 2*alloc : 256;
+            video->frame_offsets = (size_t*)realloc(video->frame_offsets,
+                                                    alloc * sizeof(size_t));
+            if (!video->frame_offsets) {
+                fprintf(stderr, "out of memory indexing %s\n", filename);
+                exit(1);
+            }
+        }
+
+        video->frame_offsets[video->info.num_frames++] = offset;
+        pos = offset + frame_bytes;
+
+    }
+
+    return 1;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+
+unsigned char video_clamp(int x) {
+    return x < 0 ? 0 : x > 255 ? 255 : x;
+}
+
+//////////////////////////////////////////////////////////////////////
+// BT.601, fixed point with 8 fractional bits
+
+int y4m_decode(const video_t* video, int frame, unsigned char* dst) {
+
+    const video_info_t* info = &video->info;
+
+    size_t width = video->src_width, height = video->src_height;
+
+    unsigned char* pixels = (video->factor > 1) ? video->scratch : dst;
+    size_t chroma_width = width, chroma_shift = 0;
+
+    if (video->chroma == Y4M_CHROMA_420) {
+        chroma_width = (width+1)/2;
+        chroma_shift = 1;
+    }
+
+    size_t chroma_height = (height + chroma_shift) >> chroma_shift;
+
+    const unsigned char* y_plane = ((const unsigned char*)video->file.data +
+                                    video->frame_offsets[frame]);
+    const unsigned char* u_plane = y_plane + width*height;
+    const unsigned char* v_plane = u_plane + chroma_width*chroma_height;
+
+    int y_offset = 16, ky = 298, krv = 409, kgu = 100, kgv = 208, kbu = 516;
+
+    if (video->full_range) {
+        y_offset = 0; ky = 256; krv = 359; kgu = 88; kgv = 183; kbu = 454;
+    }
+
+    size_t stride = width * info->channels;
+    ptrdiff_t row_delta = stride;
+    unsigned char* row = pixels;
+
+    if (video->vflip) {
+        row = pixels + (height-1)*stride;
+        row_delta = -(ptrdiff_t)stride;
+    }
+
+    for (size_t i=0; i<height; ++i, row += row_delta) {
+
+        const unsigned char* ysrc = y_plane + i*width;
+
+        if (video->chroma == Y4M_CHROMA_MONO) {
+            for (size_t j=0; j<width; ++j) {
+                row[j] = video_clamp((ky*(ysrc[j] - y_offset) + 128) >> 8);
+            }
+            continue;
+        }
+
+        const unsigned char* usrc = u_plane + (i >> chroma_shift)*chroma_width;
+        const unsigned char* vsrc = v_plane + (i >> chroma_shift)*chroma_width;
+
+        unsigned char* out = row;
+
+        for (size_t j=0; j<width; ++j, out += 3) {
+
+            int c = ky * (ysrc[j] - y_offset);
+            int d = usrc[j >> chroma_shift] - 128;
+            int e = vsrc[j >> chroma_shift] - 128;
+
+            out[0] = video_clamp((c + krv*e + 128) >> 8);
+            out[1] = video_clamp((c - kgu*d - kgv*e + 128) >> 8);
+            out[2] = video_clamp((c + kbu*d + 128) >> 8);
+
+        }
+
+    }
+
+    if (video->factor > 1) {
+        downsample(pixels, width, height, info->channels, video->factor, dst);
+    }
+
+    return 1;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+
+void sequence_path(const video_t* video, int index, char* path) {
+    snprintf(path, VIDEO_MAX_PATH, video->pattern, index);
+}
+
+//////////////////////////////////////////////////////////////////////
+
+int video_file_exists(const char* path) {
+    struct stat sb;
+    return stat(path, &sb) == 0;
+}
+
+//////////////////////////////////////////////////////////////////////
+// returns 0 after printing a message if there are no usable frames
+
+int sequence_open(video_t* video, const char* pattern) {
+
+    if (strlen(pattern) >= VIDEO_MAX_PATH) {
+        fprintf(stderr, "error: filename too long!\n");
+        return 0;
+    }
+
+    strcpy(video->pattern, pattern);
+
+    char path[VIDEO_MAX_PATH];
+
+    // numbering may start at either 0 or 1
+    video->first_index = 0;
+    sequence_path(video, 0, path);
+
+    if (!video_file_exists(path)) {
+        video->first_index = 1;
+        sequence_path(video, 1, path);
+    }
+
+    while (video_file_exists(path)) {
+        ++video->info.num_frames;
+        sequence_path(video, video->first_index + video->info.num_frames, path);
+    }
+
+    if (!video->info.num_frames) {
+        fprintf(stderr, "error: no frames found for %s\n", pattern);
+        return 0;
+    }
+
+    sequence_path(video, video->first_index, path);
+
+    buffer_t raw = { 0, 0, 0, 0 };
+    image_info_t image_info;
+
+    if (!buf_try_map_file(&raw, path)) {
+        return 0;
+    }
+    
+    int ok = try_read_image(&raw, get_image_type(path), video->vflip,
+                            video->max_size, &image_info, NULL);
+    buf_free(&raw);
+
+    if (!ok) { return 0; }
+
+    video->info.channels = image_info.channels;
+    video->info.width = image_info.width;
+    video->info.height = image_info.height;
+    video->info.frame_size = image_info.size;
+
+    return 1;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+
+// returns 0 after printing a message if the frame is missing, broken
+// or a different size from the first one
+
+int sequence_decode(const video_t* video, int frame, unsigned char* dst) {
+
+    char path[VIDEO_MAX_PATH];
+    sequence_path(video, video->first_index + frame, path);
+
+    buffer_t raw = { 0, 0, 0, 0 };
+    image_info_t image_info;
+
+    int type = get_image_type(path);
+
+    if (!buf_try_map_file(&raw, path)) {
+        return 0;
+    }
+
+    int ok = try_read_image(&raw, type, video->vflip, video->max_size,
+                            &image_info, NULL);
+
+    if (ok && (image_info.channels != video->info.channels ||
+               image_info.width != video->info.width ||
+               image_info.height != video->info.height)) {
+        fprintf(stderr, "error: frame %s doesn't match the first frame\n", path);
+        ok = 0;
+    }
+
+    if (ok) {
+        ok = try_read_image(&raw, type, video->vflip, video->max_size,
+                            &image_info, dst);
+    }
+
+    buf_free(&raw);
+
+    return ok;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+
+int video_has_seq(const video_t* video, long seq) {
+
+    for (int i=0; i<video->num_slots; ++i) {
+        const video_slot_t* slot = video->slots + i;
+        if ((slot->state == SLOT_DECODING || slot->state == SLOT_READY ||
+             slot->state == SLOT_FAILED) && slot->seq == seq) {
+            return 1;
+        }
+    }
+
+    return 0;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+
+void* video_thread(void* arg) {
+
+    video_t* video = (video_t*)arg;
+
+    pthread_mutex_lock(&video->mutex);
+
+    while (!video->quit) {
+
+        long first = video->position;
+        long last = first + video->num_slots;
+
+        // recycle frames that playback has moved past or jumped away from
+        for (int i=0; i<video->num_slots; ++i) {
+            video_slot_t* slot = video->slots + i;
+            if ((slot->state == SLOT_READY || slot->state == SLOT_FAILED) &&
+                (slot->seq < first || slot->seq >= last)) {
+                slot->state = SLOT_FREE;
+            }
+        }
+
+        long next = -1;
+
+        for (long seq=first; seq<last; ++seq) {
+            if (!video_has_seq(video, seq)) {
+                next = seq;
+                break;
+            }
+        }
+
+        video_slot_t* slot = NULL;
+
+        for (int i=0; i<video->num_slots && next >= 0; ++i) {
+            if (video->slots[i].state == SLOT_FREE) {
+                slot = video->slots + i;
+                break;
+            }
+        }
+
+        if (!slot) {
+            pthread_cond_wait(&video->cond, &video->mutex);
+            continue;
+        }
+
+        slot->state = SLOT_DECODING;
+        slot->seq = next;
+
+        int frame = next % video->info.num_frames;
+
+        pthread_mutex_unlock(&video->mutex);
+
+        int ok;
+
+        if (video->kind == VIDEO_Y4M) {
+            ok = y4m_decode(video, frame, slot->data);
+        } else {
+            ok = sequence_decode(video, frame, slot->data);
+        }
+
+        pthread_mutex_lock(&video->mutex);
+
+        slot->state = ok ? SLOT_READY : SLOT_FAILED;
+        pthread_cond_broadcast(&video->cond);
+
+    }
+
+    pthread_mutex_unlock(&video->mutex);
+
+    return NULL;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+
+video_t* video_open(const char* src, double fps,
+                    int vflip, int max_size,
+                    int num_slots, video_info_t* info) {
+
+    require(num_slots >= 2 && num_slots <= VIDEO_MAX_SLOTS);
+
+    video_t* video = (video_t*)calloc(1, sizeof(video_t));
+
+    if (!video) {
+        fprintf(stderr, "out of memory opening %s\n", src);
+        exit(1);
+    }
+
+    video->vflip = vflip;
+    video->max_size = max_size;
+    video->num_slots = num_slots;
+
+    const char* dot = strrchr(src, '.');
+    int ok = 0;
+
+    if (dot && !strcasecmp(dot, ".y4m")) {
+        video->kind = VIDEO_Y4M;
+        ok = y4m_open(video, src);
+    } else if (strchr(src, '%')) {
+        video->kind = VIDEO_SEQUENCE;
+        video->info.fps = fps;
+        ok = sequence_open(video, src);
+    } else {
+        fprintf(stderr, "error: video %s should be a .y4m file or "
+                "an image sequence pattern like frame%%04d.png\n", src);
+    }
+
+    if (ok && !video->info.num_frames) {
+        fprintf(stderr, "error: no frames in %s\n", src);
+        ok = 0;
+    }
+
+    if (!ok) {
+        buf_free(&video->file);
+        free(video->frame_offsets);
+        free(video->scratch);
+        free(video);
+        return NULL;
+    }
+
+    printf("video %s is %dx%d with %d frames at %.2f fps\n", src,
+           (int)video->info.width, (int)video->info.height,
+           video->info.num_frames, video->info.fps);
+
+    pthread_mutex_init(&video->mutex, NULL);
+    pthread_cond_init(&video->cond, NULL);
+
+    if (pthread_create(&video->thread, NULL, video_thread, video)) {
+        fprintf(stderr, "error creating video thread!\n");
+        exit(1);
+    }
+
+    *info = video->info;
+
+    return video;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+
+void video_provide_slot(video_t* video, int slot, unsigned char* data) {
+
+    require(slot >= 0 && slot < video->num_slots);
+
+    pthread_mutex_lock(&video->mutex);
+
+    video->slots[slot].data = data;
+    video->slots[slot].state = SLOT_FREE;
+
+    pthread_cond_broadcast(&video->cond);
+    pthread_mutex_unlock(&video->mutex);
+
+}
+
+//////////////////////////////////////////////////////////////////////
+
+int video_acquire(video_t* video, long seq, int wait) {
+
+    pthread_mutex_lock(&video->mutex);
+
+    if (video->position != seq) {
+        video->position = seq;
+        pthread_cond_broadcast(&video->cond);
+    }
+
+    int found = -1;
+
+    while (1) {
+
+        for (int i=0; i<video->num_slots; ++i) {
+            video_slot_t* slot = video->slots + i;
+            if (slot->seq != seq) { continue; }
+            if (slot->state == SLOT_READY) {
+                slot->state = SLOT_EMPTY;
+                found = i;
+                break;
+            } else if (slot->state == SLOT_FAILED) {
+                // stays with the decoder, which reuses it once playback
+                // moves on
+                found = VIDEO_FRAME_FAILED;
+                break;
+            }
+        }
+
+        if (found != -1 || !wait) { break; }
+
+        pthread_cond_wait(&video->cond, &video->mutex);
+
+    }
+
+    pthread_mutex_unlock(&video->mutex);
+
+    return found;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+
+void video_close(video_t* video) {
+
+    pthread_mutex_lock(&video->mutex);
+    video->quit = 1;
+    pthread_cond_broadcast(&video->cond);
+    pthread_mutex_unlock(&video->mutex);
+
+    pthread_join(video->thread, NULL);
+
+    pthread_mutex_destroy(&video->mutex);
+    pthread_cond_destroy(&video->cond);
+
+    buf_free(&video->file);
+    free(video->frame_offsets);
+    free(video->scratch);
+    free(video);
+
+}
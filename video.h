@@ -0,0 +1,52 @@
+#ifndef _VIDEO_H_
+#define _VIDEO_H_
+
+#include <stddef.h>
+
+// Local video sources for texture channels: either an uncompressed
+// YUV4MPEG2 (.y4m) file or a numbered image sequence given as a
+// printf-style pattern such as "frames/%04d.png".
+//
+// A background thread decodes ahead of playback into a small ring of
+// slots. The memory for each slot is handed in by the caller (e.g. a
+// mapped pixel unpack buffer), taken back by video_acquire(), and
+// handed in again once the caller is done with it.
+//
+// Frames are requested by sequence number, which counts up forever;
+// playback loops, so sequence number s shows frame s % num_frames.
+
+enum {
+    VIDEO_MAX_SLOTS = 8,
+    VIDEO_FRAME_FAILED = -2
+};
+
+typedef struct video_info {
+
+    size_t channels, width, height, frame_size;
+    int num_frames;
+    double fps;
+
+} video_info_t;
+
+typedef struct video video_t;
+
+// returns NULL after printing a message if src can't be opened or
+// isn't a video; fps is only used for image sequences, and max_size
+// works as in read_image()
+video_t* video_open(const char* src, double fps,
+                    int vflip, int max_size,
+                    int num_slots, video_info_t* info);
+
+// give slot memory of info->frame_size bytes to the decoder
+void video_provide_slot(video_t* video, int slot, unsigned char* data);
+
+// returns the slot holding sequence number seq and takes it back from
+// the decoder, or -1 if it isn't decoded yet (unless wait is set, in
+// which case this blocks until it is), or VIDEO_FRAME_FAILED if that
+// frame couldn't be decoded. Either way, frames before seq are no
+// longer needed after this call.
+int video_acquire(video_t* video, long seq, int wait);
+
+void video_close(video_t* video);
+
+#endif
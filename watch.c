@@ -0,0 +1,176 @@
+#include "watch.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef ST_GLFW_USE_INOTIFY
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+enum {
+    WATCH_PATH_LENGTH = 1024
+};
+
+typedef struct watched_file {
+
+    char path[WATCH_PATH_LENGTH];
+    const char* name; // points into path
+    int wd;
+
+} watched_file_t;
+
+struct watcher {
+
+    int fd;
+    
+    watched_file_t files[WATCH_MAX_FILES];
+    int num_files;
+    
+};
+
+#ifdef ST_GLFW_USE_INOTIFY
+
+//////////////////////////////////////////////////////////////////////
+
+watcher_t* watch_create(void) {
+
+    int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0) { return NULL; }
+
+    watcher_t* w = (watcher_t*)calloc(1, sizeof(watcher_t));
+
+    if (!w) {
+        fprintf(stderr, "out of memory in watch_create!\n");
+        exit(1);
+    }
+
+    w->fd = fd;
+
+    return w;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+
+int watch_add(watcher_t* w, const char* path) {
+
+    if (w->num_files >= WATCH_MAX_FILES) {
+        fprintf(stderr, "error: can't watch more than %d files\n",
+                WATCH_MAX_FILES);
+        exit(1);
+    }
+
+    watched_file_t* f = w->files + w->num_files;
+
+    if (snprintf(f->path, WATCH_PATH_LENGTH, "%s", path) >= WATCH_PATH_LENGTH) {
+        fprintf(stderr, "error: path too long to watch: %s\n", path);
+        exit(1);
+    }
+
+    char dir[WATCH_PATH_LENGTH];
+    const char* slash = strrchr(f->path, '/');
+
+    if (slash) {
+        f->name = slash + 1;
+        snprintf(dir, WATCH_PATH_LENGTH, "%.*s",
+                 (int)(slash == f->path ? 1 : slash - f->path), f->path);
+    } else {
+        f->name = f->path;
+        snprintf(dir, WATCH_PATH_LENGTH, ".");
+    }
+
+    // watching the same directory twice just gives back the same wd
+    f->wd = inotify_add_watch(w->fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO);
+
+    if (f->wd < 0) {
+        fprintf(stderr, "error: can't watch directory %s\n", dir);
+        exit(1);
+    }
+
+    return w->num_files++;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+
+int watch_poll(watcher_t* w, int changed[WATCH_MAX_FILES]) {
+
+    char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    int count = 0;
+
+    memset(changed, 0, WATCH_MAX_FILES*sizeof(int));
+
+    ssize_t len;
+    
+    while ((len = read(w->fd, buf, sizeof(buf))) > 0) {
+
+        for (char* ptr=buf; ptr<buf+len; ) {
+
+            const struct inotify_event* event = (const struct inotify_event*)ptr;
+            ptr += sizeof(struct inotify_event) + event->len;
+
+            for (int i=0; i<w->num_files; ++i) {
+
+                const watched_file_t* f = w->files + i;
+
+                // on overflow, assume the worst
+                int hit = ((event->mask & IN_Q_OVERFLOW) ||
+                           (f->wd == event->wd && event->len &&
+                            !strcmp(f->name, event->name)));
+
+                if (hit && !changed[i]) {
+                    changed[i] = 1;
+                    ++count;
+                }
+                
+            }
+            
+        }
+        
+    }
+
+    return count;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+
+void watch_free(watcher_t* w) {
+
+    if (!w) { return; }
+
+    close(w->fd);
+    free(w);
+
+}
+
+#else
+
+//////////////////////////////////////////////////////////////////////
+// no inotify, so nothing to watch with
+
+watcher_t* watch_create(void) {
+    return NULL;
+}
+
+int watch_add(watcher_t* w, const char* path) {
+    return -1;
+}
+
+int watch_poll(watcher_t* w, int changed[WATCH_MAX_FILES]) {
+    return 0;
+}
+
+void watch_free(watcher_t* w) {
+    free(w);
+}
+
+#endif
+
+//////////////////////////////////////////////////////////////////////
+
+const char* watch_path(const watcher_t* w, int id) {
+    return w->files[id].path;
+}
@@ -0,0 +1,28 @@
+#ifndef _WATCH_H_
+#define _WATCH_H_
+
+// Notices when files get rewritten. The directories holding them are
+// watched rather than the files themselves, so that editors that save
+// by renaming a new file over the old one are caught too.
+
+typedef struct watcher watcher_t;
+
+enum {
+    WATCH_MAX_FILES = 64
+};
+
+// returns NULL if watching files isn't supported here
+watcher_t* watch_create(void);
+
+// returns an id for the file, counting up from 0; exits on error
+int watch_add(watcher_t* w, const char* path);
+
+const char* watch_path(const watcher_t* w, int id);
+
+// never blocks; sets changed[id] to 1 for each file changed since the
+// last call and returns how many were
+int watch_poll(watcher_t* w, int changed[WATCH_MAX_FILES]);
+
+void watch_free(watcher_t* w);
+
+#endif
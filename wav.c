@@ -0,0 +1,119 @@
+#include "wav.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+enum {
+    WAV_HEADER_SIZE = 44,
+    WAV_BITS_PER_SAMPLE = 16
+};
+
+//////////////////////////////////////////////////////////////////////
+// .wav files are little-endian no matter the host
+
+void wav_put16(unsigned char* dst, uint32_t x) {
+    dst[0] = x & 0xff;
+    dst[1] = (x >> 8) & 0xff;
+}
+
+void wav_put32(unsigned char* dst, uint32_t x) {
+    wav_put16(dst, x & 0xffff);
+    wav_put16(dst+2, x >> 16);
+}
+
+//////////////////////////////////////////////////////////////////////
+
+int wav_write_header(wav_writer_t* w) {
+
+    unsigned char header[WAV_HEADER_SIZE];
+
+    uint32_t block_align = w->channels * WAV_BITS_PER_SAMPLE / 8;
+    uint32_t data_size = w->frames * block_align;
+
+    memcpy(header+0, "RIFF", 4);
+    wav_put32(header+4, WAV_HEADER_SIZE - 8 + data_size);
+    memcpy(header+8, "WAVE", 4);
+
+    memcpy(header+12, "fmt ", 4);
+    wav_put32(header+16, 16);
+    wav_put16(header+20, 1); // PCM
+    wav_put16(header+22, w->channels);
+    wav_put32(header+24, w->sample_rate);
+    wav_put32(header+28, w->sample_rate * block_align);
+    wav_put16(header+32, block_align);
+    wav_put16(header+34, WAV_BITS_PER_SAMPLE);
+
+    memcpy(header+36, "data", 4);
+    wav_put32(header+40, data_size);
+
+    return (fseek(w->fp, 0, SEEK_SET) == 0 &&
+            fwrite(header, WAV_HEADER_SIZE, 1, w->fp) == 1);
+
+}
+
+//////////////////////////////////////////////////////////////////////
+
+void wav_open(wav_writer_t* w, const char* filename,
+              int sample_rate, int channels) {
+
+    memset(w, 0, sizeof(wav_writer_t));
+
+    w->fp = fopen(filename, "wb");
+
+    if (!w->fp) {
+        fprintf(stderr, "error: can't write %s\n", filename);
+        exit(1);
+    }
+
+    w->channels = channels;
+    w->sample_rate = sample_rate;
+
+    if (!wav_write_header(w)) {
+        fprintf(stderr, "error writing %s\n", filename);
+        exit(1);
+    }
+
+}
+
+//////////////////////////////////////////////////////////////////////
+
+void wav_write(wav_writer_t* w, const int16_t* samples, size_t frames) {
+
+    size_t count = frames * w->channels;
+    unsigned char buf[4096];
+
+    while (count) {
+
+        size_t n = count < sizeof(buf)/2 ? count : sizeof(buf)/2;
+
+        for (size_t i=0; i<n; ++i) {
+            wav_put16(buf + 2*i, (uint16_t)samples[i]);
+        }
+
+        if (fwrite(buf, 2, n, w->fp) != n) {
+            fprintf(stderr, "error writing wav file!\n");
+            exit(1);
+        }
+
+        samples += n;
+        count -= n;
+
+    }
+
+    w->frames += frames;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+
+int wav_close(wav_writer_t* w) {
+
+    int ok = wav_write_header(w);
+
+    if (fclose(w->fp)) { ok = 0; }
+
+    memset(w, 0, sizeof(wav_writer_t));
+
+    return ok;
+
+}
@@ -0,0 +1,29 @@
+#ifndef _WAV_H_
+#define _WAV_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+// Writes 16-bit PCM .wav files a block at a time. The sizes in the
+// header are patched when the file is closed.
+
+typedef struct wav_writer {
+
+    FILE* fp;
+    int channels;
+    int sample_rate;
+    size_t frames; // one sample per channel
+
+} wav_writer_t;
+
+// exits on error
+void wav_open(wav_writer_t* w, const char* filename,
+              int sample_rate, int channels);
+
+// samples are interleaved
+void wav_write(wav_writer_t* w, const int16_t* samples, size_t frames);
+
+// returns 1 on success
+int wav_close(wav_writer_t* w);
+
+#endif
@@ -2,9 +2,12 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdarg.h>
+#include <time.h>
 
 #ifdef ST_GLFW_USE_CURL
 #include <curl/curl.h>
+#include <pthread.h>
 #endif
 
 size_t write_response(void *ptr, size_t size, size_t nmemb, void * b) {
@@ -19,17 +22,77 @@ size_t write_response(void *ptr, size_t size, size_t nmemb, void * b) {
 
 //////////////////////////////////////////////////////////////////////
 
-void fetch_url(const char* url, buffer_t* buf) {
+#ifdef ST_GLFW_USE_CURL
 
-#ifndef ST_GLFW_USE_CURL
+enum {
+    MAX_HOST_CONNECTIONS = 6
+};
 
-    fprintf(stderr, "not compiled with curl support, can't fetching URL!");
-    exit(1);
+// shared between all transfers so that DNS lookups, TLS sessions and
+// open connections to www.shadertoy.com get reused across batches
+CURLSH* curl_share = NULL;
 
-#else
+// fetches run on the image loader and playlist preloader threads at
+// the same time, so curl has to lock whatever part of the share it
+// touches
+pthread_mutex_t curl_share_locks[CURL_LOCK_DATA_LAST];
+pthread_mutex_t curl_init_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+//////////////////////////////////////////////////////////////////////
+
+void lock_share(CURL* handle, curl_lock_data data,
+                curl_lock_access access, void* userptr) {
+    
+    pthread_mutex_lock(curl_share_locks + data);
+    
+}
+
+//////////////////////////////////////////////////////////////////////
+
+void unlock_share(CURL* handle, curl_lock_data data, void* userptr) {
+    
+    pthread_mutex_unlock(curl_share_locks + data);
     
+}
+
+//////////////////////////////////////////////////////////////////////
+
+void www_init() {
+
+    pthread_mutex_lock(&curl_init_mutex);
+
+    if (curl_share) {
+        pthread_mutex_unlock(&curl_init_mutex);
+        return;
+    }
+
     curl_global_init(CURL_GLOBAL_ALL);
 
+    for (int i=0; i<CURL_LOCK_DATA_LAST; ++i) {
+        pthread_mutex_init(curl_share_locks + i, NULL);
+    }
+
+    curl_share = curl_share_init();
+
+    if (!curl_share) {
+        fprintf(stderr, "error initting curl share!\n");
+        exit(1);
+    }
+
+    curl_share_setopt(curl_share, CURLSHOPT_LOCKFUNC, lock_share);
+    curl_share_setopt(curl_share, CURLSHOPT_UNLOCKFUNC, unlock_share);
+    curl_share_setopt(curl_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt(curl_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+    curl_share_setopt(curl_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+
+    pthread_mutex_unlock(&curl_init_mutex);
+    
+}
+
+//////////////////////////////////////////////////////////////////////
+
+CURL* make_easy_handle(const char* url, buffer_t* buf) {
+
     CURL* curl = curl_easy_init();
 
     if (!curl) {
@@ -38,37 +101,189 @@ void fetch_url(const char* url, buffer_t* buf) {
     }
 
     curl_easy_setopt(curl, CURLOPT_URL, url);
-    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1);
+    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(curl, CURLOPT_SHARE, curl_share);
     
     curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_response);
     curl_easy_setopt(curl, CURLOPT_WRITEDATA, buf);
 
-    printf("fetching %s...\n", url);
-    
-    int status = curl_easy_perform(curl);
+    return curl;
+
+}
+
+#endif
+
+//////////////////////////////////////////////////////////////////////
+
+void fetch_urls(int count, const char** urls, buffer_t* bufs,
+                fetch_callback_t callback, void* userdata) {
+
+    if (!count) { return; }
+
+#ifndef ST_GLFW_USE_CURL
 
-    if (status != 0) {
-        fprintf(stderr, "curl error %s\n", curl_easy_strerror(status));
+    fprintf(stderr, "not compiled with curl support, can't fetching URL!");
+    exit(1);
+
+#else
+
+    www_init();
+
+    CURLM* multi = curl_multi_init();
+
+    if (!multi) {
+        fprintf(stderr, "error initting curl multi!\n");
         exit(1);
     }
 
-    long code;
-    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &code);
+    curl_multi_setopt(multi, CURLMOPT_MAX_HOST_CONNECTIONS,
+                      (long)MAX_HOST_CONNECTIONS);
 
-    if (code != 200) {
-        fprintf(stderr, "server responded with code %ld\n", code);
-        exit(1);
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    CURL* handles[count];
+
+    for (int i=0; i<count; ++i) {
+        printf("fetching %s...\n", urls[i]);
+        handles[i] = make_easy_handle(urls[i], bufs + i);
+        curl_easy_setopt(handles[i], CURLOPT_PRIVATE, (void*)(size_t)i);
+        curl_multi_add_handle(multi, handles[i]);
+    }
+
+    int running = count;
+
+    while (running) {
+
+        CURLMcode mc = curl_multi_perform(multi, &running);
+        
+        if (mc == CURLM_OK && running) {
+            mc = curl_multi_poll(multi, NULL, 0, 1000, NULL);
+        }
+
+        if (mc != CURLM_OK) {
+            fprintf(stderr, "curl multi error %s\n", curl_multi_strerror(mc));
+            exit(1);
+        }
+
+        CURLMsg* msg;
+        int msgs_left;
+
+        while ((msg = curl_multi_info_read(multi, &msgs_left))) {
+
+            if (msg->msg != CURLMSG_DONE) { continue; }
+
+            CURL* curl = msg->easy_handle;
+
+            void* priv;
+            curl_easy_getinfo(curl, CURLINFO_PRIVATE, &priv);
+            
+            int idx = (int)(size_t)priv;
+            const char* url = urls[idx];
+            
+            if (msg->data.result != CURLE_OK) {
+                fprintf(stderr, "curl error fetching %s: %s\n",
+                        url, curl_easy_strerror(msg->data.result));
+                exit(1);
+            }
+
+            long code;
+            curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &code);
+
+            if (code != 200) {
+                fprintf(stderr, "server responded with code %ld for %s\n",
+                        code, url);
+                exit(1);
+            }
+
+            double total_time, connect_time;
+            curl_off_t length;
+            
+            curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME, &total_time);
+            curl_easy_getinfo(curl, CURLINFO_CONNECT_TIME, &connect_time);
+            curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD_T, &length);
+            
+            printf("  ...retrieved %s: %ld bytes in %.1f ms (connect %.1f ms)\n",
+                   url, (long)length, total_time*1e3, connect_time*1e3);
+
+            if (callback) { callback(idx, bufs + idx, userdata); }
+
+        }
+        
+    }
+
+    for (int i=0; i<count; ++i) {
+        curl_multi_remove_handle(multi, handles[i]);
+        curl_easy_cleanup(handles[i]);
     }
 
-    printf("  ...retrieved data of length %d\n", (int)buf->size);
+    curl_multi_cleanup(multi);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    if (count > 1) {
+        printf("fetched %d URLs in %.1f ms\n", count,
+               (end.tv_sec - start.tv_sec)*1e3 + (end.tv_nsec - start.tv_nsec)*1e-6);
+    }
 
 #endif
     
 } 
 
+//////////////////////////////////////////////////////////////////////
+
+void fetch_url(const char* url, buffer_t* buf) {
+
+    fetch_urls(1, &url, buf, NULL, NULL);
+    
+}
+
+//////////////////////////////////////////////////////////////////////
+
+void www_cleanup() {
+
+#ifdef ST_GLFW_USE_CURL
+
+    if (curl_share) {
+        
+        curl_share_cleanup(curl_share);
+        curl_share = NULL;
+        
+        for (int i=0; i<CURL_LOCK_DATA_LAST; ++i) {
+            pthread_mutex_destroy(curl_share_locks + i);
+        }
+        
+        curl_global_cleanup();
+        
+    }
+
+#endif
+
+}
 
 //////////////////////////////////////////////////////////////////////
 
+__thread jmp_buf* jsfail_jmp = NULL;
+__thread char jsfail_message[JSFAIL_MESSAGE_LENGTH];
+
+void jsfail(const char* format, ...) {
+
+    va_list args;
+    va_start(args, format);
+    vsnprintf(jsfail_message, JSFAIL_MESSAGE_LENGTH, format, args);
+    va_end(args);
+
+    fprintf(stderr, "%s\n", jsfail_message);
+
+    if (jsfail_jmp) {
+        longjmp(*jsfail_jmp, 1);
+    }
+
+    exit(1);
+    
+}
+
+//////////////////////////////////////////////////////////////////////
 
 json_t* jsobject(const json_t* object,
                   const char* key,
@@ -77,13 +292,11 @@ json_t* jsobject(const json_t* object,
     json_t* j = json_object_get(object, key);
     
     if (!j) {
-        fprintf(stderr, "JSON error: JSON key not found: %s\n", key);
-        exit(1);
+        jsfail("JSON error: JSON key not found: %s", key);
     }
 
     if (json_typeof(j) != type) {
-        fprintf(stderr, "JSON error: incorrect type for %s in JSON\n", key);
-        exit(1);
+        jsfail("JSON error: incorrect type for %s in JSON", key);
     }
 
     return j;
@@ -113,8 +326,7 @@ json_t* jsobject_first(const json_t* object,
         if (!j) { continue; }
         
         if (json_typeof(j) != type) {
-            fprintf(stderr, "JSON error: incorrect type for %s in JSON\n", keys[i]);
-            exit(1);
+            jsfail("JSON error: incorrect type for %s in JSON", keys[i]);
         }
 
         if (idx) { *idx = i; }
@@ -122,13 +334,15 @@ json_t* jsobject_first(const json_t* object,
         
     }
 
-    fprintf(stderr, "JSON error: none of the keys (");
-    for (int i=0; keys[i]; ++i) {
-        if (i)  { fprintf(stderr, ", "); }
-        fprintf(stderr, "%s", keys[i]);
+    char names[JSFAIL_MESSAGE_LENGTH] = "";
+    size_t length = 0;
+    
+    for (int i=0; keys[i] && length < sizeof(names); ++i) {
+        length += snprintf(names + length, sizeof(names) - length,
+                           "%s%s", i ? ", " : "", keys[i]);
     }
-    fprintf(stderr, ") was found\n");
-    exit(1);
+    
+    jsfail("JSON error: none of the keys (%s) was found", names);
 
 }
 
@@ -163,13 +377,11 @@ json_t* jsarray(const json_t* array,
     json_t* j = json_array_get(array, idx);
     
     if (!j) {
-        fprintf(stderr, "JSON error: array item %d not found in JSON\n", idx);
-        exit(1);
+        jsfail("JSON error: array item %d not found in JSON", idx);
     }
 
     if (json_typeof(j) != type) {
-        fprintf(stderr, "JSON error: incorrect type for array item %d in JSON\n", idx);
-        exit(1);
+        jsfail("JSON error: incorrect type for array item %d in JSON", idx);
     }
 
     return j;
@@ -195,13 +407,12 @@ json_t* jsparse(const buffer_t* buf) {
     json_t* json_root = json_loadb(data, size, 0, &error);
     
     if (!json_root) {
-        fprintf(stderr, "JSON error: on line %d: %s\n", error.line, error.text);
-        exit(1);
+        jsfail("JSON error: on line %d: %s", error.line, error.text);
     }
 
     if (!json_is_object(json_root)) {
-        fprintf(stderr, "JSON error: expected JSON root to be object!\n");
-        exit(1);
+        json_decref(json_root);
+        jsfail("JSON error: expected JSON root to be object!");
     }
 
     return json_root;
@@ -2,8 +2,24 @@
 #define _WWW_H_
 
 #include <jansson.h>
+#include <setjmp.h>
 #include "buffer.h"
 
+// The js* helpers below report malformed JSON through jsfail(), which
+// prints the message and exits, unless the calling thread has pointed
+// jsfail_jmp at a jmp_buf, in which case the message is kept in
+// jsfail_message and jsfail() longjmps there instead. Loaders use the
+// same thing for their own errors.
+
+enum {
+    JSFAIL_MESSAGE_LENGTH = 1024
+};
+
+extern __thread jmp_buf* jsfail_jmp;
+extern __thread char jsfail_message[JSFAIL_MESSAGE_LENGTH];
+
+_Noreturn void jsfail(const char* format, ...);
+
 json_t* jsparse(const buffer_t* buf);
 json_t* jsobject(const json_t* object, const char* key, int type);
 
@@ -24,5 +40,15 @@ json_t* jsarray(const json_t* object, int idx, int type);
 
 void fetch_url(const char* url, buffer_t* buf);
 
+typedef void (*fetch_callback_t)(int idx, buffer_t* buf, void* userdata);
+
+// fetch count URLs concurrently, each one into the corresponding
+// buffer; if callback is non-NULL, it is called from this thread as
+// soon as each transfer completes
+void fetch_urls(int count, const char** urls, buffer_t* bufs,
+                fetch_callback_t callback, void* userdata);
+
+void www_cleanup();
+
 
 #endif